@@ -34,8 +34,15 @@
  * A procfs interface is exported to allow a userspace app to extract
  * the DMA addresses of each chunk as well as total memory
  * available. Another procfs interface is provided allowing userspace
- * to read/write to the buffer.  Userspace can use this for debugging
- * and try to warm the caches with the buffer contents.
+ * to read/write and mmap() the buffer.  Userspace can use this for
+ * debugging, try to warm the caches with the buffer contents, or
+ * share descriptor rings with the NFP.
+ *
+ * A further @NFP_PCIEBENCH_XFER_CHUNKS chunks are allocated as a
+ * transfer area, into which the NFP DMAs its test journal and results
+ * (or streams the journal during long running tests).  They are
+ * exported through separate procfs entries so that the tests never
+ * touch them, and userspace can mmap() them to avoid copies.
  *
  * The buffers are DMA mapped to the NFP PCI device.  We obtain the
  * device handle by calling into the main NFP PCI device driver.
@@ -49,6 +56,7 @@
 #include <linux/module.h>
 #include <linux/pci.h>
 #include <linux/proc_fs.h>
+#include <linux/mm.h>
 #include <linux/seq_file.h>
 #include <linux/init.h>
 #include <linux/pci.h>
@@ -115,6 +123,11 @@ MODULE_PARM_DESC(node, "NUMA Node index to allocate memory from");
 #define NFP_PCIEBENCH_CHUNK_SZ (4 * 1024 * 1024)
 #define NFP_PCIEBENCH_CHUNK_PO (10)  /* PAGE ORDER (assuming 4K pages) */
 #define NFP_PCIEBENCH_CHUNKS (NFP_PCIEBENCH_MAX_MEM / NFP_PCIEBENCH_CHUNK_SZ)
+#define NFP_PCIEBENCH_XFER_CHUNKS (16 + 1) /* journal + results */
+#define NFP_PCIEBENCH_XFER_SZ \
+	(NFP_PCIEBENCH_XFER_CHUNKS * NFP_PCIEBENCH_CHUNK_SZ)
+#define NFP_PCIEBENCH_ALL_CHUNKS \
+	(NFP_PCIEBENCH_CHUNKS + NFP_PCIEBENCH_XFER_CHUNKS)
 
 /*
  * Names for procfs entries
@@ -122,6 +135,8 @@ MODULE_PARM_DESC(node, "NUMA Node index to allocate memory from");
 #define NFP_PCIEBENCH_PROC_DMA_ADDRS  "pciebench_dma_addrs-%d"
 #define NFP_PCIEBENCH_PROC_BUF_SZ     "pciebench_buf_sz-%d"
 #define NFP_PCIEBENCH_PROC_BUFFER     "pciebench_buffer-%d"
+#define NFP_PCIEBENCH_PROC_XFER_ADDRS "pciebench_xfer_addrs-%d"
+#define NFP_PCIEBENCH_PROC_XFER       "pciebench_xfer-%d"
 
 /*
  * Global state
@@ -131,13 +146,16 @@ struct nfp_pciebench {
 	struct nfp_cpp *cpp;
 	struct platform_device *nfp_dev_cpp;
 
-	void *buf[NFP_PCIEBENCH_CHUNKS];
-	dma_addr_t buf_dma_addrs[NFP_PCIEBENCH_CHUNKS];
+	/* Test buffer chunks followed by the transfer area chunks */
+	void *buf[NFP_PCIEBENCH_ALL_CHUNKS];
+	dma_addr_t buf_dma_addrs[NFP_PCIEBENCH_ALL_CHUNKS];
 	int id;
 
 	struct proc_dir_entry *proc_dma_addrs;
 	struct proc_dir_entry *proc_buf_sz;
-	struct proc_dir_entry *proc_buffer;	
+	struct proc_dir_entry *proc_buffer;
+	struct proc_dir_entry *proc_xfer_addrs;
+	struct proc_dir_entry *proc_xfer;
 };
 
 /*
@@ -168,6 +186,35 @@ static const struct file_operations npb_dma_addrs_fops = {
 	.release = single_release,
 };
 
+/*
+ * procfs interface for userspace to get the DMA addresses of the
+ * transfer area
+ */
+static int npb_xfer_addrs_show(struct seq_file *m, void *v)
+{
+	struct nfp_pciebench *npb = (struct nfp_pciebench *)m->private;
+	int i;
+
+	for (i = NFP_PCIEBENCH_CHUNKS; i < NFP_PCIEBENCH_ALL_CHUNKS; i++)
+		seq_printf(m, "0x%llx\n", npb->buf_dma_addrs[i]);
+
+	return 0;
+}
+
+static int npb_xfer_addrs_open(struct inode *inode, struct  file *file)
+{
+	struct nfp_pciebench *npb = PDE_DATA(inode);
+	return single_open(file, npb_xfer_addrs_show, npb);
+}
+
+static const struct file_operations npb_xfer_addrs_fops = {
+	.owner = THIS_MODULE,
+	.open = npb_xfer_addrs_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
 /*
  * procfs interface for userspace to get buffer size
  */
@@ -206,7 +253,8 @@ static int npb_buf_release(struct inode *inode, struct file *file)
 };
 
 static ssize_t npb_buf_op(struct file *file, char __user *buf,
-			  size_t count, loff_t *offp, int write)
+			  size_t count, loff_t *offp, int write,
+			  int first_chunk, loff_t size)
 {
 	struct nfp_pciebench *npb = file->private_data;
 	ssize_t ret = 0;
@@ -220,14 +268,14 @@ static ssize_t npb_buf_op(struct file *file, char __user *buf,
 	if (count == 0)
 		return 0;
 
-	if (*offp >= NFP_PCIEBENCH_MAX_MEM)
+	if (*offp >= size)
 		return 0;
 
-	if (*offp + count > NFP_PCIEBENCH_MAX_MEM)
-		count = NFP_PCIEBENCH_MAX_MEM - *offp;
+	if (*offp + count > size)
+		count = size - *offp;
 
 	for (pos = 0; pos < count; pos += len) {
-		chunk_idx = (*offp + pos) / NFP_PCIEBENCH_CHUNK_SZ;
+		chunk_idx = first_chunk + (*offp + pos) / NFP_PCIEBENCH_CHUNK_SZ;
 		chunk_off = (*offp + pos) % NFP_PCIEBENCH_CHUNK_SZ;
 
 		len = count - pos;
@@ -257,13 +305,59 @@ err_out:
 static ssize_t npb_buf_read(struct file *file, char __user *buf,
 			    size_t count, loff_t *offp)
 {
-	return npb_buf_op(file, buf, count, offp, 0);
+	return npb_buf_op(file, buf, count, offp, 0,
+			  0, NFP_PCIEBENCH_MAX_MEM);
 }
 
 static ssize_t npb_buf_write(struct file *file, const char __user *buf,
 			     size_t count, loff_t *offp)
 {
-	return npb_buf_op(file, (char __user *)buf, count, offp, 1);
+	return npb_buf_op(file, (char __user *)buf, count, offp, 1,
+			  0, NFP_PCIEBENCH_MAX_MEM);
+}
+
+/*
+ * Map the chunks, starting at @first_chunk, of an area of @area_sz
+ * bytes into a contiguous user mapping
+ */
+static int npb_mmap_chunks(struct file *file, struct vm_area_struct *vma,
+			   int first_chunk, unsigned long area_sz)
+{
+	struct nfp_pciebench *npb = file->private_data;
+	unsigned long off = vma->vm_pgoff << PAGE_SHIFT;
+	unsigned long size = vma->vm_end - vma->vm_start;
+	unsigned long addr = vma->vm_start;
+	unsigned long chunk_off, len, pfn;
+	int chunk_idx;
+	int err;
+
+	if (off + size > area_sz)
+		return -EINVAL;
+
+	while (size) {
+		chunk_idx = first_chunk + off / NFP_PCIEBENCH_CHUNK_SZ;
+		chunk_off = off % NFP_PCIEBENCH_CHUNK_SZ;
+
+		len = size;
+		if (chunk_off + len > NFP_PCIEBENCH_CHUNK_SZ)
+			len = NFP_PCIEBENCH_CHUNK_SZ - chunk_off;
+
+		pfn = virt_to_phys(npb->buf[chunk_idx] + chunk_off) >> PAGE_SHIFT;
+		err = remap_pfn_range(vma, addr, pfn, len, vma->vm_page_prot);
+		if (err)
+			return err;
+
+		addr += len;
+		off += len;
+		size -= len;
+	}
+
+	return 0;
+}
+
+static int npb_buf_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	return npb_mmap_chunks(file, vma, 0, NFP_PCIEBENCH_MAX_MEM);
 }
 
 static const struct file_operations npb_buf_fops = {
@@ -272,6 +366,40 @@ static const struct file_operations npb_buf_fops = {
 	.release        = npb_buf_release,
 	.read           = npb_buf_read,
 	.write          = npb_buf_write,
+	.mmap           = npb_buf_mmap,
+};
+
+/*
+ * procfs interface to read/write and mmap the transfer area
+ */
+static ssize_t npb_xfer_read(struct file *file, char __user *buf,
+			     size_t count, loff_t *offp)
+{
+	return npb_buf_op(file, buf, count, offp, 0,
+			  NFP_PCIEBENCH_CHUNKS, NFP_PCIEBENCH_XFER_SZ);
+}
+
+static ssize_t npb_xfer_write(struct file *file, const char __user *buf,
+			      size_t count, loff_t *offp)
+{
+	return npb_buf_op(file, (char __user *)buf, count, offp, 1,
+			  NFP_PCIEBENCH_CHUNKS, NFP_PCIEBENCH_XFER_SZ);
+}
+
+static int npb_xfer_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	return npb_mmap_chunks(file, vma, NFP_PCIEBENCH_CHUNKS,
+			       NFP_PCIEBENCH_XFER_SZ);
+}
+
+static const struct file_operations npb_xfer_fops = {
+	.owner          = THIS_MODULE,
+	.open           = npb_buf_open,
+	.release        = npb_buf_release,
+	.read           = npb_xfer_read,
+	.write          = npb_xfer_write,
+	.mmap           = npb_xfer_mmap,
+	.llseek         = default_llseek,
 };
 
 
@@ -279,6 +407,10 @@ static void npb_remove(struct nfp_pciebench *npb)
 {
 	int i;
 
+	if (npb->proc_xfer)
+		proc_remove(npb->proc_xfer);
+	if (npb->proc_xfer_addrs)
+		proc_remove(npb->proc_xfer_addrs);
 	if (npb->proc_buffer)
 		proc_remove(npb->proc_buffer);
 	if (npb->proc_buf_sz)
@@ -286,7 +418,7 @@ static void npb_remove(struct nfp_pciebench *npb)
 	if (npb->proc_dma_addrs)
 		proc_remove(npb->proc_dma_addrs);
 
-	for (i = 0; i < NFP_PCIEBENCH_CHUNKS; i++) {
+	for (i = 0; i < NFP_PCIEBENCH_ALL_CHUNKS; i++) {
 		if (npb->buf_dma_addrs[i])
 			dma_unmap_single(&npb->pdev->dev, npb->buf_dma_addrs[i],
 					 NFP_PCIEBENCH_CHUNK_SZ,
@@ -310,7 +442,7 @@ static int npb_init(struct nfp_pciebench *npb)
 	int err;
 
 	flags = GFP_KERNEL;
-	for (i = 0; i < NFP_PCIEBENCH_CHUNKS; i++) {
+	for (i = 0; i < NFP_PCIEBENCH_ALL_CHUNKS; i++) {
 		/* TODO: node index should be based on system topology */
 		if (node < 0 || node > 1)
 			node = 0;
@@ -368,6 +500,24 @@ static int npb_init(struct nfp_pciebench *npb)
 		goto err;
 	}
 	npb->proc_buffer = pe;
+
+	scnprintf(buf, sizeof(buf), NFP_PCIEBENCH_PROC_XFER_ADDRS, id);
+	pe = proc_create_data(buf, 0, NULL, &npb_xfer_addrs_fops, npb);
+	if (!pe) {
+		pr_err("Failed to create xfer_addrs entry");
+		err = -ENODEV;
+		goto err;
+	}
+	npb->proc_xfer_addrs = pe;
+
+	scnprintf(buf, sizeof(buf), NFP_PCIEBENCH_PROC_XFER, id);
+	pe = proc_create_data(buf, 0, NULL, &npb_xfer_fops, npb);
+	if (!pe) {
+		pr_err("Failed to create xfer entry");
+		err = -ENODEV;
+		goto err;
+	}
+	npb->proc_xfer = pe;
 	return 0;
 
 err:
@@ -29,6 +29,11 @@
 int
 main(void)
 {
+    /* Worker MEs may act as the master of a test slot, which needs
+     * random numbers for address generation. */
+    if (ctx() == 0)
+        prn_init(0xdeadbeef ^ __ME());
+
     /* Just call the main worker function. It does the rest. */
     dma_bw_worker();
     /* NOTREACHED */
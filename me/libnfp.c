@@ -24,7 +24,7 @@ __ME(void)
     unsigned int ctxsts, menum, islclnum;
 
     ctxsts = local_csr_read(local_csr_active_ctx_sts);
-    menum = ((ctxsts >> 3) - 4) & 0x7;
+    menum = ((ctxsts >> 3) - 4) & 0xf;
 #ifdef __NFP_IS_3200
     islclnum = (ctxsts >> 25) & 0xf;
 #else
@@ -56,6 +56,17 @@ ts_hi_read(void)
     return local_csr_read(local_csr_timestamp_high);
 }
 
+__intrinsic void
+prn_init(unsigned int seed)
+{
+    unsigned int tmp;
+
+    tmp = local_csr_read(local_csr_ctx_enables);
+    tmp |= 1 << 30;
+    local_csr_write(local_csr_ctx_enables, tmp);
+    local_csr_write(local_csr_pseudo_random_number, seed);
+}
+
 #ifdef __NFP_IS_3200
 __intrinsic unsigned int
 local_csr_read(int mecsr)
@@ -128,6 +139,19 @@ signal_me(unsigned int islcl, unsigned int me,
 #endif
 }
 
+__intrinsic int
+signal_test(SIGNAL *sig)
+{
+    int ret = 1;
+
+    __asm {
+        br_signal[*sig, raised]
+        alu[ret, --, B, 0]
+    raised:
+    }
+    return ret;
+}
+
 /*
  * Stub library for access to *very* selected NFP features.  Note, we
  * do not perform any sanity checks here on arguments.
@@ -180,6 +204,21 @@ cls_test_sub(__cls void* addr, unsigned int val)
     return tmp;
 }
 
+__intrinsic unsigned int
+cls_test_add(__cls void* addr, unsigned int val)
+{
+    __xrw unsigned int tmp;
+    SIGNAL sig;
+
+    tmp = val;
+#ifdef __NFP_IS_3200
+    __asm cls[test_and_add, tmp, addr, 0, 1], ctx_swap[sig];
+#else
+    __asm cls[test_add, tmp, addr, 0, 1], ctx_swap[sig];
+#endif
+    return tmp;
+}
+
 
 /*
  * Memory unit
@@ -252,8 +291,54 @@ mem_ring_journal_fast(unsigned int rnum, unsigned int addr_hi,
         mem[fast_journal,--, addr_hi, <<8, value, 0], indirect_ref
     }
 }
+
+__intrinsic unsigned int
+mem_test_sub(__mem void *addr, unsigned int val)
+{
+    __xrw unsigned int tmp;
+    unsigned int addr_hi, addr_lo;
+    SIGNAL sig;
+
+    addr_hi = ((unsigned long long)addr >> 8) & 0xff000000;
+    addr_lo = (unsigned long long)addr & 0xffffffff;
+
+    tmp = val;
+    __asm mem[test_subsat, tmp, addr_hi, <<8, addr_lo, 1], ctx_swap[sig];
+    return tmp;
+}
+
+__intrinsic void
+mem_incr(__mem void *addr)
+{
+    unsigned int addr_hi, addr_lo;
+
+    addr_hi = ((unsigned long long)addr >> 8) & 0xff000000;
+    addr_lo = (unsigned long long)addr & 0xffffffff;
+
+    __asm mem[incr, --, addr_hi, <<8, addr_lo];
+}
 #endif /* __NFP_IS_3200 */
 
+__intrinsic void
+mem_fence(unsigned long long addr)
+{
+    __xread unsigned int tmp[2];
+    unsigned int addr_lo;
+    SIGNAL sig;
+
+    addr_lo = addr & 0xffffffff;
+#ifdef __NFP_IS_3200
+    __asm mem[read, tmp[0], addr_lo, 0, 1], ctx_swap[sig];
+#else
+    {
+        unsigned int addr_hi;
+
+        addr_hi = (addr >> 8) & 0xff000000;
+        __asm mem[read32, tmp[0], addr_hi, <<8, addr_lo, 1], ctx_swap[sig];
+    }
+#endif
+}
+
 
 /*
  * PCIe functions
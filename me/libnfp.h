@@ -44,11 +44,24 @@ __intrinsic void signal_next_me(unsigned int ctx, unsigned int sig_no);
 __intrinsic void signal_me(unsigned int isl, unsigned int me,
                            unsigned int ctx, unsigned int sig_no);
 
+/**
+ * Test if @sig has been raised without waiting for it.  Returns
+ * non-zero (and clears @sig) if it was.
+ */
+__intrinsic int signal_test(SIGNAL *sig);
+
+/**
+ * Enable the pseudo random number generator of the ME and seed it.
+ * The generator is advanced every cycle.
+ */
+__intrinsic void prn_init(unsigned int seed);
+
 
 /*
  * CLS functions
  */
 __intrinsic unsigned int cls_test_sub(__cls void* add, unsigned int val);
+__intrinsic unsigned int cls_test_add(__cls void* add, unsigned int val);
 
 /*
  * Memory unit macros and functions
@@ -68,6 +81,13 @@ __intrinsic unsigned int cls_test_sub(__cls void* add, unsigned int val);
     extern const int _name##_ring_no
 #endif
 
+/* 40bit address of a journal's memory */
+#ifdef __NFP_IS_3200
+#define MEM_JOURNAL_ADDR(_name) ((unsigned long long)(unsigned int)_name)
+#else
+#define MEM_JOURNAL_ADDR(_name) ((unsigned long long)__link_sym(#_name))
+#endif
+
 #ifdef __NFP_IS_3200
 #define MEM_JOURNAL_CONFIGURE(_name) \
     mem_journal_setup(_name##_ring_no, _name, sizeof(_name))
@@ -104,6 +124,26 @@ __intrinsic void mem_ring_journal_fast(unsigned int rnum, unsigned int addr_hi,
                                        unsigned int value);
 #endif
 
+/**
+ * Wait until the memory journals written with @MEM_JOURNAL_FAST by
+ * this context so far have reached memory.  Commands from a context to
+ * the same memory unit are processed in order, so a signalled read
+ * from the journal completes after them.
+ */
+__intrinsic void mem_fence(unsigned long long addr);
+
+#define MEM_JOURNAL_FENCE(_name) mem_fence(MEM_JOURNAL_ADDR(_name))
+
+/**
+ * Atomic test and subtract (saturating at 0) and increment of a 32bit
+ * word in memory.  @mem_test_sub returns the previous value.
+ * NFP-6000 only.
+ */
+#ifndef __NFP_IS_3200
+__intrinsic unsigned int mem_test_sub(__mem void *addr, unsigned int val);
+__intrinsic void mem_incr(__mem void *addr);
+#endif
+
 /*
  * PCIe functions
  */
@@ -21,53 +21,42 @@
 #include "libnfp.h"
 #include "pciebench.h"
 
+__import __cls volatile struct stream_state stream_state;
+__import __cls volatile uint32_t journal_pos;
+__import __cls volatile uint32_t dbg_journal_pos;
+
+#ifdef __NFP_IS_3200
+/* Test journal memory (see shared.c) */
+__import __mem uint32_t test_journal[PCIEBENCH_JOURNAL_SZ];
+#endif
+
 /*
- * Execute the @LAT_CMD_RD and @LAT_CMD_WRRD tests
+ * The measured loop of @cmd_lat.  @test, @stream and @timeline must be
+ * compile time constants for the loop to be free of test and flag
+ * checks (see @PCIEBENCH_SPECIALISE).  Otherwise the checks sit
+ * outside the timed part of each transaction, but still add to the
+ * cycles of every iteration.  Sets the timestamps and latency
+ * statistics in @r and returns the number of transactions performed.
  */
-__intrinsic int32_t
-cmd_lat(__gpr struct test_params *p, __gpr struct test_result *r, int test)
+__intrinsic static uint32_t
+cmd_lat_loop(uint32_t slot, __gpr struct test_result *r, const int test,
+             const int stream, uint32_t max_trans, uint32_t trans_sz,
+             const int timeline)
 {
     __xwrite uint32_t w_data[16];
     __xread uint32_t r_data[16];
     SIGNAL w_sig, r_sig;
 
-    __gpr uint32_t arg_trans_sz, arg_hoff, arg_win, arg_flags;
-
-    __gpr uint32_t trans, max_trans = PCIEBENCH_LAT_TRANS;
+    __gpr uint32_t trans;
     __gpr uint32_t addr_hi, addr_lo;
     __gpr uint32_t chunk_idx, old_chunk_idx;
 
-    __gpr uint32_t t0, t1;
-    __gpr int i, ret = 0;
-
-    arg_flags = p->p0;
-    arg_trans_sz = p->p1;
-    arg_win = p->p2;
-    arg_hoff = p->p3;
-
-    /* Sanity checks */
-    if ((arg_trans_sz + arg_hoff > 4096) ||
-        (arg_trans_sz + arg_hoff > arg_win)) {
-        ret = -1;
-        goto out;
-    }
-
-    /* Init the addresses array */
-    dma_addr_init(arg_win, arg_trans_sz, arg_hoff, arg_flags);
-
-    /* Thrash the cache if requested */
-    if (arg_flags & LAT_FLAGS_THRASH)
-        host_trash_cache();
-
-    if (arg_flags & LAT_FLAGS_LONG)
-        max_trans = PCIEBENCH_JOURNAL_SZ;
-
-    /* Warm the window if requested */
-    if (arg_flags & LAT_FLAGS_WARM)
-        host_warm_cache(arg_win);
+    __gpr uint32_t t0, t1, t0_hi, lat, lat_min = 0xffffffff, lat_max = 0;
+    __gpr uint64_t lat_sum = 0;
+    __gpr int i;
 
     /* Set up first address */
-    dma_addr_from_idx(0, &addr_hi, &addr_lo, &old_chunk_idx);
+    dma_addr_from_idx(slot, 0, &addr_hi, &addr_lo, &old_chunk_idx);
     pcie_c2p_barcfg(PCIEBENCH_PCIE_ISL, PCIEBENCH_C2P_IDX, addr_hi, addr_lo, 0);
 
     r->start_lo = ts_lo_read();
@@ -77,42 +66,54 @@ cmd_lat(__gpr struct test_params *p, __gpr struct test_result *r, int test)
 
         /* For write tests create a unique test pattern */
         if (test == LAT_CMD_WRRD)
-            for (i = 0; i < arg_trans_sz / sizeof(uint32_t); i++)
+            for (i = 0; i < trans_sz / sizeof(uint32_t); i++)
                 w_data[i] = 0x0000beef | ((0xffff - trans) << 16);
 
         t0 = ts_lo_read();
 
-        switch (test) {
-
-        case LAT_CMD_RD:
+        if (test == LAT_CMD_RD) {
             __pcie_read(r_data, PCIEBENCH_PCIE_ISL, PCIEBENCH_C2P_IDX,
-                        addr_hi, addr_lo, arg_trans_sz, 64, sig_done, &r_sig);
+                        addr_hi, addr_lo, trans_sz, 64, sig_done, &r_sig);
             wait_for_all(&r_sig);
             __implicit_read(r_data);
-            break;
-
-        case LAT_CMD_WRRD:
+        } else {
             __pcie_write(w_data, PCIEBENCH_PCIE_ISL, PCIEBENCH_C2P_IDX,
-                         addr_hi, addr_lo, arg_trans_sz, 64, sig_done, &w_sig);
+                         addr_hi, addr_lo, trans_sz, 64, sig_done, &w_sig);
             __pcie_read(r_data, PCIEBENCH_PCIE_ISL, PCIEBENCH_C2P_IDX,
-                        addr_hi, addr_lo, arg_trans_sz, 64, sig_done, &r_sig);
+                        addr_hi, addr_lo, trans_sz, 64, sig_done, &r_sig);
             wait_for_all(&w_sig, &r_sig);
             __implicit_read(w_data);
             __implicit_read(r_data);
-            break;
-
-        default:
-            ret = -2;
-            goto out;
         }
 
         t1 = ts_lo_read();
-        MEM_JOURNAL_FAST(test_journal, t1 - t0);
+        lat = t1 - t0;
+        MEM_JOURNAL_FAST(test_journal, lat);
+
+        /* Keep summary stats, e.g. for sweeps which don't read the
+         * journal */
+        if (lat < lat_min)
+            lat_min = lat;
+        if (lat > lat_max)
+            lat_max = lat;
+        lat_sum += lat;
+
+        if (timeline) {
+            t0_hi = ts_hi_read();
+            MEM_JOURNAL_FAST(debug_journal, t0_hi);
+            MEM_JOURNAL_FAST(debug_journal, t0);
+        } else {
+            MEM_JOURNAL_FAST(debug_journal, addr_hi);
+            MEM_JOURNAL_FAST(debug_journal, addr_lo);
+        }
 
-        MEM_JOURNAL_FAST(debug_journal, addr_hi);
-        MEM_JOURNAL_FAST(debug_journal, addr_lo);
+        /* Let the drainer know about each batch of journal entries */
+        if (stream && !((trans + 1) & PCIEBENCH_STREAM_BATCH_mask)) {
+            MEM_JOURNAL_FENCE(test_journal);
+            stream_state.prod = trans + 1;
+        }
 
-       dma_addr_from_idx(trans, &addr_hi, &addr_lo, &chunk_idx);
+        dma_addr_from_idx(slot, trans, &addr_hi, &addr_lo, &chunk_idx);
         if (chunk_idx != old_chunk_idx) {
             pcie_c2p_barcfg(PCIEBENCH_PCIE_ISL, PCIEBENCH_C2P_IDX,
                             addr_hi, addr_lo, 0);
@@ -122,10 +123,101 @@ cmd_lat(__gpr struct test_params *p, __gpr struct test_result *r, int test)
 
     r->end_lo = ts_lo_read();
     r->end_hi = ts_hi_read();
+
+    r->r3 = lat_min;
+    r->r4 = lat_max;
+    r->r5 = lat_sum >> 32;
+    r->r6 = lat_sum & 0xffffffff;
+
+    return trans;
+}
+
+/*
+ * Execute the @LAT_CMD_RD and @LAT_CMD_WRRD tests
+ */
+__intrinsic int32_t
+cmd_lat(uint32_t slot, __gpr struct test_params *p,
+        __gpr struct test_result *r, int test)
+{
+    __gpr uint32_t arg_trans_sz, arg_hoff, arg_win, arg_flags;
+
+    __gpr uint32_t trans, max_trans = PCIEBENCH_LAT_TRANS;
+    __gpr uint32_t jpos, dpos;
+    __gpr int ret = 0;
+
+    arg_flags = p->p0;
+    arg_trans_sz = p->p1;
+    arg_win = p->p2;
+    arg_hoff = p->p3;
+
+    /* Sanity checks */
+    if ((arg_trans_sz + arg_hoff > 4096) ||
+        (arg_trans_sz + arg_hoff > arg_win)) {
+        ret = -1;
+        goto out;
+    }
+
+    /* Thrash the cache or warm the window if requested, before the
+     * addresses array is set up as in @dma_lat */
+    if (arg_flags & LAT_FLAGS_THRASH)
+        host_trash_cache(slot);
+    if (arg_flags & LAT_FLAGS_WARM)
+        host_warm_cache(slot, arg_win);
+
+    /* Init the addresses array */
+    dma_addr_init(slot, arg_win, arg_trans_sz, arg_hoff, arg_flags);
+
+    if (arg_flags & LAT_FLAGS_LONG)
+        max_trans = PCIEBENCH_JOURNAL_SZ;
+    if (p->p5)
+        max_trans = p->p5;
+
+    /* Stream the journal to the host if requested */
+    if (arg_flags & LAT_FLAGS_STREAM) {
+        if (!p->p5 || stream_start()) {
+            ret = -1;
+            goto out;
+        }
+    }
+
+    /* Reserve the journal entries of this test, one per transaction
+     * in the test journal and two in the debug journal */
+    jpos = cls_test_add((__cls void *)&journal_pos, max_trans);
+    dpos = cls_test_add((__cls void *)&dbg_journal_pos, 2 * max_trans);
+    if (arg_flags & LAT_FLAGS_STREAM)
+        stream_state.base = jpos;
+
+#ifdef PCIEBENCH_SPECIALISE
+    if (arg_flags & LAT_FLAGS_STREAM) {
+        if (arg_flags & LAT_FLAGS_TIMELINE)
+            trans = cmd_lat_loop(slot, r, test, 1, max_trans, arg_trans_sz,
+                                 1);
+        else
+            trans = cmd_lat_loop(slot, r, test, 1, max_trans, arg_trans_sz,
+                                 0);
+    } else {
+        if (arg_flags & LAT_FLAGS_TIMELINE)
+            trans = cmd_lat_loop(slot, r, test, 0, max_trans, arg_trans_sz,
+                                 1);
+        else
+            trans = cmd_lat_loop(slot, r, test, 0, max_trans, arg_trans_sz,
+                                 0);
+    }
+#else
+    trans = cmd_lat_loop(slot, r, test, arg_flags & LAT_FLAGS_STREAM,
+                         max_trans, arg_trans_sz,
+                         arg_flags & LAT_FLAGS_TIMELINE);
+#endif
+
+    if (arg_flags & LAT_FLAGS_STREAM) {
+        MEM_JOURNAL_FENCE(test_journal);
+        stream_stop(trans);
+    }
+
     r->r0 = trans;
-    r->r1 = 0;
-    r->r2 = 0;
-    r->r3 = 0;
+    r->r1 = jpos & (PCIEBENCH_JOURNAL_SZ - 1);
+    r->r2 = dpos & (PCIEBENCH_DBG_JOURNAL_SZ - 1);
+    r->r7 = 0;
 
 out:
     return ret;
@@ -23,11 +23,50 @@
 #include "pciebench.h"
 
 /* Location where host writes test parameters */
-__import __cls volatile int32_t test_ctrl;
-__import __cls volatile struct test_params test_params;
+__import __cls volatile int32_t test_ctrl[PCIEBENCH_SLOTS];
+__import __cls volatile struct test_params test_params[PCIEBENCH_SLOTS];
+__import __cls volatile struct test_slot test_slots[PCIEBENCH_SLOTS];
+__import __cls volatile uint32_t slot_busy[PCIEBENCH_SLOTS];
+__import __cls volatile uint32_t slot_start[PCIEBENCH_LAST_WORKER_ME + 1];
+__import __cls volatile struct stream_state stream_state;
+__import __cls volatile uint32_t journal_pos;
+__import __cls volatile uint32_t dbg_journal_pos;
+__import __cls volatile uint64_t host_dma_addrs[PCIEBENCH_CHUNKS];
+__import __cls volatile uint64_t host_xfer_addrs[PCIEBENCH_XFER_CHUNKS];
+__import __cls volatile struct rate_spec rate_spec[PCIEBENCH_SLOTS];
+__import __cls volatile struct duplex_spec duplex_spec[PCIEBENCH_SLOTS];
+__import __cls volatile uint32_t size_dist[PCIEBENCH_SLOTS *
+                                           PCIEBENCH_SIZE_DIST_SZ];
+__import __emem struct test_result xfer_result_buf[PCIEBENCH_SLOTS];
+
+#ifdef __NFP_IS_3200
+/* Test journal memory (see shared.c) */
+__import __mem uint32_t test_journal[PCIEBENCH_JOURNAL_SZ];
+#endif
+
+__import __emem struct worker_stats worker_stats[PCIEBENCH_WORKER_STATS];
+
+/* Doorbells and batches of @RING_DESC */
+__import __cls volatile uint32_t ring_doorbell[PCIEBENCH_SLOTS];
+__import __emem struct ring_desc ring_descs[PCIEBENCH_SLOTS *
+                                            PCIEBENCH_RING_BATCH];
+__import __emem struct ring_cmpl ring_cmpls[PCIEBENCH_SLOTS *
+                                            PCIEBENCH_RING_BATCH];
+
+/* Clock synchronisation with the host */
+__import __cls volatile uint32_t clock_sync_req[PCIEBENCH_SLOTS];
+__import __emem struct clock_stamp clock_stamps[PCIEBENCH_SLOTS];
+__import __emem struct clock_stamp fresh_lines[PCIEBENCH_SLOTS];
+
+#if PCIEBENCH_ISLANDS > 1
+__import __emem volatile struct island_job island_job;
+#endif
 
 /* Global, shared test parameters, mostly for DMA BW tests */
 __shared __gpr static uint32_t test_no;
+__shared __gpr static uint32_t arg_slot;
+__shared __gpr static uint32_t arg_me_first;
+__shared __gpr static uint32_t arg_me_last;
 
 __shared __gpr static uint32_t arg_flags;
 __shared __gpr static uint32_t arg_trans_sz;
@@ -35,20 +74,93 @@ __shared __gpr static uint32_t arg_win;
 __shared __gpr static uint32_t arg_hoff;
 __shared __gpr static uint32_t arg_doff;
 
-/* CLS variable to hold number of DMAs to perform */
-__export __shared __cls uint32_t num_dma_trans;
+/* Index of the transaction counter of this ME in @num_dma_trans */
+__shared __gpr static uint32_t arg_trans_idx;
+
+/* CPP address of the NFP buffer (see @nfp_buf_select) */
+__shared __gpr static uint32_t arg_buf_hi;
+__shared __gpr static uint32_t arg_buf_lo;
+
+#if PCIEBENCH_ISLANDS > 1
+/* Worker islands used by the test and the master (see @island_job) */
+__shared __gpr static uint32_t arg_islands;
+__shared __gpr static uint32_t arg_master;
+#endif
+
+/* CLS variable to hold number of DMAs to perform (per slot).  The
+ * write pool of a duplex test has its own counter in the second half
+ * (see "Duplex bandwidth tests" in pciebench.h). */
+__export __shared __cls uint32_t num_dma_trans[PCIEBENCH_SLOTS * 2];
+
+/* State of duplex tests: Pools finished (per slot) and the time the
+ * last DMA of each pool completed (indexed like @num_dma_trans) */
+__export __shared __cls uint32_t duplex_done[PCIEBENCH_SLOTS];
+__export __shared __cls uint32_t duplex_end[PCIEBENCH_SLOTS * 2];
+
+/* Arguments of a host fill for the worker MEs of a slot (see @host_fill) */
+struct fill_args {
+    uint32_t size;              /*< Bytes to write, 0 if no fill active */
+    uint32_t base;              /*< Offset into the host buffer */
+    uint32_t unit;              /*< Size of each DMA */
+    uint32_t flags;             /*< @LAT_FLAGS_RANDOM or 0 */
+};
+__export __shared __cls struct fill_args fill_args[PCIEBENCH_SLOTS];
+
+/* State of rate controlled tests (per slot): The start time and the
+ * schedule (in cycles) and the number of DMAs completed */
+__export __shared __cls uint32_t rate_start[PCIEBENCH_SLOTS];
+__export __shared __cls uint32_t rate_vtime[PCIEBENCH_SLOTS];
+__export __shared __cls uint32_t rate_done[PCIEBENCH_SLOTS];
+
+/* -ln(u) * 256 for u uniformly spaced in (0, 1], for exponentially
+ * distributed inter-arrival times with a mean of 256 */
+__export __shared __cls uint32_t rate_exp_tab[256] = {
+    PCIEBENCH_RATE_EXP_MAX, 1316, 1185, 1099, 1035,  983,  940,  904,
+     872,  843,  818,  794,  773,  753,  735,  718,
+     702,  687,  673,  659,  646,  634,  623,  611,
+     601,  590,  581,  571,  562,  553,  545,  536,
+     528,  521,  513,  506,  499,  492,  485,  478,
+     472,  466,  460,  454,  448,  442,  437,  431,
+     426,  421,  416,  411,  406,  401,  396,  391,
+     387,  382,  378,  374,  369,  365,  361,  357,
+     353,  349,  345,  341,  337,  334,  330,  327,
+     323,  319,  316,  313,  309,  306,  303,  299,
+     296,  293,  290,  287,  284,  281,  278,  275,
+     272,  269,  266,  263,  261,  258,  255,  252,
+     250,  247,  245,  242,  239,  237,  234,  232,
+     229,  227,  225,  222,  220,  217,  215,  213,
+     210,  208,  206,  204,  202,  199,  197,  195,
+     193,  191,  189,  187,  185,  182,  180,  178,
+     176,  174,  172,  171,  169,  167,  165,  163,
+     161,  159,  157,  155,  154,  152,  150,  148,
+     146,  145,  143,  141,  139,  138,  136,  134,
+     133,  131,  129,  128,  126,  124,  123,  121,
+     120,  118,  116,  115,  113,  112,  110,  109,
+     107,  106,  104,  103,  101,  100,   98,   97,
+      95,   94,   92,   91,   89,   88,   87,   85,
+      84,   82,   81,   80,   78,   77,   76,   74,
+      73,   72,   70,   69,   68,   66,   65,   64,
+      63,   61,   60,   59,   58,   56,   55,   54,
+      53,   51,   50,   49,   48,   46,   45,   44,
+      43,   42,   41,   39,   38,   37,   36,   35,
+      34,   32,   31,   30,   29,   28,   27,   26,
+      25,   24,   22,   21,   20,   19,   18,   17,
+      16,   15,   14,   13,   12,   11,   10,    9,
+       8,    7,    6,    5,    4,    3,    2,    1
+};
 
 
 /*
  * Fill out all the common parts of the DMA command structure, plus
- * other setup required for DMA engines tests.
+ * other setup required for DMA engines tests.  The NFP side of the
+ * DMA is the MU address @cpp_hi/@cpp_lo.
  *
  * Once setup, the caller only needs to patch in the PCIe address and
  * is ready to go.
  */
 __intrinsic static void
-pcie_dma_setup(__gpr struct nfp_pcie_dma_cmd *cmd,
-               int signo, uint32_t len, int d_off)
+pcie_dma_setup_cpp(__gpr struct nfp_pcie_dma_cmd *cmd, int signo,
+                   uint32_t len, uint32_t cpp_hi, uint32_t cpp_lo)
 {
     unsigned int meid = __MEID;
 
@@ -75,8 +187,8 @@ pcie_dma_setup(__gpr struct nfp_pcie_dma_cmd *cmd,
         cmd->token = 0;
         cmd->completion = cmpl.completion;
 
-        cmd->cpp_addr_hi = 0;
-        cmd->cpp_addr_lo = (uint32_t)((uint64_t)nfp_buf & 0xffffffff) + d_off;
+        cmd->cpp_addr_hi = cpp_hi;
+        cmd->cpp_addr_lo = cpp_lo;
         cmd->len = len;
     }
 #else
@@ -105,8 +217,8 @@ pcie_dma_setup(__gpr struct nfp_pcie_dma_cmd *cmd,
                          (cmd->__raw[1] & mode_msk_inv));
 
         cmd->cpp_token = 0;
-        cmd->cpp_addr_hi = 0;
-        cmd->cpp_addr_lo = (uint32_t)((uint64_t)nfp_buf & 0xffffffff) + d_off;
+        cmd->cpp_addr_hi = cpp_hi;
+        cmd->cpp_addr_lo = cpp_lo;
         /* On the 6k the length is length - 1 */
         cmd->length = len - 1;
     }
@@ -114,56 +226,312 @@ pcie_dma_setup(__gpr struct nfp_pcie_dma_cmd *cmd,
 }
 
 /*
- * Execute the @LAT_DMA_RD and @LAT_DMA_WRRD tests
+ * Select the NFP buffer in memory @mem (see "NFP buffer memories" in
+ * pciebench.h) for the DMAs of this ME.  Returns non-zero if @mem is
+ * not supported.
  */
-__intrinsic int32_t
-dma_lat(__gpr struct test_params *p, __gpr struct test_result *r, int test)
+__intrinsic static int
+nfp_buf_select(uint32_t mem)
 {
-    __gpr uint32_t trans, max_trans = PCIEBENCH_LAT_TRANS;
-    __gpr uint32_t addr_hi, addr_lo;
-    __gpr uint32_t unused;
+    __gpr uint64_t addr;
 
-    __gpr uint32_t t0, t1;
-    __gpr int ret = 0;
+    switch (mem) {
+    case NFP_BUF_DEFAULT:
+#ifdef __NFP_IS_3200
+    case NFP_BUF_EMEM:
+#else
+    case NFP_BUF_CTM:
+#endif
+        arg_buf_hi = 0;
+        arg_buf_lo = (uint32_t)((uint64_t)nfp_buf & 0xffffffff);
+        return 0;
+#ifndef __NFP_IS_3200
+    case NFP_BUF_IMEM:
+        addr = (uint64_t)nfp_buf_imem;
+        break;
+    case NFP_BUF_EMEM:
+        addr = (uint64_t)nfp_buf_emem;
+        break;
+#endif
+    default:
+        return -1;
+    }
 
-    __gpr struct nfp_pcie_dma_cmd dma_cmd;
-    __xwrite struct nfp_pcie_dma_cmd dma_cmd_wr;
+    arg_buf_hi = addr >> 32;
+    arg_buf_lo = addr & 0xffffffff;
+    return 0;
+}
 
-    SIGNAL cmpl_sig, enq_sig;
+/*
+ * Set the PCIe TLP attributes of a DMA command according to the
+ * @LAT_FLAGS_RO and @LAT_FLAGS_NS bits of @flags.
+ *
+ * The NFP-3200 has the attributes in the descriptor.  On the NFP-6000
+ * they live in the DMA config registers, so each combination gets its
+ * own even config register (2, 4 or 6) which the descriptor then
+ * selects.  Config register 0 stays the default without attributes.
+ * All writers of a register write the same value, so concurrent tests
+ * do not interfere with each other.
+ */
+__intrinsic static void
+pcie_dma_set_attrs(__gpr struct nfp_pcie_dma_cmd *cmd, uint32_t flags)
+{
+#if __NFP_IS_3200
+    cmd->relaxed = (flags & LAT_FLAGS_RO) ? 1 : 0;
+    cmd->no_snoop = (flags & LAT_FLAGS_NS) ? 1 : 0;
+#else
+    struct nfp_pcie_dma_cfg cfg;
+    __xwrite struct nfp_pcie_dma_cfg cfg_wr;
+    unsigned int attrs;
+
+    attrs = (flags & (LAT_FLAGS_RO | LAT_FLAGS_NS)) >> 8;
+    if (!attrs)
+        return;
+
+    cfg.__raw = 0;
+    cfg.target_64_even = 1;
+    cfg.cpp_target_even = 7;
+    cfg.relaxed_order_even = (attrs & 1);
+    cfg.no_snoop_even = (attrs >> 1);
+    cfg.target_64_odd = 1;
+    cfg.cpp_target_odd = 7;
+    cfg.relaxed_order_odd = (attrs & 1);
+    cfg.no_snoop_odd = (attrs >> 1);
+
+    cfg_wr = cfg;
+    pcie_dma_cfg_set_pair(0, attrs * 2, &cfg_wr);
+
+    cmd->dma_cfg_index = attrs * 2;
+#endif
+}
 
-    arg_flags = p->p0;
-    arg_trans_sz = p->p1;
-    arg_win = p->p2;
-    arg_hoff = p->p3;
-    arg_doff = p->p4;
+/*
+ * Set up a DMA command for transfers to/from the selected NFP buffer
+ * (see @nfp_buf_select) at offset @d_off with the TLP attributes of
+ * the current test (see @pcie_dma_set_attrs).
+ */
+__intrinsic static void
+pcie_dma_setup(__gpr struct nfp_pcie_dma_cmd *cmd,
+               int signo, uint32_t len, int d_off)
+{
+    pcie_dma_setup_cpp(cmd, signo, len, arg_buf_hi, arg_buf_lo + d_off);
+    pcie_dma_set_attrs(cmd, arg_flags);
+}
 
-    /* Sanity checks */
-    if ((arg_trans_sz + arg_hoff > 4096) ||
-        (arg_trans_sz + arg_hoff > arg_win)) {
-        ret = -1;
-        goto out;
+/*
+ * Change the length of a DMA command set up with @pcie_dma_setup.
+ */
+__intrinsic static void
+pcie_dma_set_len(__gpr struct nfp_pcie_dma_cmd *cmd, uint32_t len)
+{
+#if __NFP_IS_3200
+    cmd->len = len;
+#else
+    cmd->length = len - 1;
+#endif
+}
+
+/*
+ * Set up a DMA command like @pcie_dma_setup but without a completion
+ * signal, for all but the last descriptor of a chained DMA.
+ */
+__intrinsic static void
+pcie_dma_setup_link(__gpr struct nfp_pcie_dma_cmd *cmd, int d_off)
+{
+    pcie_dma_setup(cmd, 0, PCIEBENCH_XFER_DMA_SZ, d_off);
+}
+
+/*
+ * Issue a chained DMA of @len bytes between the host at
+ * @addr_hi/@addr_lo and the NFP buffer on @queue and wait for its
+ * completion (see "Chained DMAs" in pciebench.h).  @cmd and @link are
+ * set up with @pcie_dma_setup and @pcie_dma_setup_link for the same
+ * device offset, @cmd signalling @cmpl_sig.
+ */
+__intrinsic static void
+pcie_dma_chain(__gpr struct nfp_pcie_dma_cmd *cmd,
+               __gpr struct nfp_pcie_dma_cmd *link, uint32_t queue,
+               uint32_t addr_hi, uint32_t addr_lo, uint32_t len,
+               SIGNAL *cmpl_sig)
+{
+    __gpr struct nfp_pcie_dma_cmd desc;
+    __xwrite struct nfp_pcie_dma_cmd desc_wr;
+    __gpr uint32_t cpp_lo, seg;
+
+    SIGNAL enq_sig;
+
+    desc = *link;
+    cpp_lo = cmd->cpp_addr_lo;
+
+    for (;;) {
+        seg = 0x1000 - (addr_lo & 0xfff);
+        if (seg > PCIEBENCH_XFER_DMA_SZ)
+            seg = PCIEBENCH_XFER_DMA_SZ;
+        if (seg >= len)
+            break;
+
+        desc.cpp_addr_lo = cpp_lo;
+        desc.pcie_addr_hi = addr_hi;
+        desc.pcie_addr_lo = addr_lo;
+        pcie_dma_set_len(&desc, seg);
+        desc_wr = desc;
+        __pcie_dma_enq(0, &desc_wr, queue, ctx_swap, &enq_sig);
+
+        cpp_lo += seg;
+        addr_lo += seg;
+        if (addr_lo < seg)
+            addr_hi++;
+        len -= seg;
     }
 
-    /* Init the addresses array */
-    dma_addr_init(arg_win, arg_trans_sz, arg_hoff, arg_flags);
+    /* The last descriptor signals the completion of the chain */
+    desc = *cmd;
+    desc.cpp_addr_lo = cpp_lo;
+    desc.pcie_addr_hi = addr_hi;
+    desc.pcie_addr_lo = addr_lo;
+    pcie_dma_set_len(&desc, len);
+    desc_wr = desc;
+    __pcie_dma_enq(0, &desc_wr, queue, sig_done, &enq_sig);
+    wait_for_all(cmpl_sig, &enq_sig);
+}
+
+/*
+ * Host cache warming and thrashing
+ *
+ * Both write to a region of host memory with DMAs issued by all worker
+ * contexts of the slot, using the same mechanism as the bandwidth
+ * tests (see below) with the internal test @HOST_FILL.  The region is
+ * split into units of equal size (the largest power of two up to
+ * @PCIEBENCH_XFER_DMA_SZ dividing the region size) and twice as many
+ * DMAs as there are units are issued, either to random units or
+ * sequentially.  The content written is whatever is in the NFP buffer.
+ *
+ * This clobbers the shared test parameters, so it must be called
+ * before they are set up.
+ */
+__intrinsic static void
+host_fill(uint32_t slot, uint32_t base, uint32_t size, uint32_t flags)
+{
+    __gpr uint32_t unit;
 
-    /* Thrash the cache if requested */
-    if (arg_flags & LAT_FLAGS_THRASH)
-        host_trash_cache();
+    SIGNAL dma_ctrl_sig;
+    __assign_relative_register(&dma_ctrl_sig, PCIEBENCH_CTRL_SIGNO);
 
-    if (arg_flags & LAT_FLAGS_LONG)
-        max_trans = PCIEBENCH_JOURNAL_SZ;
+    unit = size & -size;
+    if (unit > PCIEBENCH_XFER_DMA_SZ)
+        unit = PCIEBENCH_XFER_DMA_SZ;
+
+    /* Shared registers for the contexts of this ME, CLS for others */
+    test_no = HOST_FILL;
+    arg_slot = slot;
+    arg_me_first = test_slots[slot].me_first;
+    arg_me_last = test_slots[slot].me_last;
+    arg_flags = flags;
+    arg_trans_sz = unit;
+    arg_win = size;
+    arg_hoff = base;
+    arg_doff = 0;
+    nfp_buf_select(NFP_BUF_DEFAULT);
+
+    fill_args[slot].base = base;
+    fill_args[slot].unit = unit;
+    fill_args[slot].flags = flags;
+    fill_args[slot].size = size;
+
+    num_dma_trans[slot] = 2 * (size / unit);
+
+    signal_next_ctx(PCIEBENCH_CTRL_SIGNO);
+    wait_for_all(&dma_ctrl_sig);
+
+    fill_args[slot].size = 0;
+}
+
+/*
+ * The part of the host buffer a slot owns: From its @host_off up to the
+ * next @host_off of another slot, or the end of the host buffer.
+ */
+__intrinsic static uint32_t
+slot_host_end(uint32_t slot)
+{
+    __gpr uint32_t s, start, off, end = PCIEBENCH_MAX_MEM;
+
+    start = test_slots[slot].host_off;
+    for (s = 0; s < PCIEBENCH_SLOTS; s++) {
+        off = test_slots[s].host_off;
+        if (off > start && off < end)
+            end = off;
+    }
+    return end;
+}
+
+__intrinsic void
+host_trash_cache(uint32_t slot)
+{
+    __gpr uint32_t base;
+
+    base = test_slots[slot].host_off;
+    host_fill(slot, base, slot_host_end(slot) - base, LAT_FLAGS_RANDOM);
+}
+
+__intrinsic void
+host_warm_cache(uint32_t slot, int win_sz)
+{
+    host_fill(slot, test_slots[slot].host_off, win_sz, 0);
+}
+
+/*
+ * Check the size @trans_sz and the host and device offsets @h_off and
+ * @d_off of DMA transactions.  Returns non-zero if they are invalid.
+ */
+__intrinsic static int
+dma_trans_check(uint32_t trans_sz, uint32_t h_off, uint32_t d_off)
+{
+    if (trans_sz > PCIEBENCH_MAX_TRANS_SZ)
+        return -1;
+    /* Transactions up to 4K must fit into a 4K page */
+    if (trans_sz <= 4096 && trans_sz + h_off > 4096)
+        return -1;
+    if (trans_sz + d_off > NFP_BUF_SZ)
+        return -1;
+    return 0;
+}
 
-    /* Warm the window if requested */
-    if (arg_flags & LAT_FLAGS_WARM)
-        host_warm_cache(arg_win);
+/*
+ * The measured loop of @dma_lat.  @test, @stream, @timeline and @chain
+ * (for chained DMAs) must be compile time constants for the loop to be
+ * free of test and flag checks (see @PCIEBENCH_SPECIALISE).  Sets the
+ * timestamps and latency statistics in @r and returns the number of
+ * transactions performed.
+ */
+__intrinsic static uint32_t
+dma_lat_loop(uint32_t slot, __gpr struct test_result *r, const int test,
+             const int stream, const int timeline, const int chain,
+             uint32_t max_trans)
+{
+    __gpr uint32_t trans;
+    __gpr uint32_t addr_hi, addr_lo;
+    __gpr uint32_t unused;
+
+    __gpr uint32_t t0, t1, t0_hi, lat, lat_min = 0xffffffff, lat_max = 0;
+    __gpr uint64_t lat_sum = 0;
+
+    __gpr struct nfp_pcie_dma_cmd dma_cmd, link_cmd;
+    __xwrite struct nfp_pcie_dma_cmd dma_cmd_wr;
+
+    SIGNAL cmpl_sig, enq_sig;
 
     /* Set up first address */
-    dma_addr_from_idx(0, &addr_hi, &addr_lo, &unused);
+    dma_addr_from_idx(slot, 0, &addr_hi, &addr_lo, &unused);
 
     /* Setup the generic parts of the DMA descriptor */
-    pcie_dma_setup(&dma_cmd,
-                   __signal_number(&cmpl_sig), arg_trans_sz, arg_doff);
+    if (chain) {
+        pcie_dma_setup(&dma_cmd, __signal_number(&cmpl_sig),
+                       PCIEBENCH_XFER_DMA_SZ, arg_doff);
+        pcie_dma_setup_link(&link_cmd, arg_doff);
+    } else {
+        pcie_dma_setup(&dma_cmd,
+                       __signal_number(&cmpl_sig), arg_trans_sz, arg_doff);
+    }
 
     r->start_lo = ts_lo_read();
     r->start_hi = ts_hi_read();
@@ -176,235 +544,2018 @@ dma_lat(__gpr struct test_params *p, __gpr struct test_result *r, int test)
 
         t0 = ts_lo_read();
 
-        switch (test) {
-
-        case LAT_DMA_RD:
-            __pcie_dma_enq(0, &dma_cmd_wr, NFP_PCIE_DMA_FROMPCI_HI,
-                           sig_done, &enq_sig);
-            wait_for_all(&cmpl_sig, &enq_sig);
-            break;
-
-        case LAT_DMA_WRRD:
-            /* DMA ToPCIE (PCIe write)*/
-            __pcie_dma_enq(0, &dma_cmd_wr, NFP_PCIE_DMA_TOPCI_HI,
-                           sig_done, &enq_sig);
-            wait_for_all(&cmpl_sig, &enq_sig);
+        if (chain) {
+            if (test == LAT_DMA_WRRD)
+                pcie_dma_chain(&dma_cmd, &link_cmd, NFP_PCIE_DMA_TOPCI_HI,
+                               addr_hi, addr_lo, arg_trans_sz, &cmpl_sig);
+            pcie_dma_chain(&dma_cmd, &link_cmd, NFP_PCIE_DMA_FROMPCI_HI,
+                           addr_hi, addr_lo, arg_trans_sz, &cmpl_sig);
+        } else {
+            if (test == LAT_DMA_WRRD) {
+                /* DMA ToPCIE (PCIe write)*/
+                __pcie_dma_enq(0, &dma_cmd_wr, NFP_PCIE_DMA_TOPCI_HI,
+                               sig_done, &enq_sig);
+                wait_for_all(&cmpl_sig, &enq_sig);
+            }
 
             /* DMA FromPCIE (PCIe read)*/
             __pcie_dma_enq(0, &dma_cmd_wr, NFP_PCIE_DMA_FROMPCI_HI,
                            sig_done, &enq_sig);
             wait_for_all(&cmpl_sig, &enq_sig);
-
-            break;
-
-        default:
-            ret = -2;
-            goto out;
         }
 
         t1 = ts_lo_read();
-        MEM_JOURNAL_FAST(test_journal, t1 - t0);
+        lat = t1 - t0;
+        MEM_JOURNAL_FAST(test_journal, lat);
+
+        /* Keep summary stats, e.g. for sweeps which don't read the
+         * journal */
+        if (lat < lat_min)
+            lat_min = lat;
+        if (lat > lat_max)
+            lat_max = lat;
+        lat_sum += lat;
+
+        if (timeline) {
+            t0_hi = ts_hi_read();
+            MEM_JOURNAL_FAST(debug_journal, t0_hi);
+            MEM_JOURNAL_FAST(debug_journal, t0);
+        } else {
+            MEM_JOURNAL_FAST(debug_journal, addr_hi);
+            MEM_JOURNAL_FAST(debug_journal, addr_lo);
+        }
 
-        MEM_JOURNAL_FAST(debug_journal, addr_hi);
-        MEM_JOURNAL_FAST(debug_journal, addr_lo);
+        /* Let the drainer know about each batch of journal entries */
+        if (stream && !((trans + 1) & PCIEBENCH_STREAM_BATCH_mask)) {
+            MEM_JOURNAL_FENCE(test_journal);
+            stream_state.prod = trans + 1;
+        }
 
-        dma_addr_from_idx(trans, &addr_hi, &addr_lo, &unused);
+        dma_addr_from_idx(slot, trans, &addr_hi, &addr_lo, &unused);
     }
 
     r->end_lo = ts_lo_read();
     r->end_hi = ts_hi_read();
-    r->r0 = trans;
-    r->r1 = 0;
-    r->r2 = 0;
-    r->r3 = 0;
 
-out:
-    return ret;
+    r->r3 = lat_min;
+    r->r4 = lat_max;
+    r->r5 = lat_sum >> 32;
+    r->r6 = lat_sum & 0xffffffff;
+
+    return trans;
 }
 
 /*
- * PCIe bandwidth tests
- *
- * For bandwidth tests, Context/Thread 0 (the master context) is
- * simply setting up the tests and waits for a number of worker
- * threads on this ME and other MEs to complete the work.
- *
- * The master context performs any warming/thrashing and sets-up the
- * address calcualtion state for worker threads in this ME.  It also
- * writes the number of DMAs to be performed to CLS.  After setting
- * everything up, it waits to be signalled that all DMAs have been
- * completed.
- *
- * Worker MEs, test_sub the CLS variable containing the number of DMAs
- * to complete.  This is atomic and value of the CLS variable is used
- * as the index for address calculation (for sequential access).  For
- * Read/Write tests, the value is also used to alternate between Read
- * and Write DMAs.  The worker contxt handling the last DMA signals
- * the master once the DMA completed.
+ * Enqueue the @segs segments of a gather/scatter transaction at the
+ * host addresses in @seg_hi/@seg_lo on @queue and wait for the last
+ * one to complete.  @cmd and @link are set up as for @pcie_dma_chain
+ * with a length of @arg_trans_sz.
  */
+__intrinsic static void
+pcie_dma_sg(__gpr struct nfp_pcie_dma_cmd *cmd,
+            __gpr struct nfp_pcie_dma_cmd *link, uint32_t queue,
+            __lmem uint32_t *seg_hi, __lmem uint32_t *seg_lo, uint32_t segs,
+            SIGNAL *cmpl_sig)
+{
+    __gpr struct nfp_pcie_dma_cmd desc;
+    __xwrite struct nfp_pcie_dma_cmd desc_wr;
+    __gpr uint32_t cpp_lo, i;
+
+    SIGNAL enq_sig;
+
+    desc = *link;
+    cpp_lo = cmd->cpp_addr_lo;
+    for (i = 0; i < segs - 1; i++) {
+        desc.cpp_addr_lo = cpp_lo;
+        desc.pcie_addr_hi = seg_hi[i];
+        desc.pcie_addr_lo = seg_lo[i];
+        desc_wr = desc;
+        __pcie_dma_enq(0, &desc_wr, queue, ctx_swap, &enq_sig);
+        cpp_lo += arg_trans_sz;
+    }
 
+    /* The last segment signals the completion of the transaction */
+    desc = *cmd;
+    desc.cpp_addr_lo = cpp_lo;
+    desc.pcie_addr_hi = seg_hi[i];
+    desc.pcie_addr_lo = seg_lo[i];
+    desc_wr = desc;
+    __pcie_dma_enq(0, &desc_wr, queue, sig_done, &enq_sig);
+    wait_for_all(cmpl_sig, &enq_sig);
+}
 
 /*
- * Execute the @BW_RD, @BW_WR, and @BW_RW tests.
- *
- * Context 0 in the main app ME is not issuing any DMAs.
+ * Run @dma_lat_loop specialised for the flags of the test
  */
-__intrinsic int32_t
-dma_bw(__gpr struct test_params *p, __gpr struct test_result *r, int test)
+__intrinsic static uint32_t
+dma_lat_run(uint32_t slot, __gpr struct test_result *r, int test,
+            uint32_t max_trans)
 {
-    __gpr uint32_t arg_win, max_trans = PCIEBENCH_BW_TRANS;
-    __gpr int ret = 0;
-
-    SIGNAL dma_ctrl_sig;
-    __assign_relative_register(&dma_ctrl_sig, PCIEBENCH_CTRL_SIGNO);
-
-    /* Copy test number and test argument into local registers shared
-     * with the worker contexts. */
-    test_no = test;
-    arg_flags = p->p0;
-    arg_trans_sz = p->p1;
-    arg_win = p->p2;
-    arg_hoff = p->p3;
-    arg_doff = p->p4;
-
-    /* Sanity checks */
-    if ((arg_trans_sz + arg_hoff > 4096) ||
-        (arg_trans_sz + arg_hoff > arg_win)) {
-        ret = -1;
-        goto out;
+#ifdef PCIEBENCH_SPECIALISE
+    if (arg_trans_sz > PCIEBENCH_XFER_DMA_SZ) {
+        if (arg_flags & LAT_FLAGS_STREAM) {
+            if (arg_flags & LAT_FLAGS_TIMELINE)
+                return dma_lat_loop(slot, r, test, 1, 1, 1, max_trans);
+            else
+                return dma_lat_loop(slot, r, test, 1, 0, 1, max_trans);
+        } else {
+            if (arg_flags & LAT_FLAGS_TIMELINE)
+                return dma_lat_loop(slot, r, test, 0, 1, 1, max_trans);
+            else
+                return dma_lat_loop(slot, r, test, 0, 0, 1, max_trans);
+        }
+    } else {
+        if (arg_flags & LAT_FLAGS_STREAM) {
+            if (arg_flags & LAT_FLAGS_TIMELINE)
+                return dma_lat_loop(slot, r, test, 1, 1, 0, max_trans);
+            else
+                return dma_lat_loop(slot, r, test, 1, 0, 0, max_trans);
+        } else {
+            if (arg_flags & LAT_FLAGS_TIMELINE)
+                return dma_lat_loop(slot, r, test, 0, 1, 0, max_trans);
+            else
+                return dma_lat_loop(slot, r, test, 0, 0, 0, max_trans);
+        }
     }
+#else
+    return dma_lat_loop(slot, r, test, arg_flags & LAT_FLAGS_STREAM,
+                        arg_flags & LAT_FLAGS_TIMELINE,
+                        arg_trans_sz > PCIEBENCH_XFER_DMA_SZ, max_trans);
+#endif
+}
 
-    /* Set up address calculation state */
-    dma_addr_init(arg_win, arg_trans_sz, arg_hoff, arg_flags);
+/*
+ * The measured loop of @dma_lat for gather/scatter transactions of
+ * @segs segments (see @dma_lat in pciebench.h).  @test, @stream and
+ * @timeline must be compile time constants (see
+ * @PCIEBENCH_SPECIALISE).  Sets the timestamps and latency statistics
+ * in @r and returns the number of transactions performed.
+ */
+__intrinsic static uint32_t
+dma_sg_loop(uint32_t slot, __gpr struct test_result *r, const int test,
+            const int stream, const int timeline, uint32_t segs,
+            uint32_t max_trans)
+{
+    __gpr uint32_t trans, i;
+    __gpr uint32_t addr_hi, addr_lo;
+    __gpr uint32_t unused;
 
-    /* Thrash the cache if requested */
-    if (arg_flags & LAT_FLAGS_THRASH)
-        host_trash_cache();
+    __gpr uint32_t t0, t1, t0_hi, lat, lat_min = 0xffffffff, lat_max = 0;
+    __gpr uint64_t lat_sum = 0;
 
-    if (arg_flags & LAT_FLAGS_LONG)
-        max_trans = PCIEBENCH_JOURNAL_SZ;
+    __lmem uint32_t seg_hi[PCIEBENCH_SG_MAX];
+    __lmem uint32_t seg_lo[PCIEBENCH_SG_MAX];
 
-    /* Warm the window if requested */
-    if (arg_flags & LAT_FLAGS_WARM)
-        host_warm_cache(arg_win);
+    __gpr struct nfp_pcie_dma_cmd dma_cmd, link_cmd;
 
-    /* Set up CLS atomic for the number of transactions */
-    num_dma_trans = max_trans;
+    SIGNAL cmpl_sig;
+
+    /* Setup the generic parts of the DMA descriptors */
+    pcie_dma_setup(&dma_cmd,
+                   __signal_number(&cmpl_sig), arg_trans_sz, arg_doff);
+    pcie_dma_setup_link(&link_cmd, arg_doff);
+    pcie_dma_set_len(&link_cmd, arg_trans_sz);
 
-    /* record start time */
     r->start_lo = ts_lo_read();
     r->start_hi = ts_hi_read();
 
-    /* Signal first worker */
-    signal_next_ctx(PCIEBENCH_CTRL_SIGNO);
+    for (trans = 0; trans < max_trans; trans++) {
 
-    /* Wait for the worker, who issued last DMA to signal us */
-    wait_for_all(&dma_ctrl_sig);
+        /* Look up the segment addresses outside the measurement */
+        for (i = 0; i < segs; i++) {
+            dma_addr_from_idx(slot, trans * segs + i,
+                              &addr_hi, &addr_lo, &unused);
+            seg_hi[i] = addr_hi;
+            seg_lo[i] = addr_lo;
+        }
+
+        t0 = ts_lo_read();
+
+        if (test == LAT_DMA_WRRD)
+            pcie_dma_sg(&dma_cmd, &link_cmd, NFP_PCIE_DMA_TOPCI_HI,
+                        seg_hi, seg_lo, segs, &cmpl_sig);
+        pcie_dma_sg(&dma_cmd, &link_cmd, NFP_PCIE_DMA_FROMPCI_HI,
+                    seg_hi, seg_lo, segs, &cmpl_sig);
+
+        t1 = ts_lo_read();
+        lat = t1 - t0;
+        MEM_JOURNAL_FAST(test_journal, lat);
+
+        if (lat < lat_min)
+            lat_min = lat;
+        if (lat > lat_max)
+            lat_max = lat;
+        lat_sum += lat;
+
+        if (timeline) {
+            t0_hi = ts_hi_read();
+            MEM_JOURNAL_FAST(debug_journal, t0_hi);
+            MEM_JOURNAL_FAST(debug_journal, t0);
+        } else {
+            MEM_JOURNAL_FAST(debug_journal, seg_hi[0]);
+            MEM_JOURNAL_FAST(debug_journal, seg_lo[0]);
+        }
+
+        if (stream && !((trans + 1) & PCIEBENCH_STREAM_BATCH_mask)) {
+            MEM_JOURNAL_FENCE(test_journal);
+            stream_state.prod = trans + 1;
+        }
+    }
 
-    /* Record end time */
     r->end_lo = ts_lo_read();
     r->end_hi = ts_hi_read();
-    r->r0 = max_trans;
-    r->r1 = 0;
-    r->r2 = 0;
-    r->r3 = 0;
 
-out:
-    return ret;
+    r->r3 = lat_min;
+    r->r4 = lat_max;
+    r->r5 = lat_sum >> 32;
+    r->r6 = lat_sum & 0xffffffff;
+
+    return trans;
 }
 
+/*
+ * Run @dma_sg_loop specialised for the flags of the test
+ */
+__intrinsic static uint32_t
+dma_sg_run(uint32_t slot, __gpr struct test_result *r, int test,
+           uint32_t segs, uint32_t max_trans)
+{
+#ifdef PCIEBENCH_SPECIALISE
+    if (arg_flags & LAT_FLAGS_STREAM) {
+        if (arg_flags & LAT_FLAGS_TIMELINE)
+            return dma_sg_loop(slot, r, test, 1, 1, segs, max_trans);
+        else
+            return dma_sg_loop(slot, r, test, 1, 0, segs, max_trans);
+    } else {
+        if (arg_flags & LAT_FLAGS_TIMELINE)
+            return dma_sg_loop(slot, r, test, 0, 1, segs, max_trans);
+        else
+            return dma_sg_loop(slot, r, test, 0, 0, segs, max_trans);
+    }
+#else
+    return dma_sg_loop(slot, r, test, arg_flags & LAT_FLAGS_STREAM,
+                       arg_flags & LAT_FLAGS_TIMELINE, segs, max_trans);
+#endif
+}
 
-void
-dma_bw_worker(void)
+/*
+ * Return the 32 bit word at offset @d_off (a multiple of 8) of the NFP
+ * buffer in memory @mem.
+ */
+__intrinsic static uint32_t
+nfp_buf_read32(uint32_t mem, uint32_t d_off)
 {
-    __gpr struct test_params params;
-    __gpr uint32_t addr_hi, addr_lo;
-    __gpr uint32_t unused;
-    __gpr uint32_t trans;
-    __gpr int read;
+    __gpr uint64_t val;
+
+#ifndef __NFP_IS_3200
+    if (mem == NFP_BUF_IMEM)
+        val = nfp_buf_imem[d_off >> 3];
+    else if (mem == NFP_BUF_EMEM)
+        val = nfp_buf_emem[d_off >> 3];
+    else
+#endif
+        val = nfp_buf[d_off >> 3];
 
-    __gpr int meid;
+    return val >> 32;
+}
 
-    __gpr struct nfp_pcie_dma_cmd dma_cmd;
+/*
+ * The measured loop of @LAT_DMA_RD with @LAT_FLAGS_CHASE (see "Pointer
+ * chasing" in pciebench.h).  The next unit is only known once the
+ * current read completed.  @stream and @timeline must be compile time
+ * constants for the loop to be free of flag checks (see
+ * @PCIEBENCH_SPECIALISE).  Sets the timestamps and latency statistics
+ * in @r and returns the number of transactions performed.
+ */
+__intrinsic static uint32_t
+dma_chase_loop(uint32_t slot, __gpr struct test_result *r, uint32_t mem,
+               const int stream, const int timeline, uint32_t max_trans)
+{
+    __gpr uint32_t trans;
+    __gpr uint32_t unit_sz, units, idx = 0;
+    __gpr uint32_t lin_addr, addr_hi, addr_lo;
+    __gpr uint64_t dma_addr;
+
+    __gpr uint32_t t0, t1, t0_hi, lat, lat_min = 0xffffffff, lat_max = 0;
+    __gpr uint64_t lat_sum = 0;
+
+    __gpr struct nfp_pcie_dma_cmd dma_cmd;
+    __xwrite struct nfp_pcie_dma_cmd dma_cmd_wr;
+
+    SIGNAL cmpl_sig, enq_sig;
+
+    unit_sz = roundup64(arg_trans_sz + arg_hoff);
+    units = arg_win / unit_sz;
+
+    pcie_dma_setup(&dma_cmd,
+                   __signal_number(&cmpl_sig), arg_trans_sz, arg_doff);
+
+    r->start_lo = ts_lo_read();
+    r->start_hi = ts_hi_read();
+
+    for (trans = 0; trans < max_trans; trans++) {
+
+        lin_addr = test_slots[slot].host_off + idx * unit_sz + arg_hoff;
+        dma_addr = chunk_dma_addrs[lin_addr >> __log2(PCIEBENCH_CHUNK_SZ)] +
+            (lin_addr & PCIEBENCH_CHUNK_SZ_mask);
+        addr_hi = dma_addr >> 32;
+        addr_lo = dma_addr & 0xffffffff;
+
+        dma_cmd.pcie_addr_hi = addr_hi;
+        dma_cmd.pcie_addr_lo = addr_lo;
+        dma_cmd_wr = dma_cmd;
+
+        t0 = ts_lo_read();
+
+        __pcie_dma_enq(0, &dma_cmd_wr, NFP_PCIE_DMA_FROMPCI_HI,
+                       sig_done, &enq_sig);
+        wait_for_all(&cmpl_sig, &enq_sig);
+
+        t1 = ts_lo_read();
+        lat = t1 - t0;
+        MEM_JOURNAL_FAST(test_journal, lat);
+
+        if (lat < lat_min)
+            lat_min = lat;
+        if (lat > lat_max)
+            lat_max = lat;
+        lat_sum += lat;
+
+        if (timeline) {
+            t0_hi = ts_hi_read();
+            MEM_JOURNAL_FAST(debug_journal, t0_hi);
+            MEM_JOURNAL_FAST(debug_journal, t0);
+        } else {
+            MEM_JOURNAL_FAST(debug_journal, addr_hi);
+            MEM_JOURNAL_FAST(debug_journal, addr_lo);
+        }
+
+        if (stream && !((trans + 1) & PCIEBENCH_STREAM_BATCH_mask)) {
+            MEM_JOURNAL_FENCE(test_journal);
+            stream_state.prod = trans + 1;
+        }
+
+        /* The link to the next unit came with the data */
+        idx = nfp_buf_read32(mem, arg_doff) % units;
+    }
+
+    r->end_lo = ts_lo_read();
+    r->end_hi = ts_hi_read();
+
+    r->r3 = lat_min;
+    r->r4 = lat_max;
+    r->r5 = lat_sum >> 32;
+    r->r6 = lat_sum & 0xffffffff;
+
+    return trans;
+}
+
+/*
+ * Run @dma_chase_loop specialised for the flags of the test
+ */
+__intrinsic static uint32_t
+dma_chase_run(uint32_t slot, __gpr struct test_result *r, uint32_t mem,
+              uint32_t max_trans)
+{
+#ifdef PCIEBENCH_SPECIALISE
+    if (arg_flags & LAT_FLAGS_STREAM) {
+        if (arg_flags & LAT_FLAGS_TIMELINE)
+            return dma_chase_loop(slot, r, mem, 1, 1, max_trans);
+        else
+            return dma_chase_loop(slot, r, mem, 1, 0, max_trans);
+    } else {
+        if (arg_flags & LAT_FLAGS_TIMELINE)
+            return dma_chase_loop(slot, r, mem, 0, 1, max_trans);
+        else
+            return dma_chase_loop(slot, r, mem, 0, 0, max_trans);
+    }
+#else
+    return dma_chase_loop(slot, r, mem, arg_flags & LAT_FLAGS_STREAM,
+                          arg_flags & LAT_FLAGS_TIMELINE, max_trans);
+#endif
+}
+
+/*
+ * Check that all entries of the @size_dist table of @slot are DMA
+ * lengths between 1 and @trans_sz.  Returns non-zero if they aren't.
+ */
+__intrinsic static int
+size_dist_check(uint32_t slot, uint32_t trans_sz)
+{
+    __gpr uint32_t i, len;
+
+    for (i = 0; i < PCIEBENCH_SIZE_DIST_SZ; i++) {
+        len = size_dist[slot * PCIEBENCH_SIZE_DIST_SZ + i];
+        if (len == 0 || len > trans_sz)
+            return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Check that the schedule of a rate controlled test with @trans DMAs
+ * fits into 31 bit (see "Rate controlled bandwidth tests" in
+ * pciebench.h).  Returns non-zero if it doesn't.
+ */
+__intrinsic static int
+rate_check(uint32_t slot, uint32_t trans)
+{
+    __gpr uint64_t span, limit;
+    __gpr uint32_t on, period;
+
+    if (rate_spec[slot].interval >= (1 << 21))
+        return -1;
+
+    limit = (1ULL << 31) - PCIEBENCH_RATE_LEAD;
+    span = (uint64_t)trans * rate_spec[slot].interval;
+    if (rate_spec[slot].mode == RATE_POISSON)
+        span = (span * PCIEBENCH_RATE_EXP_MAX) >> 8;
+    if (span >= limit)
+        return -1;
+
+    /* Each @on cycles of the schedule take @on + @off cycles, and the
+     * last burst may be a partial one */
+    on = rate_spec[slot].on;
+    if (on) {
+        period = on + rate_spec[slot].off;
+        if (period < on || on >= limit ||
+            span * period >= (limit - on) * on)
+            return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Execute the @LAT_DMA_RD and @LAT_DMA_WRRD tests
+ */
+__intrinsic int32_t
+dma_lat(uint32_t slot, __gpr struct test_params *p,
+        __gpr struct test_result *r, int test)
+{
+    __gpr uint32_t trans, max_trans = PCIEBENCH_LAT_TRANS;
+    __gpr uint32_t jpos, dpos;
+    __gpr int ret = 0;
+
+    /* Sanity checks */
+    if (dma_trans_check(p->p1, p->p3, p->p4) || (p->p1 + p->p3 > p->p2)) {
+        ret = -1;
+        goto out;
+    }
+    if (nfp_buf_select(p->p7)) {
+        ret = -1;
+        goto out;
+    }
+    if ((p->p6 > 1) &&
+        ((p->p6 > PCIEBENCH_SG_MAX) ||
+         (p->p1 > PCIEBENCH_XFER_DMA_SZ) ||
+         (p->p6 * p->p1 + p->p4 > NFP_BUF_SZ))) {
+        ret = -1;
+        goto out;
+    }
+    if ((p->p0 & LAT_FLAGS_CHASE) &&
+        ((test != LAT_DMA_RD) || (p->p6 > 1) ||
+         (p->p0 & (LAT_FLAGS_WARM | LAT_FLAGS_THRASH)) ||
+         (p->p1 > PCIEBENCH_XFER_DMA_SZ) || (p->p4 & 7) ||
+         (roundup64(p->p1 + p->p3) & (roundup64(p->p1 + p->p3) - 1)) ||
+         (roundup64(p->p1 + p->p3) > 4096))) {
+        ret = -1;
+        goto out;
+    }
+
+    /* Thrash the cache or warm the window if requested.  Host fills
+     * clobber the shared test arguments, so do it first. */
+    if (p->p0 & LAT_FLAGS_THRASH)
+        host_trash_cache(slot);
+    if (p->p0 & LAT_FLAGS_WARM)
+        host_warm_cache(slot, p->p2);
+
+    arg_flags = p->p0;
+    arg_trans_sz = p->p1;
+    arg_win = p->p2;
+    arg_hoff = p->p3;
+    arg_doff = p->p4;
+    nfp_buf_select(p->p7);
+
+    /* Init the addresses array */
+    dma_addr_init(slot, arg_win, arg_trans_sz, arg_hoff, arg_flags);
+
+    if (arg_flags & LAT_FLAGS_LONG)
+        max_trans = PCIEBENCH_JOURNAL_SZ;
+    if (p->p5)
+        max_trans = p->p5;
+
+    /* Stream the journal to the host if requested */
+    if (arg_flags & LAT_FLAGS_STREAM) {
+        if (!p->p5 || stream_start()) {
+            ret = -1;
+            goto out;
+        }
+    }
+
+    /* Reserve the journal entries of this test, one per transaction
+     * in the test journal and two in the debug journal */
+    jpos = cls_test_add((__cls void *)&journal_pos, max_trans);
+    dpos = cls_test_add((__cls void *)&dbg_journal_pos, 2 * max_trans);
+    if (arg_flags & LAT_FLAGS_STREAM)
+        stream_state.base = jpos;
+
+    if (arg_flags & LAT_FLAGS_CHASE)
+        trans = dma_chase_run(slot, r, p->p7, max_trans);
+    else if (p->p6 > 1)
+        trans = dma_sg_run(slot, r, test, p->p6, max_trans);
+    else
+        trans = dma_lat_run(slot, r, test, max_trans);
+
+    if (arg_flags & LAT_FLAGS_STREAM) {
+        MEM_JOURNAL_FENCE(test_journal);
+        stream_stop(trans);
+    }
+
+    r->r0 = trans;
+    r->r1 = jpos & (PCIEBENCH_JOURNAL_SZ - 1);
+    r->r2 = dpos & (PCIEBENCH_DBG_JOURNAL_SZ - 1);
+    r->r7 = 0;
+
+out:
+    return ret;
+}
+
+/*
+ * PCIe bandwidth tests
+ *
+ * For bandwidth tests, Context/Thread 0 (the master context) is
+ * simply setting up the tests and waits for a number of worker
+ * threads on this ME and other MEs of the slot to complete the work.
+ *
+ * The master context performs any warming/thrashing and sets-up the
+ * address calcualtion state for worker threads in this ME.  It also
+ * writes the number of DMAs to be performed to CLS
+ * (@PCIEBENCH_BW_TRANS, @PCIEBENCH_JOURNAL_SZ with @LAT_FLAGS_LONG, or
+ * @p5 if set).  After setting everything up, it waits to be signalled
+ * that all DMAs have been completed.
+ *
+ * Worker MEs, test_sub the CLS variable containing the number of DMAs
+ * to complete.  This is atomic and value of the CLS variable is used
+ * as the index for address calculation (for sequential access).  For
+ * Read/Write tests, the value is also used to alternate between Read
+ * and Write DMAs.  The worker contxt handling the last DMA signals
+ * the master once the DMA completed.
+ */
+
+
+/*
+ * Execute the @BW_RD, @BW_WR, and @BW_RW tests.
+ *
+ * Context 0 in the main app ME is not issuing any DMAs.
+ */
+__intrinsic int32_t
+dma_bw(uint32_t slot, __gpr struct test_params *p,
+       __gpr struct test_result *r, int test)
+{
+    __gpr uint32_t arg_win, max_trans = PCIEBENCH_BW_TRANS;
+    __gpr uint32_t jpos, samples;
+    __gpr int ret = 0;
+#if PCIEBENCH_ISLANDS > 1
+    __gpr uint32_t i;
+#endif
+
+    SIGNAL dma_ctrl_sig;
+    __assign_relative_register(&dma_ctrl_sig, PCIEBENCH_CTRL_SIGNO);
+
+    /* Sanity checks */
+    if (dma_trans_check(p->p1, p->p3, p->p4) || (p->p1 + p->p3 > p->p2) ||
+        nfp_buf_select(p->p7)) {
+        ret = -1;
+        goto out;
+    }
+    if (p->p0 & LAT_FLAGS_LONG)
+        max_trans = PCIEBENCH_JOURNAL_SZ;
+    if (p->p5)
+        max_trans = p->p5;
+    if ((p->p0 & LAT_FLAGS_RATE) &&
+        ((p->p0 & LAT_FLAGS_STREAM) || test_slots[slot].islands ||
+         rate_check(slot, max_trans))) {
+        ret = -1;
+        goto out;
+    }
+    if ((p->p0 & LAT_FLAGS_SIZES) &&
+        ((p->p0 & LAT_FLAGS_RATE) || test_slots[slot].islands ||
+         size_dist_check(slot, p->p1))) {
+        ret = -1;
+        goto out;
+    }
+    if ((p->p0 & LAT_FLAGS_DUPLEX) &&
+        (test != BW_DMA_RW || (p->p0 & LAT_FLAGS_RATE) ||
+         test_slots[slot].islands || !duplex_spec[slot].rd_mes ||
+         test_slots[slot].me_first + duplex_spec[slot].rd_mes >
+         test_slots[slot].me_last ||
+         !duplex_spec[slot].rd_trans || !duplex_spec[slot].wr_trans)) {
+        ret = -1;
+        goto out;
+    }
+
+    /* Thrash the cache or warm the window if requested.  This uses
+     * the worker contexts as well, so do it first. */
+    if (p->p0 & LAT_FLAGS_THRASH)
+        host_trash_cache(slot);
+    if (p->p0 & LAT_FLAGS_WARM)
+        host_warm_cache(slot, p->p2);
+
+    /* Copy test number and test argument into local registers shared
+     * with the worker contexts. */
+    test_no = test;
+    arg_slot = slot;
+    arg_me_first = test_slots[slot].me_first;
+    arg_me_last = test_slots[slot].me_last;
+    arg_flags = p->p0;
+    arg_trans_sz = p->p1;
+    arg_win = p->p2;
+    arg_hoff = p->p3;
+    arg_doff = p->p4;
+    arg_trans_idx = slot;
+    nfp_buf_select(p->p7);
+
+    /* The ME of the master is the first ME of the read pool of a
+     * duplex test */
+    if (arg_flags & LAT_FLAGS_DUPLEX)
+        test_no = BW_DMA_RD;
+
+    /* Set up address calculation state */
+    dma_addr_init(slot, arg_win, arg_trans_sz, arg_hoff, arg_flags);
+
+#if PCIEBENCH_ISLANDS > 1
+    /* Hand the test to the worker islands, if the slot uses any. The
+     * number of transactions then lives in EMEM. */
+    arg_islands = test_slots[slot].islands;
+    if (arg_islands) {
+        island_job.test = test;
+        island_job.slot = slot;
+        island_job.master = __ME();
+        island_job.trans_sz = arg_trans_sz;
+        island_job.d_off = arg_doff;
+        island_job.mem = p->p7;
+        island_job.flags = arg_flags;
+        island_job.trans = max_trans;
+        island_job.done = 0;
+        for (i = 1; i <= arg_islands; i++)
+            signal_me((__ME() >> 4) + i, 0, 0, PCIEBENCH_CTRL_SIGNO);
+    } else
+#endif
+    if (arg_flags & LAT_FLAGS_DUPLEX) {
+        /* One CLS atomic per pool */
+        num_dma_trans[slot] = duplex_spec[slot].rd_trans;
+        num_dma_trans[PCIEBENCH_SLOTS + slot] = duplex_spec[slot].wr_trans;
+        duplex_done[slot] = 0;
+        max_trans = duplex_spec[slot].rd_trans + duplex_spec[slot].wr_trans;
+    } else
+    /* Set up CLS atomic for the number of transactions */
+    num_dma_trans[slot] = max_trans;
+
+    /* Set up the schedule of rate controlled tests */
+    if (arg_flags & LAT_FLAGS_RATE) {
+        samples = max_trans >> rate_spec[slot].sample_shift;
+        jpos = cls_test_add((__cls void *)&journal_pos, samples);
+        rate_vtime[slot] = 0;
+        rate_done[slot] = 0;
+        rate_start[slot] = (ts_lo_read() << 4) + PCIEBENCH_RATE_LEAD;
+    }
+
+    /* record start time */
+    r->start_lo = ts_lo_read();
+    r->start_hi = ts_hi_read();
+
+    /* Signal first worker */
+    signal_next_ctx(PCIEBENCH_CTRL_SIGNO);
+
+    /* Wait for the worker, who issued last DMA to signal us */
+    wait_for_all(&dma_ctrl_sig);
+
+    /* Record end time */
+    r->end_lo = ts_lo_read();
+    r->end_hi = ts_hi_read();
+
+#if PCIEBENCH_ISLANDS > 1
+    /* Wait for all workers in worker islands to be done */
+    if (arg_islands)
+        while (island_job.done != arg_islands * PCIEBENCH_ISLAND_WORKERS)
+            ctx_wait(voluntary);
+#endif
+
+    r->r0 = max_trans;
+    r->r1 = 0;
+    r->r2 = 0;
+    r->r3 = 0;
+    r->r4 = 0;
+    r->r5 = 0;
+    r->r6 = 0;
+    r->r7 = 0;
+
+    if (arg_flags & LAT_FLAGS_DUPLEX) {
+        r->r1 = duplex_spec[slot].rd_trans;
+        r->r2 = duplex_spec[slot].wr_trans;
+        r->r4 = duplex_end[slot] - r->start_lo;
+        r->r5 = duplex_end[PCIEBENCH_SLOTS + slot] - r->start_lo;
+    }
+
+    /* Wait for all DMAs of a rate controlled test to complete, so that
+     * their latencies are in the journal */
+    if (arg_flags & LAT_FLAGS_RATE) {
+        while (rate_done[slot] != max_trans)
+            ctx_wait(voluntary);
+
+        r->r1 = jpos & (PCIEBENCH_JOURNAL_SZ - 1);
+        r->r3 = samples;
+    }
+
+out:
+    return ret;
+}
+
+
+/*
+ * DMA @len bytes between the NFP buffer at CPP address @cpp_hi/@cpp_lo
+ * and offset @off in the host buffer on @queue.  The host side must not
+ * cross a chunk boundary.
+ */
+__intrinsic static void
+host_buf_dma(uint32_t cpp_hi, uint32_t cpp_lo, uint32_t off, uint32_t len,
+             uint32_t queue)
+{
+    __gpr uint64_t addr;
+
+    __gpr struct nfp_pcie_dma_cmd dma_cmd;
+    __xwrite struct nfp_pcie_dma_cmd dma_cmd_wr;
+
+    SIGNAL cmpl_sig, enq_sig;
+
+    pcie_dma_setup_cpp(&dma_cmd, __signal_number(&cmpl_sig), len,
+                       cpp_hi, cpp_lo);
+    pcie_dma_set_attrs(&dma_cmd, arg_flags);
+
+    addr = host_dma_addrs[off >> __log2(PCIEBENCH_CHUNK_SZ)] +
+        (off & PCIEBENCH_CHUNK_SZ_mask);
+    dma_cmd.pcie_addr_hi = addr >> 32;
+    dma_cmd.pcie_addr_lo = addr & 0xffffffff;
+    dma_cmd_wr = dma_cmd;
+
+    __pcie_dma_enq(0, &dma_cmd_wr, queue, sig_done, &enq_sig);
+    wait_for_all(&cmpl_sig, &enq_sig);
+}
+
+/*
+ * Non-zero if more than @PCIEBENCH_HOST_TIMEOUT timestamp ticks passed
+ * since @start (see "Waiting for the host" in pciebench.h)
+ */
+__intrinsic static int
+host_timeout(uint32_t start)
+{
+    return ts_lo_read() - start > PCIEBENCH_HOST_TIMEOUT;
+}
+
+/*
+ * Execute the @RING_DESC test (see "Host descriptor ring" in
+ * pciebench.h).  Only context 0 of the master takes part.
+ */
+__intrinsic int32_t
+ring_desc(uint32_t slot, __gpr struct test_params *p,
+          __gpr struct test_result *r)
+{
+    __gpr uint32_t entries, batch, mode, total, base;
+    __gpr uint32_t cons = 0, fetches = 0, empty = 0, invalid = 0;
+    __gpr uint32_t idx, n, valid, last;
+    __gpr uint64_t descs, cmpls;
+    __gpr struct ring_desc desc;
+    __gpr struct ring_cmpl cmpl;
+
+    entries = p->p2;
+    batch = p->p3;
+    mode = p->p4;
+    total = p->p5;
+
+    /* Sanity checks */
+    if (!entries || (entries & (entries - 1)) ||
+        entries > PCIEBENCH_RING_SZ || !batch ||
+        batch > PCIEBENCH_RING_BATCH || batch > entries / 2 ||
+        mode > RING_DOORBELL || !total || nfp_buf_select(p->p7))
+        return -1;
+
+    /* Both rings must be in the same chunk */
+    base = test_slots[slot].host_off;
+    if ((base & PCIEBENCH_CHUNK_SZ_mask) + PCIEBENCH_RING_CMPL_OFF +
+        PCIEBENCH_RING_SZ * sizeof(struct ring_cmpl) > PCIEBENCH_CHUNK_SZ)
+        return -1;
+
+    arg_flags = p->p0;
+    descs = (uint64_t)&ring_descs[slot * PCIEBENCH_RING_BATCH];
+    cmpls = (uint64_t)&ring_cmpls[slot * PCIEBENCH_RING_BATCH];
+
+    r->start_lo = ts_lo_read();
+    r->start_hi = ts_hi_read();
+    last = r->start_lo;
+
+    while (cons < total) {
+        /* The next batch, without wrapping around the ring */
+        idx = cons & (entries - 1);
+        n = batch;
+        if (n > total - cons)
+            n = total - cons;
+        if (n > entries - idx)
+            n = entries - idx;
+
+        if (mode == RING_DOORBELL)
+            while (ring_doorbell[slot] - cons < n) {
+                if (host_timeout(last))
+                    return -1;
+                ctx_wait(voluntary);
+            }
+
+        host_buf_dma((descs >> 32) & 0xff, descs & 0xffffffff,
+                     base + idx * sizeof(struct ring_desc),
+                     n * sizeof(struct ring_desc), NFP_PCIE_DMA_FROMPCI_LO);
+        fetches++;
+
+        /* Only the descriptors up to the first one the host has not
+         * written yet are valid */
+        for (valid = 0; valid < n; valid++) {
+            desc = ring_descs[slot * PCIEBENCH_RING_BATCH + valid];
+            if (desc.seq != cons + valid + 1)
+                break;
+
+            if (desc.len) {
+                if (desc.len > PCIEBENCH_XFER_DMA_SZ ||
+                    ((base + desc.off) & 4095) + desc.len > 4096 ||
+                    base + desc.off + desc.len > PCIEBENCH_MAX_MEM)
+                    invalid++;
+                else
+                    host_buf_dma(arg_buf_hi, arg_buf_lo, base + desc.off,
+                                 desc.len, NFP_PCIE_DMA_FROMPCI_LO);
+            }
+
+            cmpl.seq = desc.seq;
+            cmpl.ts = ts_lo_read();
+            ring_cmpls[slot * PCIEBENCH_RING_BATCH + valid] = cmpl;
+        }
+
+        if (!valid) {
+            empty++;
+            if (host_timeout(last))
+                return -1;
+            continue;
+        }
+
+        host_buf_dma((cmpls >> 32) & 0xff, cmpls & 0xffffffff,
+                     base + PCIEBENCH_RING_CMPL_OFF +
+                     idx * sizeof(struct ring_cmpl),
+                     valid * sizeof(struct ring_cmpl),
+                     NFP_PCIE_DMA_TOPCI_LO);
+        cons += valid;
+        last = ts_lo_read();
+    }
+
+    r->end_lo = ts_lo_read();
+    r->end_hi = ts_hi_read();
+
+    r->r0 = total;
+    r->r1 = fetches;
+    r->r2 = empty;
+    r->r3 = invalid;
+    r->r4 = 0;
+    r->r5 = 0;
+    r->r6 = 0;
+    r->r7 = 0;
+    return 0;
+}
+
+
+/*
+ * DMA a @clock_stamp with @seq and the current ME timestamp to offset
+ * @off in the host buffer.
+ */
+__intrinsic static void
+clock_stamp_dma(uint32_t slot, uint32_t seq, uint32_t off)
+{
+    __gpr struct clock_stamp stamp;
+    __gpr uint64_t addr;
+
+    stamp.seq = seq;
+    stamp.ts_lo = ts_lo_read();
+    stamp.ts_hi = ts_hi_read();
+    stamp.reserved = 0;
+    clock_stamps[slot] = stamp;
+
+    addr = (uint64_t)&clock_stamps[slot];
+    host_buf_dma((addr >> 32) & 0xff, addr & 0xffffffff, off,
+                 sizeof(struct clock_stamp), NFP_PCIE_DMA_TOPCI_LO);
+}
+
+/*
+ * Serve @rounds clock synchronisation requests of the host, numbered
+ * from @first (see "Clock synchronisation" in pciebench.h).  Returns
+ * -1 if the host stops sending requests.
+ */
+__intrinsic static int
+clock_sync_serve(uint32_t slot, uint32_t first, uint32_t rounds)
+{
+    __gpr uint32_t base, i, start;
+
+    base = test_slots[slot].host_off;
+    for (i = first; i < first + rounds; i++) {
+        start = ts_lo_read();
+        while (clock_sync_req[slot] != i) {
+            if (host_timeout(start))
+                return -1;
+            ctx_wait(voluntary);
+        }
+        clock_stamp_dma(slot, i, base + PCIEBENCH_SYNC_OFF);
+    }
+
+    return 0;
+}
+
+/*
+ * Execute the @CLOCK_SYNC test (see "Clock synchronisation" in
+ * pciebench.h).  Only context 0 of the master takes part.
+ */
+__intrinsic int32_t
+clock_sync(uint32_t slot, __gpr struct test_params *p,
+           __gpr struct test_result *r)
+{
+    __gpr uint32_t rounds, base;
+
+    rounds = p->p6;
+
+    /* Sanity checks */
+    base = test_slots[slot].host_off;
+    if (!rounds ||
+        (base & PCIEBENCH_CHUNK_SZ_mask) + PCIEBENCH_SYNC_OFF +
+        sizeof(struct clock_stamp) > PCIEBENCH_CHUNK_SZ)
+        return -1;
+
+    arg_flags = p->p0;
+
+    r->start_lo = ts_lo_read();
+    r->start_hi = ts_hi_read();
+
+    if (clock_sync_serve(slot, 1, rounds))
+        return -1;
+
+    r->end_lo = ts_lo_read();
+    r->end_hi = ts_hi_read();
+
+    r->r0 = rounds;
+    r->r1 = 0;
+    r->r2 = 0;
+    r->r3 = 0;
+    r->r4 = 0;
+    r->r5 = 0;
+    r->r6 = 0;
+    r->r7 = 0;
+    return 0;
+}
+
+/*
+ * Execute the @D2H_VIS test (see "One-way latencies" in pciebench.h).
+ * Only context 0 of the master takes part.
+ */
+__intrinsic int32_t
+d2h_vis(uint32_t slot, __gpr struct test_params *p,
+        __gpr struct test_result *r)
+{
+    __gpr uint32_t win, interval, samples, rounds, base;
+    __gpr uint32_t i, next;
+
+    win = p->p2;
+    interval = p->p4 >> 4;
+    samples = p->p5;
+    rounds = p->p6;
+
+    /* Sanity checks */
+    base = test_slots[slot].host_off;
+    if (!win || (win & 63) || win > PCIEBENCH_SYNC_OFF || !samples ||
+        (base & PCIEBENCH_CHUNK_SZ_mask) + PCIEBENCH_SYNC_OFF +
+        sizeof(struct clock_stamp) > PCIEBENCH_CHUNK_SZ)
+        return -1;
+
+    arg_flags = p->p0;
+
+    if (clock_sync_serve(slot, 1, rounds))
+        return -1;
+
+    r->start_lo = ts_lo_read();
+    r->start_hi = ts_hi_read();
+
+    next = r->start_lo;
+    for (i = 1; i <= samples; i++) {
+        while ((int32_t)(ts_lo_read() - next) < 0)
+            ctx_wait(voluntary);
+        next += interval;
+
+        clock_stamp_dma(slot, i, base + ((i - 1) * 64) % win);
+    }
+
+    r->end_lo = ts_lo_read();
+    r->end_hi = ts_hi_read();
+
+    if (clock_sync_serve(slot, rounds + 1, rounds))
+        return -1;
+
+    r->r0 = samples;
+    r->r1 = rounds;
+    r->r2 = 0;
+    r->r3 = 0;
+    r->r4 = 0;
+    r->r5 = 0;
+    r->r6 = 0;
+    r->r7 = 0;
+    return 0;
+}
+
+/*
+ * Execute the @H2D_FRESH test (see "One-way latencies" in pciebench.h).
+ * Only context 0 of the master takes part.
+ */
+__intrinsic int32_t
+h2d_fresh(uint32_t slot, __gpr struct test_params *p,
+          __gpr struct test_result *r)
+{
+    __xread uint32_t r_data[4];
+    SIGNAL r_sig;
+
+    __gpr uint32_t win, method, samples, rounds, base;
+    __gpr uint32_t i, off, seq, reads, reads_total = 0, reads_max = 0;
+    __gpr uint32_t start;
+    __gpr uint64_t addr, line;
+
+    win = p->p2;
+    method = p->p3;
+    samples = p->p5;
+    rounds = p->p6;
+
+    /* Sanity checks */
+    base = test_slots[slot].host_off;
+    if (!win || (win & 63) || win > PCIEBENCH_SYNC_OFF ||
+        method > FRESH_CMD || !samples ||
+        (base & PCIEBENCH_CHUNK_SZ_mask) + PCIEBENCH_ACK_OFF +
+        sizeof(struct clock_stamp) > PCIEBENCH_CHUNK_SZ)
+        return -1;
+
+    arg_flags = p->p0;
+    line = (uint64_t)&fresh_lines[slot];
+
+    /* The window is in a single chunk, one BAR config covers it */
+    addr = host_dma_addrs[base >> __log2(PCIEBENCH_CHUNK_SZ)];
+    if (method == FRESH_CMD)
+        pcie_c2p_barcfg(PCIEBENCH_PCIE_ISL, PCIEBENCH_C2P_IDX,
+                        addr >> 32, addr & 0xffffffff, 0);
+
+    if (clock_sync_serve(slot, 1, rounds))
+        return -1;
+
+    r->start_lo = ts_lo_read();
+    r->start_hi = ts_hi_read();
+
+    for (i = 1; i <= samples; i++) {
+        off = base + ((i - 1) * 64) % win;
+        reads = 0;
+        start = ts_lo_read();
+        do {
+            if (method == FRESH_CMD) {
+                addr = host_dma_addrs[off >> __log2(PCIEBENCH_CHUNK_SZ)] +
+                    (off & PCIEBENCH_CHUNK_SZ_mask);
+                __pcie_read(r_data, PCIEBENCH_PCIE_ISL, PCIEBENCH_C2P_IDX,
+                            addr >> 32, addr & 0xffffffff,
+                            sizeof(r_data), sizeof(r_data), sig_done,
+                            &r_sig);
+                wait_for_all(&r_sig);
+                seq = r_data[0];
+            } else {
+                host_buf_dma((line >> 32) & 0xff, line & 0xffffffff, off,
+                             sizeof(struct clock_stamp),
+                             NFP_PCIE_DMA_FROMPCI_LO);
+                seq = fresh_lines[slot].seq;
+            }
+            reads++;
+            if (seq != i && host_timeout(start))
+                return -1;
+        } while (seq != i);
+
+        /* The timestamp is taken in clock_stamp_dma() */
+        clock_stamp_dma(slot, i, base + PCIEBENCH_ACK_OFF);
+
+        reads_total += reads;
+        if (reads > reads_max)
+            reads_max = reads;
+    }
+
+    r->end_lo = ts_lo_read();
+    r->end_hi = ts_hi_read();
+
+    if (clock_sync_serve(slot, rounds + 1, rounds))
+        return -1;
+
+    r->r0 = samples;
+    r->r1 = rounds;
+    r->r2 = reads_total;
+    r->r3 = reads_max;
+    r->r4 = 0;
+    r->r5 = 0;
+    r->r6 = 0;
+    r->r7 = 0;
+    return 0;
+}
+
+
+/*
+ * Execute the @WR_COALESCE test (see "Write coalescing" in
+ * pciebench.h).  Only context 0 of the master takes part.
+ */
+__intrinsic int32_t
+wr_coalesce(uint32_t slot, __gpr struct test_params *p,
+            __gpr struct test_result *r)
+{
+    __gpr uint32_t sz, win, max_sz, gap, total, timeout, base;
+    __gpr uint32_t arrived = 0, first = 0, pend = 0, pend_ts = 0;
+    __gpr uint32_t dmas = 0, timeouts = 0, lat_max = 0;
+    __gpr uint32_t start, due, now, off, next, lat, i, jpos;
+    __gpr int flush;
+
+    sz = p->p1;
+    win = p->p2;
+    max_sz = p->p3;
+    total = p->p5;
+
+    /* Timestamps are in 16 cycle units */
+    gap = p->p4 >> 4;
+    timeout = p->p6 >> 4;
+
+    /* Sanity checks */
+    base = test_slots[slot].host_off;
+    if (sz < 8 || sz > 64 || (sz & (sz - 1)) ||
+        !win || (win & 4095) || (base & 4095) ||
+        max_sz < sz || (max_sz & (sz - 1)) ||
+        max_sz > PCIEBENCH_XFER_DMA_SZ || max_sz > NFP_BUF_SZ ||
+        !total || total > PCIEBENCH_JOURNAL_SZ || nfp_buf_select(p->p7))
+        return -1;
+
+    arg_flags = p->p0;
+    jpos = cls_test_add((__cls void *)&journal_pos, total);
+
+    r->start_lo = ts_lo_read();
+    r->start_hi = ts_hi_read();
+
+    start = r->start_lo;
+    due = start;
+
+    while (first < total) {
+        now = ts_lo_read();
+
+        /* Append all writes which have arrived by now to the pending
+         * run, flushing it whenever it can't take the next one */
+        flush = 0;
+        while (arrived < total && (int32_t)(now - due) >= 0) {
+            if (!pend)
+                pend_ts = due;
+            pend += sz;
+            arrived++;
+            due += gap;
+
+            next = (arrived * sz) % win;
+            if (pend == max_sz || next == 0 || (next & 4095) == 0) {
+                flush = 1;
+                break;
+            }
+        }
+
+        if (!pend)
+            continue;
+
+        /* The last run is flushed without waiting for the timeout */
+        if (!flush) {
+            if ((int32_t)(now - pend_ts) >= timeout)
+                timeouts++;
+            else if (arrived < total)
+                continue;
+        }
+
+        /* The run starts at the offset of its first write */
+        off = (first * sz) % win;
+        host_buf_dma(arg_buf_hi, arg_buf_lo, base + off, pend,
+                     NFP_PCIE_DMA_TOPCI_LO);
+        now = ts_lo_read();
+        dmas++;
+
+        for (i = 0; i < pend / sz; i++) {
+            lat = now - (pend_ts + i * gap);
+            if (lat > lat_max)
+                lat_max = lat;
+            MEM_JOURNAL_FAST(test_journal, lat);
+        }
+
+        first = arrived;
+        pend = 0;
+    }
+
+    r->end_lo = ts_lo_read();
+    r->end_hi = ts_hi_read();
+
+    r->r0 = total;
+    r->r1 = jpos & (PCIEBENCH_JOURNAL_SZ - 1);
+    r->r2 = dmas;
+    r->r3 = total;
+    r->r4 = timeouts;
+    r->r5 = lat_max;
+    r->r6 = 0;
+    r->r7 = 0;
+    return 0;
+}
+
+
+/*
+ * Each read of a @READ_ORDER batch has its own signal.  Signals can't
+ * be indexed at run time, so @read_order expands these for each @_k
+ * from 0 to @PCIEBENCH_ORDER_MAX - 1.
+ */
+#define READ_ORDER_SETUP(_k)                                            \
+    if (_k < n) {                                                       \
+        pcie_dma_setup(&dma_cmd, __signal_number(&order_sig##_k),       \
+                       sz, _k * sz);                                    \
+        order_cmds[_k] = dma_cmd;                                       \
+    }
+
+#define READ_ORDER_CMD(_k)                                              \
+    if (_k < n) {                                                       \
+        t_issue[_k] = ts_lo_read();                                     \
+        __pcie_read(&r_data[_k], PCIEBENCH_PCIE_ISL, PCIEBENCH_C2P_IDX, \
+                    addr_hi[_k], addr_lo[_k], 4, 4, sig_done,           \
+                    &order_sig##_k);                                    \
+    }
+
+#define READ_ORDER_POLL(_k)                                             \
+    if ((pend & (1 << _k)) && signal_test(&order_sig##_k)) {            \
+        t_cmpl[_k] = ts_lo_read();                                      \
+        pos[_k] = done++;                                               \
+        pend &= ~(1 << _k);                                             \
+    }
+
+/*
+ * Execute the @READ_ORDER test (see "Read completion ordering" in
+ * pciebench.h).  Only context 0 of the master takes part.
+ */
+__intrinsic int32_t
+read_order(uint32_t slot, __gpr struct test_params *p,
+           __gpr struct test_result *r)
+{
+    __lmem struct nfp_pcie_dma_cmd order_cmds[PCIEBENCH_ORDER_MAX];
+    __lmem uint32_t addr_hi[PCIEBENCH_ORDER_MAX];
+    __lmem uint32_t addr_lo[PCIEBENCH_ORDER_MAX];
+    __lmem uint32_t t_issue[PCIEBENCH_ORDER_MAX];
+    __lmem uint32_t t_cmpl[PCIEBENCH_ORDER_MAX];
+    __lmem uint32_t pos[PCIEBENCH_ORDER_MAX];
+
+    __xread uint32_t r_data[PCIEBENCH_ORDER_MAX];
+
+    __gpr struct nfp_pcie_dma_cmd dma_cmd;
+    __xwrite struct nfp_pcie_dma_cmd dma_cmd_wr;
+
+    SIGNAL order_sig0, order_sig1, order_sig2, order_sig3;
+    SIGNAL order_sig4, order_sig5, order_sig6, order_sig7;
+    SIGNAL enq_sig;
+
+    __gpr uint32_t sz, win, method, n, batches, base, stride;
+    __gpr uint32_t b, k, j, off, pend, done, depth, lat, hol, hol_end, jpos;
+    __gpr uint32_t reordered = 0, depth_max = 0, batches_reordered = 0;
+    __gpr uint32_t batch_reordered;
+    __gpr uint64_t addr;
+
+    sz = p->p1;
+    win = p->p2;
+    method = p->p3;
+    n = p->p4;
+    batches = p->p5;
+
+    /* Reads are 64B aligned, so they don't cross a 4K page */
+    stride = sz < 64 ? 64 : sz;
+
+    /* Sanity checks */
+    base = test_slots[slot].host_off;
+    if (sz < 4 || (sz & (sz - 1)) || sz > PCIEBENCH_XFER_DMA_SZ ||
+        !win || (win & (stride - 1)) || (base & 4095) ||
+        method > ORDER_CMD || !n || n > PCIEBENCH_ORDER_MAX ||
+        !batches || batches > PCIEBENCH_JOURNAL_SZ / (2 * n) ||
+        nfp_buf_select(p->p7))
+        return -1;
+    if (method == ORDER_CMD &&
+        (sz != 4 ||
+         (base & PCIEBENCH_CHUNK_SZ_mask) + win > PCIEBENCH_CHUNK_SZ))
+        return -1;
+
+    arg_flags = p->p0;
+    jpos = cls_test_add((__cls void *)&journal_pos, 2 * n * batches);
+
+    /* For PCIe reads the window is in a single chunk, one BAR config
+     * covers it */
+    if (method == ORDER_CMD) {
+        addr = host_dma_addrs[base >> __log2(PCIEBENCH_CHUNK_SZ)];
+        pcie_c2p_barcfg(PCIEBENCH_PCIE_ISL, PCIEBENCH_C2P_IDX,
+                        addr >> 32, addr & 0xffffffff, 0);
+    } else {
+        READ_ORDER_SETUP(0);
+        READ_ORDER_SETUP(1);
+        READ_ORDER_SETUP(2);
+        READ_ORDER_SETUP(3);
+        READ_ORDER_SETUP(4);
+        READ_ORDER_SETUP(5);
+        READ_ORDER_SETUP(6);
+        READ_ORDER_SETUP(7);
+    }
+
+    r->start_lo = ts_lo_read();
+    r->start_hi = ts_hi_read();
+
+    for (b = 0; b < batches; b++) {
+        for (k = 0; k < n; k++) {
+            off = base + ((b * n + k) * stride) % win;
+            addr = host_dma_addrs[off >> __log2(PCIEBENCH_CHUNK_SZ)] +
+                (off & PCIEBENCH_CHUNK_SZ_mask);
+            addr_hi[k] = addr >> 32;
+            addr_lo[k] = addr & 0xffffffff;
+        }
+
+        /* Issue all reads of the batch back to back */
+        if (method == ORDER_CMD) {
+            READ_ORDER_CMD(0);
+            READ_ORDER_CMD(1);
+            READ_ORDER_CMD(2);
+            READ_ORDER_CMD(3);
+            READ_ORDER_CMD(4);
+            READ_ORDER_CMD(5);
+            READ_ORDER_CMD(6);
+            READ_ORDER_CMD(7);
+        } else {
+            for (k = 0; k < n; k++) {
+                dma_cmd = order_cmds[k];
+                dma_cmd.pcie_addr_hi = addr_hi[k];
+                dma_cmd.pcie_addr_lo = addr_lo[k];
+                dma_cmd_wr = dma_cmd;
+                t_issue[k] = ts_lo_read();
+                __pcie_dma_enq(0, &dma_cmd_wr, NFP_PCIE_DMA_FROMPCI_LO,
+                               sig_done, &enq_sig);
+                wait_for_all(&enq_sig);
+            }
+        }
+
+        /* Poll for the completions.  Reads which complete between two
+         * polls count as in order. */
+        pend = (1 << n) - 1;
+        done = 0;
+        while (pend) {
+            READ_ORDER_POLL(0);
+            READ_ORDER_POLL(1);
+            READ_ORDER_POLL(2);
+            READ_ORDER_POLL(3);
+            READ_ORDER_POLL(4);
+            READ_ORDER_POLL(5);
+            READ_ORDER_POLL(6);
+            READ_ORDER_POLL(7);
+        }
+
+        /* Head-of-line latencies run until the latest completion of
+         * the read and all reads issued before it */
+        batch_reordered = 0;
+        hol_end = 0;
+        for (k = 0; k < n; k++) {
+            depth = 0;
+            for (j = k + 1; j < n; j++)
+                if (pos[j] < pos[k])
+                    depth++;
+
+            lat = t_cmpl[k] - t_issue[k];
+            if (t_cmpl[k] - t_issue[0] > hol_end)
+                hol_end = t_cmpl[k] - t_issue[0];
+            hol = t_issue[0] + hol_end - t_issue[k];
+
+            MEM_JOURNAL_FAST(test_journal, (depth << 24) | (lat & 0xffffff));
+            MEM_JOURNAL_FAST(test_journal, hol);
+
+            if (depth) {
+                reordered++;
+                batch_reordered = 1;
+                if (depth > depth_max)
+                    depth_max = depth;
+            }
+        }
+        batches_reordered += batch_reordered;
+    }
+
+    r->end_lo = ts_lo_read();
+    r->end_hi = ts_hi_read();
+
+    r->r0 = n * batches;
+    r->r1 = jpos & (PCIEBENCH_JOURNAL_SZ - 1);
+    r->r2 = reordered;
+    r->r3 = 2 * n * batches;
+    r->r4 = depth_max;
+    r->r5 = batches_reordered;
+    r->r6 = 0;
+    r->r7 = 0;
+    return 0;
+}
+
+#undef READ_ORDER_SETUP
+#undef READ_ORDER_CMD
+#undef READ_ORDER_POLL
+
+
+/*
+ * Find the busy slot a worker ME belongs to.
+ */
+__intrinsic static uint32_t
+slot_of_me(uint32_t me)
+{
+    __gpr uint32_t slot;
+
+    for (slot = 0; slot < PCIEBENCH_SLOTS - 1; slot++)
+        if (slot_busy[slot] &&
+            test_slots[slot].me_first <= me && me <= test_slots[slot].me_last)
+            break;
+    return slot;
+}
+
+/*
+ * The DMA loops of the bandwidth workers.  Each worker context takes
+ * DMAs off the counter of its slot until none are left and returns the
+ * number of the last DMA it issued.  @test, @global and @sizes must be
+ * compile time constants for the loops to be free of test and flag
+ * checks (see @PCIEBENCH_SPECIALISE).  With @sizes set, the length of
+ * each DMA is drawn from the slot's @size_dist table.
+ */
+__intrinsic static uint32_t
+bw_worker_loop(const int test, const int global, const int sizes)
+{
+    __gpr struct worker_stats stats;
+    __gpr uint32_t addr_hi, addr_lo;
+    __gpr uint32_t unused;
+    __gpr uint32_t trans;
+    __gpr uint32_t dmas = 0;
+    __gpr uint64_t bytes = 0;
+    __gpr uint32_t idx, len, queue;
+
+    __gpr struct nfp_pcie_dma_cmd dma_cmd, link_cmd;
+    __xwrite struct nfp_pcie_dma_cmd dma_cmd_wr;
+
+    SIGNAL cmpl_sig, enq_sig;
+
+    /* Setup the generic parts of the DMA descriptor */
+    pcie_dma_setup(&dma_cmd,
+                   __signal_number(&cmpl_sig), arg_trans_sz, arg_doff);
+    if (arg_trans_sz > PCIEBENCH_XFER_DMA_SZ)
+        pcie_dma_setup_link(&link_cmd, arg_doff);
+    len = arg_trans_sz;
+
+    stats.first_lo = ts_lo_read();
+    stats.first_hi = ts_hi_read();
+
+    for (;;) {
+#if PCIEBENCH_ISLANDS > 1
+        if (global)
+            trans = mem_test_sub((__mem void *)&island_job.trans, 1);
+        else
+#endif
+        trans = cls_test_sub(&num_dma_trans[arg_trans_idx], 1);
+
+        dma_addr_from_idx(arg_slot, trans, &addr_hi, &addr_lo, &unused);
+
+        dma_cmd.pcie_addr_hi = addr_hi;
+        dma_cmd.pcie_addr_lo = addr_lo;
+        if (sizes) {
+            idx = local_csr_read(local_csr_pseudo_random_number) &
+                (PCIEBENCH_SIZE_DIST_SZ - 1);
+            len = size_dist[arg_slot * PCIEBENCH_SIZE_DIST_SZ + idx];
+            pcie_dma_set_len(&dma_cmd, len);
+            bytes += len;
+        }
+        dma_cmd_wr = dma_cmd;
+
+        /* Work out if we read or write. For Read/Write tests use
+         * the transaction number: Uneven are reads, even are writes */
+        if (test == BW_DMA_RD || (test == BW_DMA_RW && (trans & 1)))
+            queue = NFP_PCIE_DMA_FROMPCI_LO;
+        else
+            queue = NFP_PCIE_DMA_TOPCI_LO;
+
+        if (len > PCIEBENCH_XFER_DMA_SZ) {
+            pcie_dma_chain(&dma_cmd, &link_cmd, queue,
+                           addr_hi, addr_lo, len, &cmpl_sig);
+        } else {
+            __pcie_dma_enq(0, &dma_cmd_wr, queue, sig_done, &enq_sig);
+            wait_for_all(&cmpl_sig, &enq_sig);
+        }
+        dmas++;
+
+        /* Stop if this was the last transaction. */
+        if (trans <= 1)
+            break;
+    }
+
+    stats.last_lo = ts_lo_read();
+    stats.last_hi = ts_hi_read();
+
+    /* Record the statistics of this context (see "Worker statistics") */
+    if (!sizes)
+        bytes = (uint64_t)dmas * arg_trans_sz;
+    stats.dmas = dmas;
+    stats.bytes_hi = bytes >> 32;
+    stats.bytes_lo = bytes & 0xffffffff;
+    stats.reserved = 0;
+    idx = (((__ME() >> 4) - PCIEBENCH_FIRST_ISL) *
+           (PCIEBENCH_LAST_WORKER_ME + 1) + (__ME() & 0xf)) * 8 + ctx();
+    worker_stats[idx] = stats;
+
+    return trans;
+}
+
+/*
+ * The DMA loop of rate controlled bandwidth tests (see "Rate
+ * controlled bandwidth tests" in pciebench.h).  Only the worker which
+ * issued the last DMA returns 1.
+ */
+__intrinsic static uint32_t
+rate_worker_loop(const int test)
+{
+    __gpr uint32_t addr_hi, addr_lo;
+    __gpr uint32_t unused;
+    __gpr uint32_t trans;
+    __gpr uint32_t interval, poisson, on, period, sample_mask, start;
+    __gpr uint32_t delta, vtime, sched, lat, queue;
+
+    __gpr struct nfp_pcie_dma_cmd dma_cmd, link_cmd;
+    __xwrite struct nfp_pcie_dma_cmd dma_cmd_wr;
+
+    SIGNAL cmpl_sig, enq_sig;
+
+    /* Setup the generic parts of the DMA descriptor */
+    pcie_dma_setup(&dma_cmd,
+                   __signal_number(&cmpl_sig), arg_trans_sz, arg_doff);
+    if (arg_trans_sz > PCIEBENCH_XFER_DMA_SZ)
+        pcie_dma_setup_link(&link_cmd, arg_doff);
+
+    interval = rate_spec[arg_slot].interval;
+    poisson = rate_spec[arg_slot].mode == RATE_POISSON;
+    on = rate_spec[arg_slot].on;
+    period = on + rate_spec[arg_slot].off;
+    sample_mask = (1 << rate_spec[arg_slot].sample_shift) - 1;
+    start = rate_start[arg_slot];
+
+    for (;;) {
+        trans = cls_test_sub(&num_dma_trans[arg_slot], 1);
+        if (trans == 0)
+            break;
+
+        /* Append the next inter-arrival time to the schedule and work
+         * out when this DMA is due, skipping the off periods */
+        if (poisson)
+            delta = (interval * rate_exp_tab[
+                         local_csr_read(local_csr_pseudo_random_number) &
+                         0xff]) >> 8;
+        else
+            delta = interval;
+        vtime = cls_test_add(&rate_vtime[arg_slot], delta);
+        if (on)
+            vtime = (vtime / on) * period + (vtime % on);
+        sched = start + vtime;
+
+        dma_addr_from_idx(arg_slot, trans, &addr_hi, &addr_lo, &unused);
+
+        dma_cmd.pcie_addr_hi = addr_hi;
+        dma_cmd.pcie_addr_lo = addr_lo;
+        dma_cmd_wr = dma_cmd;
+
+        /* Timestamps are in 16 cycle units */
+        while ((int32_t)(sched - (ts_lo_read() << 4)) > 0)
+            ctx_wait(voluntary);
+
+        if (test == BW_DMA_RD || (test == BW_DMA_RW && (trans & 1)))
+            queue = NFP_PCIE_DMA_FROMPCI_LO;
+        else
+            queue = NFP_PCIE_DMA_TOPCI_LO;
+
+        if (arg_trans_sz > PCIEBENCH_XFER_DMA_SZ) {
+            pcie_dma_chain(&dma_cmd, &link_cmd, queue,
+                           addr_hi, addr_lo, arg_trans_sz, &cmpl_sig);
+        } else {
+            __pcie_dma_enq(0, &dma_cmd_wr, queue, sig_done, &enq_sig);
+            wait_for_all(&cmpl_sig, &enq_sig);
+        }
+
+        lat = ((ts_lo_read() << 4) - sched) >> 4;
+        if (!(trans & sample_mask))
+            MEM_JOURNAL_FAST(test_journal, lat);
+        cls_test_add(&rate_done[arg_slot], 1);
+
+        if (trans == 1)
+            break;
+    }
+
+    return trans;
+}
+
+/* Host fill: DMA writes of whole units, see @host_fill */
+__intrinsic static uint32_t
+fill_worker_loop(const int rand)
+{
+    __gpr uint32_t trans;
+    __gpr uint32_t unit, off;
+    __gpr uint64_t dma_addr;
+
+    __gpr struct nfp_pcie_dma_cmd dma_cmd;
     __xwrite struct nfp_pcie_dma_cmd dma_cmd_wr;
 
     SIGNAL cmpl_sig, enq_sig;
+
+    pcie_dma_setup(&dma_cmd, __signal_number(&cmpl_sig), arg_trans_sz, 0);
+
+    for (;;) {
+        trans = cls_test_sub(&num_dma_trans[arg_slot], 1);
+
+        if (rand)
+            unit = local_csr_read(local_csr_pseudo_random_number);
+        else
+            unit = trans;
+        off = arg_hoff + (unit % (arg_win / arg_trans_sz)) * arg_trans_sz;
+
+        dma_addr = host_dma_addrs[off >> __log2(PCIEBENCH_CHUNK_SZ)] +
+            (off & PCIEBENCH_CHUNK_SZ_mask);
+        dma_cmd.pcie_addr_hi = dma_addr >> 32;
+        dma_cmd.pcie_addr_lo = dma_addr & 0xffffffff;
+        dma_cmd_wr = dma_cmd;
+
+        __pcie_dma_enq(0, &dma_cmd_wr, NFP_PCIE_DMA_TOPCI_LO,
+                       sig_done, &enq_sig);
+        wait_for_all(&cmpl_sig, &enq_sig);
+
+        if (trans <= 1)
+            break;
+    }
+
+    return trans;
+}
+
+/*
+ * Run the bandwidth worker loop for @test_no, taking DMAs off
+ * @island_job.trans if @global is set and drawing DMA lengths from
+ * @size_dist if @sizes is set.
+ */
+__intrinsic static uint32_t
+bw_worker_run(const int global, const int sizes)
+{
+#ifdef PCIEBENCH_SPECIALISE
+    if (test_no == BW_DMA_RD)
+        return bw_worker_loop(BW_DMA_RD, global, sizes);
+    else if (test_no == BW_DMA_WR)
+        return bw_worker_loop(BW_DMA_WR, global, sizes);
+    else
+        return bw_worker_loop(BW_DMA_RW, global, sizes);
+#else
+    return bw_worker_loop(test_no, global, sizes);
+#endif
+}
+
+void
+dma_bw_worker(void)
+{
+    __gpr struct test_params params;
+    __gpr uint32_t trans;
+    __gpr uint32_t req;
+
+    __gpr uint32_t ctrl, t0;
+
+    __gpr int meid;
+    __gpr int me;
+    __gpr int drainer;
+
     SIGNAL dma_ctrl_sig;
     __assign_relative_register(&dma_ctrl_sig, PCIEBENCH_CTRL_SIGNO);
 
     meid = __ME();
+    me = meid & 0xf;
+
+    /* The last context of one ME drains the journal for streaming
+     * latency tests while it is not needed as a DMA worker */
+    drainer = ctx() == 7 && me == PCIEBENCH_STREAM_ME;
 
     for (;;) {
 
-        /* Wait for the start signal */
-        wait_for_all(&dma_ctrl_sig);
+        /* Wait for the start signal, polling for a streaming test
+         * without hammering CLS on the drainer context */
+        if (drainer) {
+            t0 = ts_lo_read();
+            while (!signal_test(&dma_ctrl_sig)) {
+                if (ts_lo_read() - t0 < PCIEBENCH_STREAM_POLL) {
+                    ctx_wait(voluntary);
+                    continue;
+                }
+                ctrl = stream_state.ctrl;
+                if (ctrl == STREAM_IDLE)
+                    t0 = ts_lo_read();
+                else
+                    stream_drain(ctrl);
+                ctx_wait(voluntary);
+            }
+        } else {
+            wait_for_all(&dma_ctrl_sig);
+        }
 
-        /* Context 0 on a worker ME reads in the parameter and copies
-         * them to GPRs shared between all worker contexts. */
+        /* Context 0 on a worker ME may be asked by the dispatcher to
+         * act as the master of a slot.  Otherwise it reads in the
+         * parameters of the slot the ME belongs to and copies them to
+         * GPRs shared between all worker contexts. */
         if (ctx() == 0) {
-            test_no = test_ctrl;
-
-            params = test_params;
-            arg_flags = params.p0;
-            arg_trans_sz = params.p1;
-            arg_win = params.p2;
-            arg_hoff = params.p3;
-            arg_doff = params.p4;
+            req = slot_start[me];
+            if (req) {
+                slot_start[me] = 0;
+                slot_run(req - 1);
+                continue;
+            }
+
+            arg_slot = slot_of_me(me);
+            arg_me_first = test_slots[arg_slot].me_first;
+            arg_me_last = test_slots[arg_slot].me_last;
+
+            if (fill_args[arg_slot].size) {
+                test_no = HOST_FILL;
+                arg_flags = fill_args[arg_slot].flags;
+                arg_trans_sz = fill_args[arg_slot].unit;
+                arg_win = fill_args[arg_slot].size;
+                arg_hoff = fill_args[arg_slot].base;
+                arg_doff = 0;
+                nfp_buf_select(NFP_BUF_DEFAULT);
+            } else {
+                test_no = test_ctrl[arg_slot];
+
+                params = test_params[arg_slot];
+                arg_flags = params.p0;
+                arg_trans_sz = params.p1;
+                arg_win = params.p2;
+                arg_hoff = params.p3;
+                arg_doff = params.p4;
+                arg_trans_idx = arg_slot;
+                nfp_buf_select(params.p7);
+
+                /* Pick the pool of this ME in duplex tests */
+                if (arg_flags & LAT_FLAGS_DUPLEX) {
+                    if (me < arg_me_first + duplex_spec[arg_slot].rd_mes) {
+                        test_no = BW_DMA_RD;
+                    } else {
+                        test_no = BW_DMA_WR;
+                        arg_trans_idx = PCIEBENCH_SLOTS + arg_slot;
+                    }
+                }
+            }
+#if PCIEBENCH_ISLANDS > 1
+            arg_islands = test_slots[arg_slot].islands;
+#endif
         }
 
         /* Ping the next context to start.
          * CTX 7 in each ME pings CTX 0 in the next ME. The last ME
-         * does not need to ping anyone. */
+         * of the slot does not need to ping anyone. */
         if (ctx() != 7)
             signal_next_ctx(PCIEBENCH_CTRL_SIGNO);
         else
-            if ((meid & 0xf) != PCIEBENCH_LAST_WORKER_ME)
+            if (me != arg_me_last)
                 signal_next_me(0, PCIEBENCH_CTRL_SIGNO);
 
-        /* Setup the generic parts of the DMA descriptor */
-        pcie_dma_setup(&dma_cmd,
-                       __signal_number(&cmpl_sig), arg_trans_sz, arg_doff);
-
         /* Do work until done */
-        for (;;) {
-            trans = cls_test_sub(&num_dma_trans, 1);
-
-            dma_addr_from_idx(trans, &addr_hi, &addr_lo, &unused);
-
-            dma_cmd.pcie_addr_hi = addr_hi;
-            dma_cmd.pcie_addr_lo = addr_lo;
-            dma_cmd_wr = dma_cmd;
-
-            /* Work out if we read or write. For Read/Write tests use
-             * the transaction number: Uneven are reads, even are writes */
+        if (test_no == HOST_FILL) {
+#ifdef PCIEBENCH_SPECIALISE
+            if (arg_flags & LAT_FLAGS_RANDOM)
+                trans = fill_worker_loop(1);
+            else
+                trans = fill_worker_loop(0);
+#else
+            trans = fill_worker_loop(arg_flags & LAT_FLAGS_RANDOM);
+#endif
+        }
+        else if (arg_flags & LAT_FLAGS_RATE) {
+#ifdef PCIEBENCH_SPECIALISE
             if (test_no == BW_DMA_RD)
-                read = 1;
+                trans = rate_worker_loop(BW_DMA_RD);
             else if (test_no == BW_DMA_WR)
-                read = 0;
-            else if (trans & 1)
-                read = 1;
+                trans = rate_worker_loop(BW_DMA_WR);
             else
-                read = 0;
+                trans = rate_worker_loop(BW_DMA_RW);
+#else
+            trans = rate_worker_loop(test_no);
+#endif
+        }
+#if PCIEBENCH_ISLANDS > 1
+        else if (arg_islands)
+            trans = bw_worker_run(1, 0);
+#endif
+        else if (arg_flags & LAT_FLAGS_SIZES)
+            trans = bw_worker_run(0, 1);
+        else
+            trans = bw_worker_run(0, 0);
+
+        /* Context which processed the last DMA signals the master of
+         * the slot, which is CTX 0 of the first ME of the slot in the
+         * same island.  In duplex tests, only the last of the two
+         * pools to finish does. */
+        if (trans == 1 && (arg_flags & LAT_FLAGS_DUPLEX)) {
+            duplex_end[arg_trans_idx] = ts_lo_read();
+            if (cls_test_add(&duplex_done[arg_slot], 1) == 0)
+                continue;
+        }
+        if (trans == 1)
+            signal_me(meid >> 4, arg_me_first, 0, PCIEBENCH_CTRL_SIGNO);
+    }
+}
 
-            if (read)
-                __pcie_dma_enq(0, &dma_cmd_wr, NFP_PCIE_DMA_FROMPCI_LO,
-                               sig_done, &enq_sig);
-            else
-                __pcie_dma_enq(0, &dma_cmd_wr, NFP_PCIE_DMA_TOPCI_LO,
-                               sig_done, &enq_sig);
+#if PCIEBENCH_ISLANDS > 1
+/*
+ * DMA workers in worker islands (see "Worker islands" in pciebench.h)
+ */
+void
+island_worker(void)
+{
+    __gpr uint32_t trans;
+    __gpr int me;
 
-            wait_for_all(&cmpl_sig, &enq_sig);
+    SIGNAL dma_ctrl_sig;
+    __assign_relative_register(&dma_ctrl_sig, PCIEBENCH_CTRL_SIGNO);
 
-            /* Stop if this was the last transaction. */
-            if (trans <= 1)
-                break;
+    me = __ME() & 0xf;
+
+    for (;;) {
+
+        /* Wait for the start signal */
+        wait_for_all(&dma_ctrl_sig);
+
+        /* Context 0 of each ME copies the test to the GPRs shared
+         * between its contexts */
+        if (ctx() == 0) {
+            test_no = island_job.test;
+            arg_slot = island_job.slot;
+            arg_master = island_job.master;
+            arg_trans_sz = island_job.trans_sz;
+            arg_doff = island_job.d_off;
+            arg_flags = island_job.flags;
+            nfp_buf_select(island_job.mem);
         }
 
-        /* Context which processed the last DMA signals master. who is
-         * ME 0 CTX 0 in the same island.  */
+        /* Ping the next context/ME to start, as in i32 */
+        if (ctx() != 7)
+            signal_next_ctx(PCIEBENCH_CTRL_SIGNO);
+        else
+            if (me != PCIEBENCH_LAST_WORKER_ME)
+                signal_next_me(0, PCIEBENCH_CTRL_SIGNO);
+
+        trans = bw_worker_run(1, 0);
+
         if (trans == 1)
-            signal_me(meid >> 4, 0, 0, PCIEBENCH_CTRL_SIGNO);
+            signal_me(arg_master >> 4, arg_master & 0xf, 0,
+                      PCIEBENCH_CTRL_SIGNO);
+
+        mem_incr((__mem void *)&island_job.done);
+    }
+}
+#endif
+
+
+/*
+ * Transfer of journals and results to the host
+ */
+
+/*
+ * DMA @len bytes (at most @PCIEBENCH_XFER_DMA_SZ) from MU address @src
+ * to offset @off in the transfer area.  The copy is split where it
+ * crosses a host chunk boundary.
+ */
+__intrinsic static void
+xfer_dma(uint64_t src, uint32_t off, uint32_t len)
+{
+    __gpr uint64_t addr;
+    __gpr uint32_t n;
+
+    __gpr struct nfp_pcie_dma_cmd dma_cmd;
+    __xwrite struct nfp_pcie_dma_cmd dma_cmd_wr;
+
+    SIGNAL cmpl_sig, enq_sig;
+
+    while (len) {
+        n = PCIEBENCH_CHUNK_SZ - (off & PCIEBENCH_CHUNK_SZ_mask);
+        if (n > len)
+            n = len;
+
+        pcie_dma_setup_cpp(&dma_cmd, __signal_number(&cmpl_sig), n,
+                           (src >> 32) & 0xff, src & 0xffffffff);
+
+        addr = host_xfer_addrs[off >> __log2(PCIEBENCH_CHUNK_SZ)] +
+            (off & PCIEBENCH_CHUNK_SZ_mask);
+        dma_cmd.pcie_addr_hi = addr >> 32;
+        dma_cmd.pcie_addr_lo = addr & 0xffffffff;
+        dma_cmd_wr = dma_cmd;
+
+        __pcie_dma_enq(0, &dma_cmd_wr, NFP_PCIE_DMA_TOPCI_LO,
+                       sig_done, &enq_sig);
+        wait_for_all(&cmpl_sig, &enq_sig);
+
+        src += n;
+        off += n;
+        len -= n;
+    }
+}
+
+void
+xfer_results(uint32_t slot, __gpr struct test_result *r,
+             uint32_t start, uint32_t entries)
+{
+    __gpr uint32_t off, idx, len;
+
+    /* Journal entries, in the largest DMAs the engine supports and
+     * without crossing the end of the journal */
+    for (off = 0; off < entries * 4; off += len) {
+        idx = (start + off / 4) & (PCIEBENCH_JOURNAL_SZ - 1);
+        len = entries * 4 - off;
+        if (len > PCIEBENCH_XFER_DMA_SZ)
+            len = PCIEBENCH_XFER_DMA_SZ;
+        if (len > (PCIEBENCH_JOURNAL_SZ - idx) * 4)
+            len = (PCIEBENCH_JOURNAL_SZ - idx) * 4;
+        xfer_dma(MEM_JOURNAL_ADDR(test_journal) + idx * 4, off, len);
+    }
+
+    /* The results last, so they are visible once the journal is */
+    xfer_result_buf[slot] = *r;
+    xfer_dma((uint64_t)&xfer_result_buf[slot],
+             PCIEBENCH_XFER_RESULT_CHUNK * PCIEBENCH_CHUNK_SZ +
+             slot * sizeof(struct test_result),
+             sizeof(struct test_result));
+}
+
+
+/*
+ * Journal drainer
+ *
+ * Context 7 of @PCIEBENCH_STREAM_ME copies the test journal to the
+ * host ring while a streaming latency test is running and it is not
+ * busy as a DMA worker (see @dma_bw_worker).  Each call waits for a
+ * full batch and copies it with a single DMA, unless it crosses the
+ * end of the journal or the host ring, in which case the batch is
+ * copied in two parts.  Once the test stopped, the remaining partial
+ * batch is copied and the drainer goes back to idle.  The drainer
+ * does not overwrite entries the host has not consumed yet.
+ */
+__intrinsic void
+stream_drain(uint32_t ctrl)
+{
+    __gpr uint32_t prod, drained, lost, avail, n;
+    __gpr uint32_t idx;
+
+    prod = stream_state.prod;
+    drained = stream_state.drained;
+    lost = stream_state.lost;
+    avail = prod - drained - lost;
+
+    /* The journal wrapped over entries we did not copy yet.  Skip
+     * ahead by whole batches, leaving half the journal. */
+    if (avail > PCIEBENCH_JOURNAL_SZ - PCIEBENCH_STREAM_BATCH) {
+        n = (avail - PCIEBENCH_JOURNAL_SZ / 2) &
+            ~PCIEBENCH_STREAM_BATCH_mask;
+        lost += n;
+        avail -= n;
+        stream_state.lost = lost;
     }
+
+    if (avail > PCIEBENCH_STREAM_BATCH)
+        n = PCIEBENCH_STREAM_BATCH;
+    else
+        n = avail;
+
+    /* Wait for a full batch unless the test has finished */
+    if (n == 0 || (n < PCIEBENCH_STREAM_BATCH && ctrl != STREAM_STOP)) {
+        if (ctrl == STREAM_STOP)
+            stream_state.ctrl = STREAM_IDLE;
+        return;
+    }
+
+    /* Wait for the host to make room in the ring */
+    if (drained + n - stream_state.cons > PCIEBENCH_STREAM_SZ)
+        return;
+
+    /* Journal entry (base + drained + lost) to host ring entry
+     * @drained, stopping at the end of either */
+    idx = (stream_state.base + drained + lost) &
+        (PCIEBENCH_JOURNAL_SZ - 1);
+    if (n > PCIEBENCH_JOURNAL_SZ - idx)
+        n = PCIEBENCH_JOURNAL_SZ - idx;
+    if (n > PCIEBENCH_STREAM_SZ - (drained & (PCIEBENCH_STREAM_SZ - 1)))
+        n = PCIEBENCH_STREAM_SZ - (drained & (PCIEBENCH_STREAM_SZ - 1));
+    xfer_dma(MEM_JOURNAL_ADDR(test_journal) + (idx << 2),
+             (drained & (PCIEBENCH_STREAM_SZ - 1)) << 2, n << 2);
+
+    stream_state.drained = drained + n;
 }
 
 /* -*-  Mode:C; c-basic-offset:4; tab-width:4 -*- */
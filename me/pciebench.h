@@ -33,6 +33,18 @@
  */
 #define PCIEBENCH_MAX_CMD_SZ 64
 
+/**
+ * Specialised measurement loops
+ *
+ * The measured loops of all tests are intrinsics which take the test
+ * and the flags they depend on as arguments.  If
+ * @PCIEBENCH_SPECIALISE is defined (SPECIALISE=1 in the Makefile, the
+ * default) the callers pick between them with compile time constants,
+ * so a separate loop without any test or flag checks is built for each
+ * combination.  Otherwise a single generic loop is built per test
+ * function, which uses less code store.
+ */
+
 
 /**
  * Memory management:
@@ -66,6 +78,16 @@
  *
  * An array element is 64bit, with the low 40bit containing the host
  * DMA address and the top byte being the chunk index.
+ *
+ *
+ * Byte order: Everything the host and the MEs exchange through host
+ * memory (the transfer area, descriptor rings, clock stamps and
+ * pointer chasing links) is made of 32 bit little endian words, the
+ * byte order of the host.  The PCIe interface of the NFP keeps the
+ * value of 32 bit words, so the MEs access them as native words, and
+ * the host side (nfp-pciebench-helper and the Python code) converts
+ * explicitly.  64 bit values are split into two words, e.g. @ts_hi
+ * and @ts_lo of @clock_stamp.
  */
 
 /**
@@ -92,6 +114,15 @@
 #define PCIEBENCH_ADDR_ARRAY_SZ (PCIEBENCH_MAX_MEM / 64)
 #define PCIEBENCH_ADDR_ARRAY_SZ_mask (PCIEBENCH_ADDR_ARRAY_SZ - 1)
 
+/**
+ * Maximum number of worker MEs
+ */
+#ifdef __NFP_IS_3200
+#define PCIEBENCH_LAST_WORKER_ME 7
+#else
+#define PCIEBENCH_LAST_WORKER_ME 11
+#endif
+
 /**
  * Queue indices to use for journaling.
  *
@@ -99,6 +130,14 @@
  * it. @PCIEBENCH_JOURNAL_SZ defines the number of 32bit entries in the
  * journal.
  * @debug_journal is for address debugging.
+ *
+ * The journals are set up once when the firmware is loaded and are
+ * never reset.  Instead, @journal_pos and @dbg_journal_pos count the
+ * entries written to the test and the debug journal so far, and tests
+ * report where their entries start, so the firmware can run any number
+ * of tests without being reloaded.  Each test reserves the range of
+ * entries it writes with an atomic add before writing them, and only
+ * tests which write to the debug journal advance @dbg_journal_pos.
  */
 #define PCIEBENCH_JOURNAL_RNUM 1
 #define PCIEBENCH_JOURNAL_SZ (16 * 1024 * 1024)
@@ -111,6 +150,99 @@ MEM_JOURNAL_DECLARE_EXT(test_journal);
 
 MEM_JOURNAL_DECLARE_EXT(debug_journal);
 
+/**
+ * Transfer area
+ *
+ * The host driver allocates a transfer area separately from the test
+ * buffers, in @PCIEBENCH_XFER_CHUNKS chunks of @PCIEBENCH_CHUNK_SZ,
+ * and the host writes their DMA addresses to @host_xfer_addrs.  The
+ * first @PCIEBENCH_XFER_JOURNAL_CHUNKS chunks are large enough to hold
+ * the entire test journal, the last chunk holds the results of each
+ * slot (at offset @slot * sizeof(struct test_result)).
+ *
+ * With @LAT_FLAGS_XFER set, the master of a slot DMAs the journal
+ * entries of a latency test and the results into the transfer area
+ * once the test is done.  The host can then read them from host
+ * memory instead of through the (slow) CPP explicit path.  The
+ * journal entries always start at the beginning of the transfer area.
+ *
+ * NOTE: These need to be kept in sync with the kernel module.
+ */
+#define PCIEBENCH_XFER_JOURNAL_CHUNKS \
+    (PCIEBENCH_JOURNAL_SZ * 4 / PCIEBENCH_CHUNK_SZ)
+#define PCIEBENCH_XFER_RESULT_CHUNK PCIEBENCH_XFER_JOURNAL_CHUNKS
+#define PCIEBENCH_XFER_CHUNKS (PCIEBENCH_XFER_JOURNAL_CHUNKS + 1)
+
+/* Largest DMA used for transfers and host cache warming/thrashing
+ * (the 3200 DMA engines do up to 2K) */
+#ifdef __NFP_IS_3200
+#define PCIEBENCH_XFER_DMA_SZ 2048
+#else
+#define PCIEBENCH_XFER_DMA_SZ 4096
+#endif
+
+/**
+ * Chained DMAs
+ *
+ * DMA latency and bandwidth tests support transactions of up to
+ * @PCIEBENCH_MAX_TRANS_SZ bytes.  Transactions larger than
+ * @PCIEBENCH_XFER_DMA_SZ are split into a chain of descriptors, none
+ * of which crosses a 4K boundary in host memory, enqueued back to back
+ * on the same queue.  Only the last descriptor of a chain signals its
+ * completion.  The DMA engine processes the descriptors of a queue in
+ * order, so this is the completion of the whole transaction, and
+ * latencies and bandwidth are measured per transaction.
+ *
+ * Transactions of up to 4K are placed so that they don't cross a 4K
+ * boundary in host memory, larger ones so that they don't cross a
+ * chunk boundary, as only chunks are contiguous in DMA address space.
+ */
+#define PCIEBENCH_MAX_TRANS_SZ (64 * 1024)
+
+/**
+ * Journal streaming
+ *
+ * For runs longer than the journal, latency tests can stream the
+ * test journal into a ring in host memory (@LAT_FLAGS_STREAM).  The
+ * ring occupies the journal part of the transfer area and holds
+ * @PCIEBENCH_STREAM_SZ 32bit entries.
+ *
+ * Context 7 of ME @PCIEBENCH_STREAM_ME drains the journal while it is
+ * idle as a DMA worker, copying @PCIEBENCH_STREAM_BATCH entries at a
+ * time to the host ring with a single DMA.  Tests fence the journal
+ * before publishing their progress in @stream_state.prod.  If another
+ * slot runs a bandwidth test on that ME meanwhile, draining pauses
+ * until it is done.  Progress is tracked in @stream_state using free running
+ * entry counts: Entry n in the stream is at offset
+ * (n % @PCIEBENCH_STREAM_SZ) * 4 in the host ring.  The host advances
+ * @cons as it consumes entries.  If the host falls behind so far that
+ * the journal wraps, the drainer skips the overwritten entries and
+ * accounts for them in @lost.  Stream entry 0 is journal entry
+ * @base.
+ */
+#define PCIEBENCH_STREAM_SZ PCIEBENCH_JOURNAL_SZ
+#define PCIEBENCH_STREAM_ME PCIEBENCH_LAST_WORKER_ME
+#define PCIEBENCH_STREAM_BATCH (PCIEBENCH_XFER_DMA_SZ / 4)
+#define PCIEBENCH_STREAM_BATCH_mask (PCIEBENCH_STREAM_BATCH - 1)
+
+/* Interval (in timestamp ticks) at which an idle drainer polls */
+#define PCIEBENCH_STREAM_POLL 1024
+
+enum stream_ctrl {
+    STREAM_IDLE = 0,            /*< No streaming test is running */
+    STREAM_RUN  = 1,            /*< Streaming test running */
+    STREAM_STOP = 2,            /*< Test finished, drain the rest */
+};
+
+struct stream_state {
+    uint32_t ctrl;              /*< See @stream_ctrl */
+    uint32_t prod;              /*< Entries written to the journal */
+    uint32_t drained;           /*< Entries copied to the host ring */
+    uint32_t cons;              /*< Entries consumed (written by host) */
+    uint32_t lost;              /*< Entries skipped as the host was slow */
+    uint32_t base;              /*< Journal entry of the first entry */
+};
+
 /**
  * How much data should be transferred for bandwidth tests.
  *
@@ -138,32 +270,168 @@ __shared __lmem extern uint64_t chunk_dma_addrs[PCIEBENCH_CHUNKS];
  */
 #define PCIEBENCH_CTRL_SIGNO 15
 
-/**
- * Maximum number of worker MEs
- */
-#ifdef __NFP_IS_3200
-#define PCIEBENCH_LAST_WORKER_ME 7
-#else
-#define PCIEBENCH_LAST_WORKER_ME 11
-#endif
 
 /**
  * Memory for NFP side buffer
  * We use CTM on the 6k and dram memory on the 3200. Size must be
- * power of two to allow masking of address offsets on the card.
+ * power of two to allow masking of address offsets on the card and
+ * large enough for a transaction of @PCIEBENCH_MAX_TRANS_SZ at any
+ * device offset.
  */
 #ifdef __NFP_IS_3200
 #define __NFP_BUF_LOC __mem
 #else
 #define __NFP_BUF_LOC __ctm_n(4) __shared __declspec(scope(global))
 #endif
-#define NFP_BUF_SZ (8 * 1024)
+#define NFP_BUF_SZ (2 * PCIEBENCH_MAX_TRANS_SZ)
 #define NFP_BUF_SZ64 (NFP_BUF_SZ / 8)
 
 __export __NFP_BUF_LOC extern volatile uint64_t nfp_buf[NFP_BUF_SZ64];
 
+/**
+ * NFP buffer memories
+ *
+ * On the NFP-6000 there is an NFP side buffer of @NFP_BUF_SZ in each
+ * of CTM (@nfp_buf), IMEM and EMEM.  DMA tests select the buffer with
+ * their @p7 parameter, one of @nfp_buf_mem, and the device offset
+ * (@p4) may be anywhere in the buffer as long as the transaction
+ * fits.  The NFP-3200 only has @nfp_buf in DRAM, which is used for
+ * @NFP_BUF_DEFAULT and @NFP_BUF_EMEM.  Host cache warming and
+ * thrashing always use @nfp_buf.
+ */
+enum nfp_buf_mem {
+    NFP_BUF_DEFAULT = 0,        /*< @nfp_buf */
+    NFP_BUF_CTM     = 1,        /*< CTM (NFP-6000 only) */
+    NFP_BUF_IMEM    = 2,        /*< IMEM (NFP-6000 only) */
+    NFP_BUF_EMEM    = 3,        /*< EMEM (DRAM on the NFP-3200) */
+};
+
+#ifndef __NFP_IS_3200
+__export __imem extern volatile uint64_t nfp_buf_imem[NFP_BUF_SZ64];
+__export __emem extern volatile uint64_t nfp_buf_emem[NFP_BUF_SZ64];
+#endif
+
+/**
+ * Test slots
+ *
+ * The host may run up to @PCIEBENCH_SLOTS independent tests
+ * concurrently.  Each slot has its own control word, parameters and
+ * results (see shared.c) and is bound to a contiguous range of MEs in
+ * the island and to a window of host memory starting at @host_off.
+ *
+ * The first ME of a slot acts as the master for the slot: Context 0
+ * runs latency tests itself and co-ordinates the worker contexts for
+ * bandwidth tests.  All other contexts in the range of MEs are DMA
+ * workers.  Context 0 in ME 0 also dispatches tests to the master MEs
+ * of the other slots.  While it runs a test in a slot starting at ME 0
+ * it can't dispatch tests to other slots, so the host should start
+ * such a test last.
+ *
+ * By default slot 0 covers all MEs and the whole host buffer.  Slots
+ * which run at the same time must not share MEs (the dispatcher
+ * rejects tests which would overlap with a running slot).  The
+ * journals are shared between all slots, so only one latency test
+ * should be run at a time.
+ */
+#define PCIEBENCH_SLOTS 4
+
+struct test_slot {
+    uint32_t me_first;          /*< First ME of the slot (master) */
+    uint32_t me_last;           /*< Last ME of the slot */
+    uint32_t host_off;          /*< Start of the host window (4K aligned) */
+    uint32_t islands;           /*< Worker islands used (see below) */
+};
+
+/**
+ * Worker islands (NFP-6000 only)
+ *
+ * The firmware may be built with @PCIEBENCH_ISLANDS ME islands
+ * (ISLANDS in the Makefile).  The first one, i32, runs the code
+ * described so far.  All MEs of the others are DMA workers for the
+ * bandwidth tests of the slot which has @islands set to the number of
+ * worker islands it uses, starting with the island after i32.  Slots
+ * using worker islands can't run at the same time.
+ *
+ * CLS is local to an island, so the work is shared through EMEM.  The
+ * master of the slot writes the test and the number of DMAs to
+ * @island_job and signals context 0 of ME 0 of each worker island,
+ * which starts the other contexts and MEs of its island in the same
+ * way as in i32.  All workers of the slot, including the ones in i32,
+ * take DMAs off @island_job.trans instead of @num_dma_trans.  As
+ * usual, the worker which takes the last DMA signals the master.
+ * Every worker context of a worker island increments
+ * @island_job.done when it is finished, and the master waits for all
+ * of them before it reports the result, so no worker can still be
+ * busy with a test when the next one starts.
+ */
+#ifndef PCIEBENCH_ISLANDS
+#define PCIEBENCH_ISLANDS 1
+#endif
+
+#if defined(__NFP_IS_3200) && PCIEBENCH_ISLANDS > 1
+#error "Worker islands are not supported on the NFP-3200"
+#endif
+
+/* Number of worker contexts in a worker island */
+#define PCIEBENCH_ISLAND_WORKERS ((PCIEBENCH_LAST_WORKER_ME + 1) * 8)
+
+struct island_job {
+    uint32_t test;              /*< Test to run (@BW_DMA_*) */
+    uint32_t slot;              /*< Slot of the test */
+    uint32_t master;            /*< __ME() of the master of the slot */
+    uint32_t trans_sz;          /*< Transaction size */
+    uint32_t d_off;             /*< Offset into the NFP buffer */
+    uint32_t trans;             /*< Number of DMAs left to issue */
+    uint32_t done;              /*< Worker contexts finished */
+    uint32_t mem;               /*< NFP buffer (see @nfp_buf_mem) */
+    uint32_t flags;             /*< Test flags (see @lat_flags) */
+};
+
+/* Island (cluster on the NFP-3200) of the master ME, i.e., mei0 */
+#ifdef __NFP_IS_3200
+#define PCIEBENCH_FIRST_ISL 1
+#else
+#define PCIEBENCH_FIRST_ISL 32
+#endif
+
+/**
+ * Worker statistics
+ *
+ * Each worker context of a bandwidth test records the number of DMAs
+ * it issued, the bytes transferred and the timestamps just before it
+ * took its first DMA and after its last DMA completed in its entry of
+ * @worker_stats.  Entries are indexed by island (relative to
+ * @PCIEBENCH_FIRST_ISL), ME and context, i.e., entry
+ * (isl * (@PCIEBENCH_LAST_WORKER_ME + 1) + me) * 8 + ctx.  They are
+ * only written by contexts taking part in a test, so the host should
+ * ignore entries with a first timestamp before the start of the test.
+ */
+struct worker_stats {
+    uint32_t dmas;              /*< DMAs issued */
+    uint32_t bytes_hi;          /*< Bytes transferred (top 32 bit) */
+    uint32_t bytes_lo;          /*< Bytes transferred (bottom 32 bit) */
+    uint32_t first_hi;          /*< Timestamp before the first DMA */
+    uint32_t first_lo;
+    uint32_t last_hi;           /*< Timestamp after the last DMA */
+    uint32_t last_lo;
+    uint32_t reserved;
+};
+
+#define PCIEBENCH_WORKER_STATS (PCIEBENCH_ISLANDS * PCIEBENCH_ISLAND_WORKERS)
+
+/**
+ * Execute the test configured for @slot and report the result.
+ * @slot      Slot to execute
+ *
+ * Must be called by context 0 of the master ME of the slot.  The
+ * results are written to the slot's @test_result and the test control
+ * word is set to 0 on success or negative on error.
+ */
+void slot_run(uint32_t slot);
+
 /**
  * Initialise the state for address calculation
+ * @slot      Slot the addresses are for
  * @win_sz    Size of the window
  * @trans_sz  Transaction size
  * @h_off     Host offset
@@ -171,13 +439,15 @@ __export __NFP_BUF_LOC extern volatile uint64_t nfp_buf[NFP_BUF_SZ64];
  *
  * This function pre-calculates and array of DMA addresses based on
  * the parameters. @dma_addr_from_idx() then becomes a simple array
- * lookup.
+ * lookup.  Each slot has its own array and its window starts at the
+ * host offset configured for the slot.
  */
-__intrinsic void dma_addr_init(uint32_t win_sz, uint32_t sz,
+__intrinsic void dma_addr_init(uint32_t slot, uint32_t win_sz, uint32_t sz,
                                uint32_t off, uint32_t flags);
 
 /**
  * Translate a unit index into a DMA address
+ * @slot        Slot to use
  * @idx         Unit index
  * @addr_hi     Return high bits of DMA address
  * @addr_lo     Return low bits of DMA address
@@ -185,22 +455,42 @@ __intrinsic void dma_addr_init(uint32_t win_sz, uint32_t sz,
  *
  * This function relies on the array set up in @dma_addr_init().
  */
-__intrinsic void dma_addr_from_idx(uint32_t idx,
+__intrinsic void dma_addr_from_idx(uint32_t slot, uint32_t idx,
                                    __gpr uint32_t *addr_hi,
                                    __gpr uint32_t *addr_lo,
                                    __gpr uint32_t *chunk_idx);
 
 /**
  * Attempt to thrash or warm the host cache.  For thrashing the host
- * cache we write randomly to the entire host buffers.  For warming,
- * use sequential writes to the host memory in the window.
+ * cache we write randomly to the part of the host buffer @slot owns,
+ * from its @host_off up to the @host_off of the next slot (or the end
+ * of the host buffer), so that concurrent tests in other slots are not
+ * disturbed.  For warming, use sequential writes to the host memory in
+ * the window of @slot.
+ * Both use large DMA writes issued from all worker contexts of @slot.
+ *
+ * NOTE: These functions use the worker contexts and the shared test
+ * arguments so any benchmarking code should call these functions
+ * *before* setting up the benchmark specific local state.
+ */
+__intrinsic void host_trash_cache(uint32_t slot);
+__intrinsic void host_warm_cache(uint32_t slot, int win_sz);
+
+/**
+ * Start and stop streaming the test journal to the host.
+ * @entries   Total number of entries written to the journal
  *
- * NOTE: These functions use @dma_addr_init() and @dma_addr_from_idx()
- * so any benchmarking code should call these functions *before*
- * setting up the benchmark specific local state.
+ * @stream_start() returns non-zero if the drainer is still busy with
+ * a previous test.  Otherwise the test reserves its journal entries
+ * and sets @stream_state.base to the first one.  Tests update
+ * @stream_state.prod every @PCIEBENCH_STREAM_BATCH entries while
+ * streaming.
  */
-__intrinsic void host_trash_cache(void);
-__intrinsic void host_warm_cache(int win_sz);
+__intrinsic int stream_start(void);
+__intrinsic void stream_stop(uint32_t entries);
+
+/* One step of the journal drainer, see @dma_bw_worker */
+__intrinsic void stream_drain(uint32_t ctrl);
 
 
 /**
@@ -216,11 +506,22 @@ enum pciebench_tests {
     BW_DMA_RD    =   5,  /* see @bw_dma */
     BW_DMA_WR    =   6,  /* see @bw_dma */
     BW_DMA_RW    =   7,  /* see @bw_dma */
+    TEST_QUEUE   =   8,  /* see "Test queue" below */
+    TEST_SWEEP   =   9,  /* see "Parameter sweeps" below */
+    RING_DESC    =  10,  /* see "Host descriptor ring" below */
+    D2H_VIS      =  11,  /* see "One-way latencies" below */
+    H2D_FRESH    =  12,  /* see "One-way latencies" below */
+    CLOCK_SYNC   =  13,  /* see "Clock synchronisation" below */
+    WR_COALESCE  =  14,  /* see "Write coalescing" below */
+    READ_ORDER   =  15,  /* see "Read completion ordering" below */
+
+    /* Internal, only used between the slot master and its workers */
+    HOST_FILL    = 255,  /* see @host_trash_cache */
 };
 
 
 /**
- * Each test may have up to 4 parameters.  See test documentation for details
+ * Each test may have up to 8 parameters.  See test documentation for details
  */
 struct test_params {
     uint32_t p0;
@@ -228,13 +529,16 @@ struct test_params {
     uint32_t p2;
     uint32_t p3;
     uint32_t p4;
+    uint32_t p5;
+    uint32_t p6;
+    uint32_t p7;
 };
 
 
 /**
  * Result for a test.
  *
- * @rX are 4 generic result values. See test documentation for details.
+ * @rX are 8 generic result values. See test documentation for details.
  */
 struct test_result {
     uint32_t start_hi;          /*< Top 32 bit of ME timestamp at start */
@@ -246,6 +550,10 @@ struct test_result {
     uint32_t r1;
     uint32_t r2;
     uint32_t r3;
+    uint32_t r4;
+    uint32_t r5;
+    uint32_t r6;
+    uint32_t r7;
 };
 
 
@@ -257,13 +565,32 @@ enum lat_flags {
     LAT_FLAGS_THRASH      = 1 << 1,  /*< Clean the buffers before the test */
     LAT_FLAGS_RANDOM      = 1 << 2,  /*< Random access */
     LAT_FLAGS_LONG        = 1 << 3,  /*< Run longer than default */
+    LAT_FLAGS_STREAM      = 1 << 4,  /*< Stream the journal to the host */
+    LAT_FLAGS_XFER        = 1 << 5,  /*< DMA journal/results to the host */
+    LAT_FLAGS_RATE        = 1 << 6,  /*< BW tests at a given rate */
+    LAT_FLAGS_SIZES       = 1 << 7,  /*< BW tests with a size distribution */
+    LAT_FLAGS_RO          = 1 << 8,  /*< DMAs with relaxed ordering */
+    LAT_FLAGS_NS          = 1 << 9,  /*< DMAs with no snoop */
+    LAT_FLAGS_DUPLEX      = 1 << 10, /*< BW_DMA_RW with read/write pools */
+    LAT_FLAGS_TIMELINE    = 1 << 11, /*< Journal start timestamps */
+    LAT_FLAGS_CHASE       = 1 << 12, /*< LAT_DMA_RD chasing pointers */
     LAT_FLAGS_RESERVED    = 1 << 31
 };
 
+/* All valid flags.  @LAT_FLAGS_RESERVED is used by the host and ignored
+ * by the firmware.  Tests with any other flag set are rejected. */
+#define LAT_FLAGS_ALL                                                   \
+    (LAT_FLAGS_WARM | LAT_FLAGS_THRASH | LAT_FLAGS_RANDOM |             \
+     LAT_FLAGS_LONG | LAT_FLAGS_STREAM | LAT_FLAGS_XFER |               \
+     LAT_FLAGS_RATE | LAT_FLAGS_SIZES | LAT_FLAGS_RO | LAT_FLAGS_NS |    \
+     LAT_FLAGS_DUPLEX | LAT_FLAGS_TIMELINE | LAT_FLAGS_CHASE |          \
+     LAT_FLAGS_RESERVED)
+
 
 /**
  * Read/write data from the host using the PCIe command and measure the time.
  *
+ * @param slot  Slot the test runs in
  * @param p     Parameters/arguments for the test
  * @param r     Results returned
  * @param test  Which test to run (see below)
@@ -280,6 +607,7 @@ enum lat_flags {
  * @p2:         Window size to operate on
  * @p3:         Offset from a host cacheline start for the read/write
  * @p4:         Not used
+ * @p5:         Number of transactions (if not 0)
  *
  * This functions measures the latency of PCIe commands, either a
  * simple read (@LAT_CMD_RD) or a write to a host memory location
@@ -303,7 +631,11 @@ enum lat_flags {
  * that even for the largest window size, each host cache line is hit
  * at least twice.  When @LAT_FLAGS_LONG is set,
  * @PCIEBENCH_JOURNAL_SZ transactions are performed, filling the entire
- * journal.
+ * journal.  If @p5 is set, @p5 transactions are performed instead.
+ * @p5 must be set with @LAT_FLAGS_STREAM, which streams the journal
+ * to the host while the test runs (see "Journal streaming" above),
+ * allowing for runs of arbitrary length.  Without streaming, runs
+ * longer than the journal overwrite their first entries.
  *
  * If the flag @LAT_FLAGS_WARM is set, the code writes full host
  * cachelines to the entire window, starting from the start, before
@@ -317,10 +649,21 @@ enum lat_flags {
  * on the host, this should ensure that the caches are clean from any
  * addresses the MEs may access.
  *
+ * If the flag @LAT_FLAGS_TIMELINE is set, the debug journal holds the
+ * 64bit ME timestamp at the start of each transaction (top and bottom
+ * 32 bit) instead of its host address.  The top 32 bit are read after
+ * the transaction, outside of the measurement, so they are one too
+ * large if the bottom 32 bit wrapped during the transaction.
+ *
  * In the result struct, the start/end time values are set outside the
  * main loop, so they represent the total time spent on the test. The
  * other results are set as follows:
  * @r0:         Number of PCIe transactions (items in journal)
+ * @r1:         Index of the first entry in the test journal
+ * @r2:         Index of the first entry in the debug journal
+ * @r3:         Minimum latency (in timestamp ticks)
+ * @r4:         Maximum latency (in timestamp ticks)
+ * @r5/@r6:     Sum of all latencies (top/bottom 32 bit, in ticks)
  *
  * Using the start/end timestamps in the result structure together
  * with @r0, one can calculate the average cost of each loop.  Note,
@@ -329,12 +672,13 @@ enum lat_flags {
  * the time spent on calculating the next address as well as any BAR
  * re-configurations.
  */
-__intrinsic int32_t cmd_lat(__gpr struct test_params *p,
+__intrinsic int32_t cmd_lat(uint32_t slot, __gpr struct test_params *p,
                             __gpr struct test_result *r, int test);
 
 /**
  * Read/write data from the host using the DMA engine and measure the time.
  *
+ * @param slot  Slot the test runs in
  * @param p     Parameters/arguments for the test
  * @param r     Results returned
  * @param test  Which test to run (see below)
@@ -354,16 +698,533 @@ __intrinsic int32_t cmd_lat(__gpr struct test_params *p,
  * @p2:         Window size to operate on
  * @p3:         Offset from a host cacheline start for the read/write
  * @p4:         Offset from start of NFP buffer
+ * @p5:         Number of transactions (if not 0)
+ * @p6:         Number of segments per transaction (if > 1)
+ * @p7:         NFP buffer memory (see "NFP buffer memories")
+ *
+ * Gather/scatter: If @p6 is larger than 1, each transaction consists
+ * of @p6 segments of @p1 bytes at independent host addresses
+ * (consecutive units of the window, or random ones with
+ * @LAT_FLAGS_RANDOM) and consecutive NFP buffer addresses, like a
+ * packet made of several fragments.  The addresses of all segments
+ * are looked up before the first timestamp and the segments are
+ * enqueued back to back, with only the last one signalling completion
+ * (like "Chained DMAs").  The latency is measured until the last
+ * segment completes.  @p6 can be at most @PCIEBENCH_SG_MAX and
+ * segments can't be larger than @PCIEBENCH_XFER_DMA_SZ.
+ *
+ * Pointer chasing: With @LAT_FLAGS_CHASE set, @LAT_DMA_RD does not use
+ * precomputed addresses.  Instead, the host links the units of the
+ * window (see @dma_addr_init()) into a cycle, with the 32 bit word
+ * (see "Byte order") at @p3 in each unit holding the index of the next
+ * unit.  Each read fetches the next index from the data it returned
+ * to the NFP buffer, so there is nothing the host could prefetch or
+ * overlap, like when walking a chain of descriptors.  The walk starts
+ * at unit 0.  The unit size (@p1 + @p3 rounded up to 64) must be a
+ * power of 2 of at most 4K and @p4 a multiple of 8.  @LAT_FLAGS_WARM
+ * and @LAT_FLAGS_THRASH would overwrite the links and are not
+ * supported, nor are gather/scatter and chained DMAs.
  */
-__intrinsic int32_t dma_lat(__gpr struct test_params *p,
+#define PCIEBENCH_SG_MAX 32
+
+__intrinsic int32_t dma_lat(uint32_t slot, __gpr struct test_params *p,
                             __gpr struct test_result *r, int test);
 
 
 
-__intrinsic int32_t dma_bw(__gpr struct test_params *p,
+__intrinsic int32_t dma_bw(uint32_t slot, __gpr struct test_params *p,
                            __gpr struct test_result *r, int test);
 
+/**
+ * Rate controlled bandwidth tests
+ *
+ * With @LAT_FLAGS_RATE set, the workers of a bandwidth test do not
+ * issue DMAs as fast as they can but at the rate configured in the
+ * slot's @rate_spec (open loop).  DMA n is scheduled at the start of
+ * the test plus the sum of the first n inter-arrival times, which are
+ * either constant (@RATE_CONST) or exponentially distributed
+ * (@RATE_POISSON) with a mean of @interval ME cycles.  The workers
+ * take inter-arrival times from a shared CLS counter, so the schedule
+ * does not depend on which worker issues a DMA.  If @on is non-zero,
+ * the schedule is only advanced during @on cycles, followed by @off
+ * cycles without DMAs (on/off bursts).
+ *
+ * A worker waits for the scheduled time of its DMA, issues it and
+ * waits for it to complete.  The latency of the DMA is measured from
+ * its scheduled time (not the time it was issued), so it includes any
+ * time spent waiting for a free worker when the offered load is
+ * higher than the workers can sustain.  The latency (in timestamp
+ * ticks) of every 2^@sample_shift-th DMA is written to the test
+ * journal.
+ *
+ * Rate controlled tests can't be combined with @LAT_FLAGS_STREAM or
+ * worker islands.  The results are:
+ * @r0:         Number of DMAs
+ * @r1:         Index of the first entry in the test journal
+ * @r3:         Number of entries in the test journal
+ *
+ * The inter-arrival times of @RATE_POISSON are quantised to 256
+ * values and @interval must be less than 2^21 cycles.  The schedule
+ * is kept in 32 bit cycles, so the whole test, from the start to the
+ * latest possible time of the last DMA, must be shorter than 2^31
+ * cycles: @PCIEBENCH_RATE_LEAD plus the number of DMAs times
+ * @interval, stretched by the off periods and, for @RATE_POISSON, by
+ * @PCIEBENCH_RATE_EXP_MAX / 256.
+ */
+enum rate_mode {
+    RATE_CONST   = 0,           /*< Constant inter-arrival times */
+    RATE_POISSON = 1,           /*< Exponential inter-arrival times */
+};
+
+struct rate_spec {
+    uint32_t interval;          /*< Mean cycles between DMAs */
+    uint32_t mode;              /*< See @rate_mode */
+    uint32_t on;                /*< Cycles with DMAs per burst (or 0) */
+    uint32_t off;               /*< Cycles without DMAs per burst */
+    uint32_t sample_shift;      /*< Journal every 2^@sample_shift DMA */
+    uint32_t reserved[3];
+};
+
+/* Time between the start of a rate controlled test and its first DMA */
+#define PCIEBENCH_RATE_LEAD 16384
+
+/* Largest Poisson inter-arrival time, in 1/256 of @interval */
+#define PCIEBENCH_RATE_EXP_MAX 1597
+
+/*
+ * Transaction size distributions
+ *
+ * With @LAT_FLAGS_SIZES set, the workers of a bandwidth test draw the
+ * length of each DMA from the slot's @size_dist table instead of using
+ * the transaction size of the test.  The host fills the
+ * @PCIEBENCH_SIZE_DIST_SZ entries of the table with sizes in
+ * proportion to their weights and a worker uses the entry indexed by
+ * the ME pseudo random number.  The transaction size of the test must
+ * be the largest size in the table, as it determines the layout of
+ * the DMAs in the window.  The test fails if any entry is 0 or larger
+ * than the transaction size.
+ *
+ * The bytes transferred by each worker context are in the worker
+ * statistics.  Size distributions can't be combined with
+ * @LAT_FLAGS_RATE or worker islands.
+ */
+#define PCIEBENCH_SIZE_DIST_SZ 256
+
+/*
+ * TLP attributes
+ *
+ * @LAT_FLAGS_RO and @LAT_FLAGS_NS set the relaxed ordering and no
+ * snoop attributes on the TLPs of the DMAs of latency and bandwidth
+ * tests.  The NFP-3200 sets them in the DMA descriptor, the NFP-6000
+ * in a DMA config register per combination of attributes.  Whether
+ * the attributes have any effect depends on the root complex and on
+ * relaxed ordering/no snoop being enabled in the device control
+ * register of the NFP.
+ */
+
+/*
+ * Duplex bandwidth tests
+ *
+ * In @BW_DMA_RW all worker contexts alternate between reads and
+ * writes.  With @LAT_FLAGS_DUPLEX set, the worker MEs of the slot are
+ * split into two pools according to the slot's @duplex_spec instead:
+ * The first @rd_mes MEs of the slot only issue reads, the remaining
+ * MEs only issue writes, and each pool takes DMAs off its own budget
+ * of @rd_trans and @wr_trans transactions.  The test ends when both
+ * pools are done.  The results are:
+ * @r0:         Number of DMAs (@rd_trans + @wr_trans)
+ * @r1:         Number of reads
+ * @r2:         Number of writes
+ * @r4:         Timestamp ticks from the start until the last read
+ *              completed
+ * @r5:         Timestamp ticks from the start until the last write
+ *              completed
+ *
+ * Duplex tests can't be combined with @LAT_FLAGS_RATE or worker
+ * islands and both pools need at least one ME and one transaction.
+ */
+struct duplex_spec {
+    uint32_t rd_mes;            /*< Number of MEs in the read pool */
+    uint32_t rd_trans;          /*< Reads to issue */
+    uint32_t wr_trans;          /*< Writes to issue */
+    uint32_t reserved;
+};
+
 /* Entry function for DMA worker threads */
 void dma_bw_worker(void);
 
+/* Entry function for the DMA worker threads in worker islands */
+void island_worker(void);
+
+/**
+ * Copy the results of @slot and @entries journal entries, starting at
+ * @start, to the transfer area in host memory (see "Transfer area").
+ * @slot      Slot the results are for
+ * @r         Results to copy
+ * @start     Index of the first journal entry to copy
+ * @entries   Number of journal entries to copy (may be 0)
+ */
+void xfer_results(uint32_t slot, __gpr struct test_result *r,
+                  uint32_t start, uint32_t entries);
+
+
+/**
+ * Test queue
+ *
+ * Instead of starting one test at a time through @test_ctrl, the host
+ * may fill in a list of tests in @test_queue and start them with a
+ * single @TEST_QUEUE.  The tests are run back to back in the slot the
+ * queue was started on, without any host interaction in between, so
+ * host side cache warming or thrashing only happens once before the
+ * whole queue.
+ *
+ * The parameters for @TEST_QUEUE are:
+ * @p0:         Index of the first queue entry to run
+ * @p1:         Number of queue entries to run
+ *
+ * For each entry, the host sets @test and @params.  Once the test has
+ * run, the firmware writes the results to @result and sets @test to
+ * the return value of the test (0 on success).  @test_ctrl is set to 0
+ * once all entries have run, or to a negative value if the queue
+ * parameters were invalid.
+ */
+#define PCIEBENCH_QUEUE_SZ 256
+
+struct test_queue_entry {
+    int32_t test;               /*< Test to run, return value once run */
+    struct test_params params;  /*< Test parameters */
+    struct test_result result;  /*< Test results */
+    uint32_t reserved[11];      /*< Pad to 128B */
+};
+
+
+/**
+ * Parameter sweeps
+ *
+ * @TEST_SWEEP runs a test over a grid of transaction sizes, host
+ * offsets and device offsets described by @sweep_spec, without any
+ * host interaction.  The test parameters for each point are:
+ * @p0:         @flags (without @LAT_FLAGS_STREAM and @LAT_FLAGS_XFER)
+ * @p1:         Transaction size, one of @sizes
+ * @p2:         @win_sz
+ * @p3:         Host offset, @h_off_first to @h_off_last in @h_off_step
+ * @p4:         Device offset, @d_off_first to @d_off_last in @d_off_step
+ * @p5:         @samples
+ *
+ * The points are run with the transaction size as the outermost and
+ * the device offset as the innermost loop.  The summary of point n is
+ * written to @sweep_points[n].  For latency tests it contains the
+ * latency stats reported by the test (see @cmd_lat), so the journal
+ * does not need to be read.  For bandwidth tests the duration and the
+ * number of DMAs give the bandwidth and the latency stats are not set.
+ * @test_ctrl is set to a negative value if the grid is invalid or has
+ * more than @PCIEBENCH_SWEEP_POINTS points.  The parameters of
+ * @TEST_SWEEP itself are not used.
+ */
+#define PCIEBENCH_SWEEP_SIZES 16
+#define PCIEBENCH_SWEEP_POINTS 4096
+
+struct sweep_spec {
+    uint32_t test;              /*< Test to run for each point */
+    uint32_t flags;             /*< Test flags */
+    uint32_t win_sz;            /*< Window size */
+    uint32_t samples;           /*< Transactions per point (0: default) */
+    uint32_t h_off_first;       /*< Host offsets */
+    uint32_t h_off_last;
+    uint32_t h_off_step;
+    uint32_t d_off_first;       /*< Device offsets */
+    uint32_t d_off_last;
+    uint32_t d_off_step;
+    uint32_t num_sizes;         /*< Number of entries in @sizes */
+    uint32_t mem;               /*< NFP buffer (see @nfp_buf_mem) */
+    uint32_t reserved[4];       /*< Pad to 64B */
+    uint32_t sizes[PCIEBENCH_SWEEP_SIZES]; /*< Transaction sizes */
+};
+
+struct sweep_point {
+    int32_t status;             /*< Return value of the test */
+    uint32_t trans_sz;          /*< Parameters of the point */
+    uint32_t h_off;
+    uint32_t d_off;
+    uint32_t ticks;             /*< Duration of the test (timestamp ticks) */
+    uint32_t count;             /*< Number of transactions (@r0) */
+    uint32_t lat_min;           /*< Latency tests: @r3 to @r6 */
+    uint32_t lat_max;
+    uint32_t lat_sum_hi;
+    uint32_t lat_sum_lo;
+    uint32_t reserved[6];       /*< Pad to 64B */
+};
+
+
+/**
+ * Waiting for the host
+ *
+ * Tests with a live host side, like the ones below, give up and
+ * return -1 if the host makes no progress for @PCIEBENCH_HOST_TIMEOUT
+ * timestamp ticks (about 3.6s at 1.2GHz), e.g. because the host side
+ * was never started or died.
+ */
+#define PCIEBENCH_HOST_TIMEOUT (1 << 28)
+
+
+/**
+ * Host descriptor ring
+ *
+ * @RING_DESC emulates the transmit path of a NIC with a live host
+ * thread (see the -e option of nfp-pciebench-helper).  The host
+ * produces descriptors into a ring at the start of the slot's host
+ * buffer and the master of the slot fetches them with one DMA per
+ * batch, fetches the buffer each descriptor points to (if its @len is
+ * non-zero) into the NFP buffer and DMAs a completion for each
+ * descriptor of the batch into the completion ring at
+ * @PCIEBENCH_RING_CMPL_OFF, which the host reaps.  Descriptor and
+ * completion @i of the ring carry sequence number @i + 1 (modulo
+ * wrapping), so the host must zero both rings before the test.
+ *
+ * With @RING_POLL the master polls the descriptor ring over PCIe,
+ * i.e., it fetches the next batch until it finds valid descriptors.
+ * With @RING_DOORBELL the host writes the number of descriptors it
+ * produced to @ring_doorbell of the slot every batch (and after the
+ * last descriptor), and the master only fetches descriptors the
+ * doorbell covers.  The host zeroes the doorbell before the test.
+ *
+ * The test parameters are as follows:
+ * @p0:         Flags (only @LAT_FLAGS_RO and @LAT_FLAGS_NS are used)
+ * @p2:         Number of ring entries (a power of 2, at most
+ *              @PCIEBENCH_RING_SZ)
+ * @p3:         Batch size (at most @PCIEBENCH_RING_BATCH and half
+ *              the ring, so that the host can always produce a batch
+ *              the master waits for)
+ * @p4:         @RING_POLL or @RING_DOORBELL
+ * @p5:         Number of descriptors
+ * @p7:         NFP buffer memory (see "NFP buffer memories")
+ *
+ * A buffer must not cross a 4K boundary in host memory.  The results
+ * are:
+ * @r0:         Number of descriptors
+ * @r1:         Descriptor fetches
+ * @r2:         Descriptor fetches which found no new descriptor
+ * @r3:         Descriptors with an invalid buffer (not fetched)
+ */
+#define PCIEBENCH_RING_SZ 4096
+#define PCIEBENCH_RING_BATCH 64
+#define PCIEBENCH_RING_CMPL_OFF (PCIEBENCH_RING_SZ * 16)
+
+enum ring_mode {
+    RING_POLL     = 0,          /*< Poll the descriptor ring */
+    RING_DOORBELL = 1,          /*< Wait for the doorbell */
+};
+
+struct ring_desc {
+    uint32_t seq;               /*< Sequence number */
+    uint32_t off;               /*< Buffer offset in the host buffer */
+    uint32_t len;               /*< Buffer length (0 for none) */
+    uint32_t reserved;
+};
+
+struct ring_cmpl {
+    uint32_t seq;               /*< Sequence number of the descriptor */
+    uint32_t ts;                /*< Timestamp of the completion */
+};
+
+__intrinsic int32_t ring_desc(uint32_t slot, __gpr struct test_params *p,
+                              __gpr struct test_result *r);
+
+
+/**
+ * Clock synchronisation
+ *
+ * To compare ME timestamps with host time, the host and the master of
+ * a slot exchange timestamps: For round @i (starting at 1) the host
+ * takes its time t0, writes @i to the slot's @clock_sync_req and
+ * spins on the host buffer at @PCIEBENCH_SYNC_OFF.  The master waits
+ * for the request, takes an ME timestamp and DMAs a @clock_stamp with
+ * @seq = @i to @PCIEBENCH_SYNC_OFF, where the host sees it at its
+ * time t1.  The ME timestamp was taken between t0 and t1, so the round
+ * with the shortest t1 - t0 gives the offset between the clocks with
+ * an error of at most (t1 - t0) / 2.  Rounds before and after a test
+ * also give the drift of the clocks.  The host zeroes
+ * @clock_sync_req before the test.
+ *
+ * The one-way latency tests synchronise the clocks themselves.  On its
+ * own, @CLOCK_SYNC just serves the rounds, so that the host can map ME
+ * timestamps of any other test to host time (see nfp-pciebench-helper
+ * -k without -v).
+ *
+ * The test parameters are as follows:
+ * @p6:         Clock synchronisation rounds
+ *
+ * The results are:
+ * @r0:         Clock synchronisation rounds
+ */
+#define PCIEBENCH_SYNC_OFF (PCIEBENCH_CHUNK_SZ - 4096)
+
+struct clock_stamp {
+    uint32_t seq;               /*< Sequence number */
+    uint32_t ts_hi;             /*< ME timestamp */
+    uint32_t ts_lo;
+    uint32_t reserved;
+};
+
+__intrinsic int32_t clock_sync(uint32_t slot, __gpr struct test_params *p,
+                               __gpr struct test_result *r);
+
+/**
+ * One-way latencies
+ *
+ * @D2H_VIS measures how long it takes until DMA writes from the device
+ * are visible to a host CPU, with the host side in
+ * nfp-pciebench-helper (see its -v option).  The master DMAs a
+ * @clock_stamp with @seq = @i and the ME timestamp taken just before
+ * setting up the DMA for sample @i (starting at 1) to the cache line
+ * (@i - 1) modulo the window, the next one at least @p4 ME cycles
+ * later.  A host thread spins on the cache line of the next sample
+ * and takes its time when @seq changes.  With the clocks synchronised
+ * before and after the samples (see "Clock synchronisation") the
+ * difference is the one-way latency.
+ *
+ * The test parameters are as follows:
+ * @p0:         Flags (only @LAT_FLAGS_RO and @LAT_FLAGS_NS are used)
+ * @p2:         Window size (a multiple of 64, at most
+ *              @PCIEBENCH_SYNC_OFF)
+ * @p4:         ME cycles between samples
+ * @p5:         Number of samples
+ * @p6:         Clock synchronisation rounds before and after the samples
+ *
+ * The results are:
+ * @r0:         Number of samples
+ * @r1:         Clock synchronisation rounds
+ *
+ * @H2D_FRESH is the mirror case and measures how long it takes until
+ * host CPU stores are visible to reads from the device.  A host thread
+ * takes its time and writes @i to the first word of the cache line
+ * (@i - 1) modulo the window for sample @i (starting at 1).  The
+ * master polls that cache line with 16B reads until one returns @i,
+ * takes an ME timestamp and DMAs a @clock_stamp with @seq = @i to
+ * @PCIEBENCH_ACK_OFF.  The host waits for it before writing the next
+ * sample.  The reads are either DMAs or PCIe reads with CPP commands,
+ * selected by @p3 (see @enum fresh_method).
+ *
+ * The test parameters are as follows:
+ * @p0:         Flags (only @LAT_FLAGS_RO and @LAT_FLAGS_NS are used)
+ * @p2:         Window size (a multiple of 64, at most
+ *              @PCIEBENCH_SYNC_OFF)
+ * @p3:         Read method
+ * @p5:         Number of samples
+ * @p6:         Clock synchronisation rounds before and after the samples
+ *
+ * The results are:
+ * @r0:         Number of samples
+ * @r1:         Clock synchronisation rounds
+ * @r2:         Reads issued
+ * @r3:         Most reads for a single sample
+ */
+#define PCIEBENCH_ACK_OFF (PCIEBENCH_SYNC_OFF + 64)
+
+enum fresh_method {
+    FRESH_DMA     = 0,          /*< Poll with DMA reads */
+    FRESH_CMD     = 1,          /*< Poll with PCIe reads */
+};
+
+__intrinsic int32_t d2h_vis(uint32_t slot, __gpr struct test_params *p,
+                            __gpr struct test_result *r);
+__intrinsic int32_t h2d_fresh(uint32_t slot, __gpr struct test_params *p,
+                              __gpr struct test_result *r);
+
+
+/*
+ * Write coalescing
+ *
+ * @WR_COALESCE emulates a write-combining engine in front of the DMA
+ * engine, e.g. for small completions or counter updates.  A stream of
+ * @p5 logical writes of @p1 bytes arrives on a fixed schedule, one
+ * every @p4 ME cycles, with write @i going to offset (@i * @p1) modulo
+ * the window.  The master of the slot (context 0 only) appends each
+ * arriving write to a pending run, and DMAs the run from the NFP
+ * buffer to the host when it can't grow any further (it reached @p3
+ * bytes, or the next write would wrap the window or cross a 4K page)
+ * or when its first write has been pending for @p6 ME cycles.  With
+ * @p6 = 0 a run is flushed as soon as the master gets to it, so only
+ * writes which queued up behind the previous DMA are coalesced, and
+ * with @p3 = @p1 every logical write is a DMA of its own.
+ *
+ * The latency of each logical write, from its scheduled arrival to the
+ * completion of the DMA which carried it, is recorded in the journal
+ * (in 16 cycle units, as for the latency tests).  It includes the time
+ * the write was held back as well as any queueing behind earlier DMAs.
+ *
+ * The test parameters are as follows:
+ * @p0:         Flags (only @LAT_FLAGS_RO and @LAT_FLAGS_NS are used)
+ * @p1:         Size of the logical writes (a power of 2, 8 to 64)
+ * @p2:         Window size (a multiple of 4096)
+ * @p3:         Maximum DMA size (a multiple of @p1, at most
+ *              @PCIEBENCH_XFER_DMA_SZ)
+ * @p4:         ME cycles between logical writes
+ * @p5:         Number of logical writes (at most
+ *              @PCIEBENCH_JOURNAL_SZ, one journal entry each)
+ * @p6:         Flush timeout in ME cycles
+ * @p7:         NFP buffer memory (see "NFP buffer memories")
+ *
+ * The results are:
+ * @r0:         Number of logical writes
+ * @r1:         Position of the first latency in the journal
+ * @r2:         Number of DMAs
+ * @r3:         Number of latencies in the journal
+ * @r4:         DMAs flushed by the timeout
+ * @r5:         Largest latency
+ */
+__intrinsic int32_t wr_coalesce(uint32_t slot, __gpr struct test_params *p,
+                                __gpr struct test_result *r);
+
+
+/*
+ * Read completion ordering
+ *
+ * @READ_ORDER measures whether reads from the host complete in the
+ * order they were issued.  The master of the slot (context 0 only)
+ * issues batches of @p4 reads back to back, read @k of a batch with
+ * its own completion signal, and then polls the signals, taking the
+ * time each read completes.  Read @k of batch @b goes to offset
+ * ((@b * @p4 + @k) * @p1) modulo the window, with @p1 rounded up to 64.
+ * The reads are either DMAs or PCIe reads with CPP commands, selected
+ * by @p3 (see @enum order_method).
+ *
+ * The reorder depth of a read is the number of reads of its batch
+ * issued after it which completed before it.  Its head-of-line latency
+ * is the time from issuing it until it and all reads issued before it
+ * completed, i.e., until a consumer which processes completions in
+ * order could process it.  Each read has two entries in the journal
+ * (in 16 cycle units): its reorder depth in the top 8 bits and its
+ * latency in the bottom 24 bits, followed by its head-of-line latency.
+ *
+ * The test parameters are as follows:
+ * @p0:         Flags (only @LAT_FLAGS_RO and @LAT_FLAGS_NS are used)
+ * @p1:         Read size (a power of 2, 4 to @PCIEBENCH_XFER_DMA_SZ
+ *              for DMAs, 4 for PCIe reads)
+ * @p2:         Window size (a multiple of @p1 and of 64, within one
+ *              chunk for PCIe reads)
+ * @p3:         Read method
+ * @p4:         Reads per batch (1 to @PCIEBENCH_ORDER_MAX)
+ * @p5:         Number of batches (at most @PCIEBENCH_JOURNAL_SZ / (2 *
+ *              @p4), as each read has two journal entries)
+ * @p7:         NFP buffer memory (see "NFP buffer memories")
+ *
+ * The results are:
+ * @r0:         Number of reads
+ * @r1:         Position of the first entry in the journal
+ * @r2:         Reads with a non-zero reorder depth
+ * @r3:         Number of entries in the journal
+ * @r4:         Largest reorder depth
+ * @r5:         Batches with at least one reordered read
+ */
+#define PCIEBENCH_ORDER_MAX 8
+
+enum order_method {
+    ORDER_DMA     = 0,          /*< Read with DMAs */
+    ORDER_CMD     = 1,          /*< Read with PCIe reads */
+};
+
+__intrinsic int32_t read_order(uint32_t slot, __gpr struct test_params *p,
+                               __gpr struct test_result *r);
+
 #endif /* _PCIEBENCH_H_ */
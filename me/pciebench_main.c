@@ -23,28 +23,39 @@
 
 #include "shared.c"
 
+/*
+ * Return a mask of the MEs between @first and @last (inclusive)
+ */
+__intrinsic static uint32_t
+me_mask(uint32_t first, uint32_t last)
+{
+    return ((2 << last) - 1) & ~((1 << first) - 1);
+}
+
+/*
+ * Return a mask of the first @islands worker islands, above the MEs
+ */
+__intrinsic static uint32_t
+island_mask(uint32_t islands)
+{
+    return ((1 << islands) - 1) << 16;
+}
+
 int
 main(void)
 {
-    __gpr struct test_params params;
-    __gpr struct test_result result;
-
-    __gpr uint32_t tmp;
-    __lmem uint32_t *lm_tmp;
-    __cls uint32_t *mem_tmp;
+    __gpr uint32_t slot, s;
+    __gpr uint32_t me_first, me_last, islands;
+    __gpr uint32_t busy_mask;
 
     __NFP_BUF_LOC volatile uint64_t *buf_tmp = nfp_buf;
 
-    __gpr int res;
     __gpr int i;
 
     if (ctx() == 0) {
         /* Init the Pseudo Random number. Make sure we generate a
          * number every cycle. */
-        tmp = local_csr_read(local_csr_ctx_enables);
-        tmp |= 1 << 30;
-        local_csr_write(local_csr_ctx_enables, tmp);
-        local_csr_write(local_csr_pseudo_random_number, 0xdeadbeef);
+        prn_init(0xdeadbeef);
 
         /* Initialise the NFP buffer with a known pattern. Useful for Debug. */
         for (i = 0; i < NFP_BUF_SZ/sizeof(uint64_t); i++, buf_tmp++)
@@ -58,56 +69,47 @@ main(void)
         dma_bw_worker();
     }
 
-    /* Only context 0 executes the following code */
+    /* Only context 0 executes the following code.  It dispatches
+     * tests to the test slots. */
     for (;;) {
-        if (test_ctrl <= 0)
-            continue;
-
-        /* Copy test configuration to local memory/registers */
-        params = test_params;
-        local_csr_write(local_csr_mailbox0, params.p0);
-        local_csr_write(local_csr_mailbox1, params.p1);
-        local_csr_write(local_csr_mailbox2, params.p2);
-        local_csr_write(local_csr_mailbox3, params.p3);
-
-        /* Copy the DMA addresses for each chunk to local memory */
-        lm_tmp = (__lmem uint32_t *)chunk_dma_addrs;
-        mem_tmp = (__cls uint32_t *)host_dma_addrs;
-        for (i = 0; i < sizeof(chunk_dma_addrs); i += 4) {
-            tmp = *mem_tmp++;
-            *lm_tmp++ = tmp;
+        for (slot = 0; slot < PCIEBENCH_SLOTS; slot++) {
+            if (test_ctrl[slot] <= 0 || slot_busy[slot])
+                continue;
+
+            me_first = test_slots[slot].me_first;
+            me_last = test_slots[slot].me_last;
+            islands = test_slots[slot].islands;
+
+            /* Work out which MEs and worker islands are used by
+             * running slots */
+            busy_mask = 0;
+            for (s = 0; s < PCIEBENCH_SLOTS; s++)
+                if (slot_busy[s])
+                    busy_mask |= me_mask(test_slots[s].me_first,
+                                         test_slots[s].me_last) |
+                        island_mask(test_slots[s].islands);
+
+            if ((me_first > me_last) ||
+                (me_last > PCIEBENCH_LAST_WORKER_ME) ||
+                (islands > PCIEBENCH_ISLANDS - 1) ||
+                (test_slots[slot].host_off & 0xfff) ||
+                (busy_mask & (me_mask(me_first, me_last) |
+                              island_mask(islands)))) {
+                test_ctrl[slot] = -3;
+                continue;
+            }
+
+            slot_busy[slot] = 1;
+
+            /* Run tests for slots on this ME directly. Otherwise hand
+             * the test to context 0 of the master ME of the slot. */
+            if (me_first == 0) {
+                slot_run(slot);
+            } else {
+                slot_start[me_first] = slot + 1;
+                signal_me(__ME() >> 4, me_first, 0, PCIEBENCH_CTRL_SIGNO);
+            }
         }
-
-        switch (test_ctrl) {
-        case LAT_CMD_RD:
-            res = cmd_lat(&params, &result, LAT_CMD_RD);
-            break;
-
-        case LAT_CMD_WRRD:
-            res = cmd_lat(&params, &result, LAT_CMD_WRRD);
-            break;
-
-        case LAT_DMA_RD:
-            res = dma_lat(&params, &result, LAT_DMA_RD);
-            break;
-
-        case LAT_DMA_WRRD:
-            res = dma_lat(&params, &result, LAT_DMA_WRRD);
-            break;
-
-        case BW_DMA_RD:
-        case BW_DMA_WR:
-        case BW_DMA_RW:
-            res = dma_bw(&params, &result, test_ctrl);
-            break;
-
-        default:
-            res = -1;
-            continue;
-        }
-
-        test_result = result;
-        test_ctrl = res;
     }
 
     return 0;
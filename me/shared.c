@@ -30,12 +30,43 @@
  * Once the test is finished, the NFP code writes the results to
  * @test_result and sets @test_ctrl to 0 to indicate to the host that
  * the test is finished.
+ *
+ * There is one set of control word, parameters and results per test
+ * slot.  The MEs and host window used by a slot are configured in
+ * @test_slots.  Slot 0 defaults to all MEs and the whole host buffer.
  */
-__export __cls volatile int32_t test_ctrl = 0;
-__export __cls volatile struct test_params test_params;
-__export __cls volatile struct test_result test_result;
+__export __cls volatile int32_t test_ctrl[PCIEBENCH_SLOTS] = {0};
+__export __cls volatile struct test_params test_params[PCIEBENCH_SLOTS];
+__export __cls volatile struct test_result test_result[PCIEBENCH_SLOTS];
+__export __cls volatile struct test_slot test_slots[PCIEBENCH_SLOTS] = {
+    {0, PCIEBENCH_LAST_WORKER_ME, 0, 0}
+};
 __export __cls volatile uint64_t host_dma_addrs[PCIEBENCH_CHUNKS];
 
+/*
+ * Dispatch state for test slots.  @slot_busy is set by the dispatcher
+ * when it hands a test to a slot's master and cleared by the master
+ * just before it reports the result.  The dispatcher asks the master
+ * ME of a slot to run a test by writing the slot number + 1 into
+ * @slot_start (indexed by ME) before signalling context 0 of that ME.
+ */
+__export __cls volatile uint32_t slot_busy[PCIEBENCH_SLOTS] = {0};
+__export __cls volatile uint32_t slot_start[PCIEBENCH_LAST_WORKER_ME + 1] = {0};
+
+/*
+ * The DMA addresses of the transfer area and the state for streaming
+ * the test journal to the host (see "Transfer area" and "Journal
+ * streaming" in pciebench.h)
+ */
+__export __cls volatile uint64_t host_xfer_addrs[PCIEBENCH_XFER_CHUNKS];
+__export __cls volatile struct stream_state stream_state = {0};
+
+/*
+ * The DMA engines can't read CLS, so test results are staged here
+ * before they are copied to the transfer area.
+ */
+__export __emem __align(64) struct test_result xfer_result_buf[PCIEBENCH_SLOTS];
+
 /*
  * The host writes the DMA addresses for each chunk of memory to
  * @host_dma_addrs.  Before a test is started these are copied into
@@ -47,6 +78,92 @@ __shared __lmem uint64_t chunk_dma_addrs[PCIEBENCH_CHUNKS];
  * NFP buffer used for DMA
  */
 __export __NFP_BUF_LOC volatile uint64_t nfp_buf[NFP_BUF_SZ64];
+#ifndef __NFP_IS_3200
+__export __imem __align(NFP_BUF_SZ) volatile uint64_t
+    nfp_buf_imem[NFP_BUF_SZ64];
+__export __emem __align(NFP_BUF_SZ) volatile uint64_t
+    nfp_buf_emem[NFP_BUF_SZ64];
+#endif
+
+/*
+ * Queue of tests for @TEST_QUEUE (see "Test queue" in pciebench.h)
+ */
+__export __emem __align(64) struct test_queue_entry
+    test_queue[PCIEBENCH_QUEUE_SZ];
+
+/*
+ * Specification and results of @TEST_SWEEP (see "Parameter sweeps" in
+ * pciebench.h)
+ */
+__export __emem __align(64) struct sweep_spec sweep_spec;
+__export __emem __align(64) struct sweep_point
+    sweep_points[PCIEBENCH_SWEEP_POINTS];
+
+/*
+ * Rate of rate controlled bandwidth tests (see "Rate controlled
+ * bandwidth tests" in pciebench.h)
+ */
+__export __cls volatile struct rate_spec rate_spec[PCIEBENCH_SLOTS];
+
+/*
+ * Read and write pools of duplex bandwidth tests (see "Duplex
+ * bandwidth tests" in pciebench.h)
+ */
+__export __cls volatile struct duplex_spec duplex_spec[PCIEBENCH_SLOTS];
+
+/*
+ * Doorbells and descriptor/completion batches of @RING_DESC (see "Host
+ * descriptor ring" in pciebench.h)
+ */
+__export __cls volatile uint32_t ring_doorbell[PCIEBENCH_SLOTS];
+__export __emem __align(64) struct ring_desc
+    ring_descs[PCIEBENCH_SLOTS * PCIEBENCH_RING_BATCH];
+__export __emem __align(64) struct ring_cmpl
+    ring_cmpls[PCIEBENCH_SLOTS * PCIEBENCH_RING_BATCH];
+
+/*
+ * Clock synchronisation requests from the host and the timestamps
+ * DMAed to the host (see "Clock synchronisation" in pciebench.h)
+ */
+__export __cls volatile uint32_t clock_sync_req[PCIEBENCH_SLOTS];
+__export __emem __align(64) struct clock_stamp
+    clock_stamps[PCIEBENCH_SLOTS];
+
+/* Destination of the DMA reads polling the host for @H2D_FRESH */
+__export __emem __align(64) struct clock_stamp
+    fresh_lines[PCIEBENCH_SLOTS];
+
+/*
+ * Transaction size distributions of bandwidth tests (see "Transaction
+ * size distributions" in pciebench.h)
+ */
+__export __cls volatile uint32_t size_dist[PCIEBENCH_SLOTS *
+                                           PCIEBENCH_SIZE_DIST_SZ];
+
+/*
+ * Per context statistics of bandwidth tests (see "Worker statistics"
+ * in pciebench.h)
+ */
+__export __emem __align(64) struct worker_stats
+    worker_stats[PCIEBENCH_WORKER_STATS];
+
+#if PCIEBENCH_ISLANDS > 1
+/*
+ * Bandwidth test shared with the worker islands (see "Worker islands"
+ * in pciebench.h)
+ */
+__export __emem __align(64) volatile struct island_job island_job;
+#endif
+
+/*
+ * Number of test journal entries written since the firmware was loaded
+ */
+__export __cls volatile uint32_t journal_pos = 0;
+
+/*
+ * Number of debug journal entries written since the firmware was loaded
+ */
+__export __cls volatile uint32_t dbg_journal_pos = 0;
 
 /*
  * Journal declaration for latency tests
@@ -0,0 +1,305 @@
+/*
+ * Copyright (C) 2015-2018 Rolf Neugebauer. All rights reserved.
+ * Copyright (C) 2015 Netronome Systems, Inc.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Execution of a test in a test slot.  This code runs on context 0
+ * of the master ME of a slot, which may be the main ME or any of the
+ * worker MEs.
+ */
+#include <stdint.h>
+
+#include "compat.h"
+#include "libnfp.h"
+#include "pciebench.h"
+
+/* Location where host writes test parameters and reads results */
+__import __cls volatile int32_t test_ctrl[PCIEBENCH_SLOTS];
+__import __cls volatile struct test_params test_params[PCIEBENCH_SLOTS];
+__import __cls volatile struct test_result test_result[PCIEBENCH_SLOTS];
+__import __cls volatile struct test_slot test_slots[PCIEBENCH_SLOTS];
+__import __cls volatile uint64_t host_dma_addrs[PCIEBENCH_CHUNKS];
+__import __cls volatile uint32_t slot_busy[PCIEBENCH_SLOTS];
+__import __emem struct test_queue_entry test_queue[PCIEBENCH_QUEUE_SZ];
+__import __emem struct sweep_spec sweep_spec;
+__import __emem struct sweep_point sweep_points[PCIEBENCH_SWEEP_POINTS];
+
+/*
+ * Zero all results, for tests which fail before setting them
+ */
+__intrinsic static void
+result_zero(__gpr struct test_result *result)
+{
+    result->start_hi = 0;
+    result->start_lo = 0;
+    result->end_hi = 0;
+    result->end_lo = 0;
+    result->r0 = 0;
+    result->r1 = 0;
+    result->r2 = 0;
+    result->r3 = 0;
+    result->r4 = 0;
+    result->r5 = 0;
+    result->r6 = 0;
+    result->r7 = 0;
+}
+
+/*
+ * Run a single test in @slot
+ */
+static int
+slot_test(uint32_t slot, int32_t test, __gpr struct test_params *params,
+          __gpr struct test_result *result)
+{
+    __gpr uint32_t tmp;
+    __gpr int res;
+
+    local_csr_write(local_csr_mailbox0, params->p0);
+    local_csr_write(local_csr_mailbox1, params->p1);
+    local_csr_write(local_csr_mailbox2, params->p2);
+    local_csr_write(local_csr_mailbox3, params->p3);
+
+    /* The window must fit into the host buffer after the slot offset */
+    if (params->p2 + test_slots[slot].host_off > PCIEBENCH_MAX_MEM)
+        return -1;
+
+    if (params->p0 & ~LAT_FLAGS_ALL)
+        return -1;
+
+    switch (test) {
+    case LAT_CMD_RD:
+        res = cmd_lat(slot, params, result, LAT_CMD_RD);
+        break;
+
+    case LAT_CMD_WRRD:
+        res = cmd_lat(slot, params, result, LAT_CMD_WRRD);
+        break;
+
+    case LAT_DMA_RD:
+        res = dma_lat(slot, params, result, LAT_DMA_RD);
+        break;
+
+    case LAT_DMA_WRRD:
+        res = dma_lat(slot, params, result, LAT_DMA_WRRD);
+        break;
+
+    case BW_DMA_RD:
+    case BW_DMA_WR:
+    case BW_DMA_RW:
+        res = dma_bw(slot, params, result, test);
+        break;
+
+    case RING_DESC:
+        res = ring_desc(slot, params, result);
+        break;
+
+    case D2H_VIS:
+        res = d2h_vis(slot, params, result);
+        break;
+
+    case H2D_FRESH:
+        res = h2d_fresh(slot, params, result);
+        break;
+
+    case CLOCK_SYNC:
+        res = clock_sync(slot, params, result);
+        break;
+
+    case WR_COALESCE:
+        res = wr_coalesce(slot, params, result);
+        break;
+
+    case READ_ORDER:
+        res = read_order(slot, params, result);
+        break;
+
+    default:
+        res = -1;
+        break;
+    }
+
+    /* Copy the journal and the results to the host transfer area.
+     * Streaming tests already copied their journal. */
+    if (res == 0 && (params->p0 & LAT_FLAGS_XFER)) {
+        if (test <= LAT_DMA_WRRD && !(params->p0 & LAT_FLAGS_STREAM))
+            tmp = result->r0;
+        else if ((params->p0 & LAT_FLAGS_RATE) || test == WR_COALESCE ||
+                 test == READ_ORDER)
+            tmp = result->r3;
+        else
+            tmp = 0;
+        if (tmp > PCIEBENCH_JOURNAL_SZ)
+            tmp = PCIEBENCH_JOURNAL_SZ;
+        xfer_results(slot, result, result->r1, tmp);
+    }
+
+    return res;
+}
+
+/*
+ * Run the entries @p0 to @p0 + @p1 - 1 of the test queue back to back
+ */
+static int
+slot_queue(uint32_t slot, __gpr struct test_params *qparams,
+           __gpr struct test_result *result)
+{
+    __gpr struct test_params params;
+    __gpr uint32_t i, end;
+    __gpr int32_t test;
+    __gpr int res;
+
+    end = qparams->p0 + qparams->p1;
+    if (end > PCIEBENCH_QUEUE_SZ || end < qparams->p0)
+        return -1;
+
+    for (i = qparams->p0; i < end; i++) {
+        test = test_queue[i].test;
+        params = test_queue[i].params;
+        result_zero(result);
+
+        /* Queues don't nest */
+        if (test == TEST_QUEUE || test == TEST_SWEEP)
+            res = -1;
+        else
+            res = slot_test(slot, test, &params, result);
+
+        test_queue[i].result = *result;
+        test_queue[i].test = res;
+    }
+
+    return 0;
+}
+
+/*
+ * Number of values from @first to @last in steps of @step, 0 if invalid
+ */
+__intrinsic static uint32_t
+sweep_range(uint32_t first, uint32_t last, uint32_t step)
+{
+    if (!step || last < first)
+        return 0;
+    return (last - first) / step + 1;
+}
+
+/*
+ * Run the test described in @sweep_spec over the whole grid
+ */
+static int
+slot_sweep(uint32_t slot, __gpr struct test_result *result)
+{
+    __gpr struct test_params params;
+    __gpr uint32_t s, h, d, num_sizes, h_num, h_step, d_num, d_step;
+    __gpr uint32_t n = 0;
+    __gpr int32_t test;
+
+    test = sweep_spec.test;
+    num_sizes = sweep_spec.num_sizes;
+    h_step = sweep_spec.h_off_step;
+    d_step = sweep_spec.d_off_step;
+    h_num = sweep_range(sweep_spec.h_off_first, sweep_spec.h_off_last,
+                        h_step);
+    d_num = sweep_range(sweep_spec.d_off_first, sweep_spec.d_off_last,
+                        d_step);
+
+    /* Sweeps don't nest */
+    if (test == TEST_QUEUE || test == TEST_SWEEP)
+        return -1;
+
+    /* Check each range on its own first, so the product can't overflow */
+    if (num_sizes == 0 || num_sizes > PCIEBENCH_SWEEP_SIZES ||
+        h_num == 0 || h_num > PCIEBENCH_SWEEP_POINTS ||
+        d_num == 0 || d_num > PCIEBENCH_SWEEP_POINTS ||
+        num_sizes * h_num * d_num > PCIEBENCH_SWEEP_POINTS)
+        return -1;
+
+    params.p0 = sweep_spec.flags & ~(LAT_FLAGS_STREAM | LAT_FLAGS_XFER);
+    params.p2 = sweep_spec.win_sz;
+    params.p5 = sweep_spec.samples;
+    params.p6 = 0;
+    params.p7 = sweep_spec.mem;
+
+    for (s = 0; s < num_sizes; s++) {
+        params.p1 = sweep_spec.sizes[s];
+        /* Iterate by count, stepping past the last offset could wrap */
+        for (h = 0; h < h_num; h++) {
+            params.p3 = sweep_spec.h_off_first + h * h_step;
+            for (d = 0; d < d_num; d++) {
+                params.p4 = sweep_spec.d_off_first + d * d_step;
+
+                result_zero(result);
+                sweep_points[n].status =
+                    slot_test(slot, test, &params, result);
+                sweep_points[n].trans_sz = params.p1;
+                sweep_points[n].h_off = params.p3;
+                sweep_points[n].d_off = params.p4;
+                sweep_points[n].ticks = result->end_lo - result->start_lo;
+                sweep_points[n].count = result->r0;
+                if (test <= LAT_DMA_WRRD) {
+                    sweep_points[n].lat_min = result->r3;
+                    sweep_points[n].lat_max = result->r4;
+                    sweep_points[n].lat_sum_hi = result->r5;
+                    sweep_points[n].lat_sum_lo = result->r6;
+                }
+                n++;
+            }
+        }
+    }
+
+    return 0;
+}
+
+void
+slot_run(uint32_t slot)
+{
+    __gpr struct test_params params;
+    __gpr struct test_result result;
+
+    __gpr uint32_t tmp;
+    __lmem uint32_t *lm_tmp;
+    __cls uint32_t *mem_tmp;
+
+    __gpr int32_t test;
+    __gpr int res;
+    __gpr int i;
+
+    test = test_ctrl[slot];
+
+    /* Copy test configuration to local memory/registers */
+    params = test_params[slot];
+
+    /* Copy the DMA addresses for each chunk to local memory */
+    lm_tmp = (__lmem uint32_t *)chunk_dma_addrs;
+    mem_tmp = (__cls uint32_t *)host_dma_addrs;
+    for (i = 0; i < sizeof(chunk_dma_addrs); i += 4) {
+        tmp = *mem_tmp++;
+        *lm_tmp++ = tmp;
+    }
+
+    result_zero(&result);
+
+    if (test == TEST_QUEUE)
+        res = slot_queue(slot, &params, &result);
+    else if (test == TEST_SWEEP)
+        res = slot_sweep(slot, &result);
+    else
+        res = slot_test(slot, test, &params, &result);
+
+    test_result[slot] = result;
+    slot_busy[slot] = 0;
+    test_ctrl[slot] = res;
+}
+
+/* -*-  Mode:C; c-basic-offset:4; tab-width:4 -*- */
@@ -21,15 +21,20 @@
 #include "libnfp.h"
 #include "pciebench.h"
 
+__import __cls volatile struct test_slot test_slots[PCIEBENCH_SLOTS];
+__import __cls volatile struct stream_state stream_state;
+
 /*
  * Utility functions
+ *
+ * There is one array of DMA addresses per test slot.
  */
 __export __emem __align(64) volatile uint64_t \
-    dma_addrs[PCIEBENCH_ADDR_ARRAY_SZ];
+    dma_addrs[PCIEBENCH_SLOTS * PCIEBENCH_ADDR_ARRAY_SZ];
 
 
 __intrinsic void
-dma_addr_init(uint32_t win_sz, uint32_t trans_sz,
+dma_addr_init(uint32_t slot, uint32_t win_sz, uint32_t trans_sz,
               uint32_t h_off, uint32_t flags)
 {
     __gpr uint32_t addr_hi, addr_lo, chunk_off;
@@ -41,8 +46,10 @@ dma_addr_init(uint32_t win_sz, uint32_t trans_sz,
     __gpr uint32_t trans;
     __gpr uint32_t avail;
     __gpr uint32_t add;
+    __gpr uint32_t base;
     __gpr int idx;
 
+    base = slot * PCIEBENCH_ADDR_ARRAY_SZ;
     unit_sz = roundup64(trans_sz + h_off);
     units_in_win = win_sz / unit_sz;
 
@@ -59,9 +66,15 @@ dma_addr_init(uint32_t win_sz, uint32_t trans_sz,
             lin_addr = trans % units_in_win;
             lin_addr *= unit_sz;
             lin_addr += h_off;
+            lin_addr += test_slots[slot].host_off;
 
-            /* Check that the transaction would not cross a 4k boundary */
-            avail = 0x1000 - (lin_addr & 0xfff);
+            /* Check that the transaction would not cross a 4k boundary
+             * or, for chained DMAs, a chunk boundary */
+            if (trans_sz > 0x1000)
+                avail = PCIEBENCH_CHUNK_SZ -
+                    (lin_addr & PCIEBENCH_CHUNK_SZ_mask);
+            else
+                avail = 0x1000 - (lin_addr & 0xfff);
             if (avail >= trans_sz)
                 break;
             else
@@ -77,18 +90,19 @@ dma_addr_init(uint32_t win_sz, uint32_t trans_sz,
 
         /* Splice in the chunk index and write to array */
         dma_addr |= (uint64_t)chunk_idx << 56;
-        dma_addrs[idx] = dma_addr;
+        dma_addrs[base + idx] = dma_addr;
     }
 }
 
 __intrinsic void
-dma_addr_from_idx(uint32_t idx,
+dma_addr_from_idx(uint32_t slot, uint32_t idx,
                   __gpr uint32_t *addr_hi, __gpr uint32_t *addr_lo,
                   __gpr uint32_t *chunk_idx)
 {
     __gpr uint64_t dma_addr;
 
-    dma_addr = dma_addrs[idx & PCIEBENCH_ADDR_ARRAY_SZ_mask];
+    dma_addr = dma_addrs[(slot << __log2(PCIEBENCH_ADDR_ARRAY_SZ)) |
+                         (idx & PCIEBENCH_ADDR_ARRAY_SZ_mask)];
 
     *addr_lo = dma_addr & 0xffffffff;
     *addr_hi = dma_addr >> 32;
@@ -97,77 +111,24 @@ dma_addr_from_idx(uint32_t idx,
     *addr_hi = *addr_hi & 0xffffff;
 }
 
-/*
- * Write a pattern to a region of @sz size in host memory. Allow
- * random and sequential patterns.
- *
- * Note there is no need to check the return value of
- * @dma_addr_from_idx() because we only use aligned 64B transactions.
- */
-__intrinsic static void
-write_region(__gpr uint32_t win_sz, const uint32_t pattern, const int rand)
-{
-    __xwrite uint32_t w_data[16];
-    __gpr uint32_t idx, trans, num_trans;
-    __gpr uint32_t lin_addr;
-    __gpr uint32_t addr_hi, addr_lo, chunk_off;
-    __gpr uint32_t chunk_idx, old_chunk_idx;
-    __gpr uint32_t i;
-    __gpr int ret;
-    SIGNAL w_sig;
-
-    old_chunk_idx = 0;
-    addr_hi = chunk_dma_addrs[0] >> 32;
-    addr_lo = chunk_dma_addrs[0] & 0xffffffff;
-
-    pcie_c2p_barcfg(PCIEBENCH_PCIE_ISL, PCIEBENCH_C2P_IDX, addr_hi, addr_lo, 0);
-
-    num_trans = 2 * (win_sz / sizeof(w_data));
-    for (trans = 0; trans < num_trans; trans++) {
-
-        /* Different content per cache line */
-        for (i = 0; i < ARRAY_SIZE(w_data); i++)
-            w_data[i] = (pattern & 0xffff0000) | (trans & 0xffff);
-
-        __pcie_write(w_data, PCIEBENCH_PCIE_ISL, PCIEBENCH_C2P_IDX,
-                     addr_hi, addr_lo, sizeof(w_data), 64, sig_done, &w_sig);
-        wait_for_all(&w_sig);
-        __implicit_read(w_data);
-
-
-        if (rand)
-            idx = local_csr_read(local_csr_pseudo_random_number);
-        else
-            idx = trans + 1;
-
-        lin_addr = idx << 6;
-        lin_addr = lin_addr % win_sz;
-
-        /* Convert Linear DMA address into host size chunk address/offset */
-        chunk_idx = lin_addr >> __log2(PCIEBENCH_CHUNK_SZ);
-        chunk_off = lin_addr & PCIEBENCH_CHUNK_SZ_mask;
-
-        addr_hi = chunk_dma_addrs[chunk_idx] >> 32;
-        addr_lo = chunk_dma_addrs[chunk_idx] & 0xffffffff;
-        addr_lo += chunk_off;
-
-        /* Reprogram BAR if necessary */
-        if (chunk_idx != old_chunk_idx) {
-            pcie_c2p_barcfg(PCIEBENCH_PCIE_ISL, PCIEBENCH_C2P_IDX,
-                            addr_hi, addr_lo, 0);
-            old_chunk_idx = chunk_idx;
-        }
-    }
-}
-
-__intrinsic void
-host_trash_cache(void)
+__intrinsic int
+stream_start(void)
 {
-    write_region(PCIEBENCH_MAX_MEM, 0xdead0000, 1);
+    if (stream_state.ctrl != STREAM_IDLE)
+        return -1;
+
+    stream_state.base = 0;
+    stream_state.prod = 0;
+    stream_state.drained = 0;
+    stream_state.cons = 0;
+    stream_state.lost = 0;
+    stream_state.ctrl = STREAM_RUN;
+    return 0;
 }
 
 __intrinsic void
-host_warm_cache(int win_sz)
+stream_stop(uint32_t entries)
 {
-    write_region(win_sz, 0xcafe0000, 0);
+    stream_state.prod = entries;
+    stream_state.ctrl = STREAM_STOP;
 }
@@ -18,11 +18,12 @@
 """Run a set of PCIe micro-benchmarks on a NFP"""
 
 import sys
+import time
 from optparse import OptionParser
 
-from pciebench.nfpbench import NFPBench
+from pciebench.nfpbench import NFPBench, HOST_PAGE_SZ
 from pciebench.tablewriter import TableWriter
-from pciebench.stats import histo2cdf
+from pciebench.stats import histo2cdf, spike_clusters, periodicity
 import pciebench.debug
 import pciebench.sysinfo
 
@@ -175,6 +176,330 @@ def run_lat_dma_sweep(nfp, outdir):
         twr.close(TableWriter.ALL)
 
 
+def run_lat_chase(nfp, outdir):
+    """Run DMA read latency tests chasing pointers through a random
+    cycle in the window, next to random reads with precomputed
+    addresses, for increasing window sizes"""
+    twr = TableWriter(nfp.lat_fmt)
+    twr.open(outdir + "lat_dma_chase", TableWriter.ALL)
+
+    trans_szs = [8, 64]
+    win_szs = [8192, 64 * 1024, 1024 * 1024, 16 * 1024 * 1024,
+               64 * 1024 * 1024]
+
+    for trans_sz in trans_szs:
+        twr.sec()
+        for win_sz in win_szs:
+            for flags in [nfp.FLAGS_RANDOM, nfp.FLAGS_CHASE]:
+                _ = nfp.lat_test(twr, nfp.LAT_DMA_RD, flags, win_sz,
+                                 trans_sz, 0, 0)
+
+    twr.close(TableWriter.ALL)
+
+
+def run_chained(nfp, outdir):
+    """Run DMA latency and bandwidth tests with transactions larger
+    than a single DMA descriptor (chained DMAs)"""
+    twr = TableWriter(nfp.lat_fmt)
+    twr.open(outdir + "lat_dma_chained", TableWriter.ALL)
+    bwwr = TableWriter(nfp.bw_fmt)
+    bwwr.open(outdir + "bw_dma_chained", TableWriter.ALL)
+
+    twr.msg("\nPCIe DMA latency of chained DMAs")
+    bwwr.msg("\nPCIe DMA bandwidth of chained DMAs")
+
+    trans_szs = [2048, 4096, 8192, 9000, 9216, 16384, 32768, 65536]
+    win_sz = 8 * 1024 * 1024
+    flags = nfp.FLAGS_RANDOM | nfp.FLAGS_HOSTWARM
+
+    for test_no in [nfp.LAT_DMA_RD, nfp.LAT_DMA_WRRD]:
+        twr.sec()
+        for trans_sz in trans_szs:
+            _ = nfp.lat_test(twr, test_no, flags, win_sz, trans_sz, 0, 0)
+
+    for test_no in [nfp.BW_DMA_RD, nfp.BW_DMA_WR, nfp.BW_DMA_RW]:
+        bwwr.sec()
+        nfp.bw_tests(bwwr, [(test_no, flags, win_sz, trans_sz, 0, 0)
+                            for trans_sz in trans_szs])
+
+    bwwr.close(TableWriter.ALL)
+    twr.close(TableWriter.ALL)
+
+
+def run_sg(nfp, outdir):
+    """Run gather/scatter DMA latency tests with K segments of
+    different sizes and compare them to a single linear DMA of the
+    same total size"""
+    twr = TableWriter(nfp.lat_fmt)
+    twr.open(outdir + "lat_dma_sg", TableWriter.ALL)
+
+    twr.msg("\nPCIe DMA latency of gather/scatter transactions")
+
+    seg_szs = [64, 256, 1024, 2048]
+    segs = [1, 2, 4, 8, 16, 32]
+    win_sz = 8 * 1024 * 1024
+    flags = nfp.FLAGS_RANDOM | nfp.FLAGS_HOSTWARM
+
+    for test_no in [nfp.LAT_DMA_RD, nfp.LAT_DMA_WRRD]:
+        for seg_sz in seg_szs:
+            twr.sec("%s seg_sz=%d: K segments" %
+                    (nfp.TEST_NAMES[test_no], seg_sz))
+            for k in segs:
+                _ = nfp.sg_lat_test(twr, test_no, flags, win_sz,
+                                    seg_sz, k, 0, 0)
+            twr.sec("%s seg_sz=%d: Linear DMA of K * seg_sz" %
+                    (nfp.TEST_NAMES[test_no], seg_sz))
+            for k in segs:
+                _ = nfp.lat_test(twr, test_no, flags, win_sz,
+                                 seg_sz * k, 0, 0)
+
+    twr.close(TableWriter.ALL)
+
+
+def run_nfp_mem(nfp, outdir):
+    """Run DMA latency and bandwidth tests to/from the NFP buffers in
+    the different NFP memories and at different device offsets"""
+    twr = TableWriter(nfp.lat_fmt)
+    twr.open(outdir + "lat_dma_nfp_mem", TableWriter.ALL)
+    bwwr = TableWriter(nfp.bw_fmt)
+    bwwr.open(outdir + "bw_dma_nfp_mem", TableWriter.ALL)
+
+    if nfp.nfp6000:
+        mems = [nfp.MEM_CTM, nfp.MEM_IMEM, nfp.MEM_EMEM]
+    else:
+        mems = [nfp.MEM_EMEM]
+    trans_szs = [64, 256, 512, 1024, 2048]
+    d_offs = [0, 4096, 8192, 32768, 65536]
+    win_sz = 8192
+    flags = nfp.FLAGS_RANDOM | nfp.FLAGS_HOSTWARM
+
+    for mem in mems:
+        for test_no in [nfp.LAT_DMA_RD, nfp.LAT_DMA_WRRD]:
+            twr.sec("%s mem=%s" % (nfp.TEST_NAMES[test_no],
+                                   nfp.MEM_NAMES[mem]))
+            for trans_sz in trans_szs:
+                _ = nfp.lat_test(twr, test_no, flags, win_sz, trans_sz,
+                                 0, 0, mem)
+            for d_off in d_offs[1:]:
+                _ = nfp.lat_test(twr, test_no, flags, win_sz, 64,
+                                 0, d_off, mem)
+
+        for test_no in [nfp.BW_DMA_RD, nfp.BW_DMA_WR, nfp.BW_DMA_RW]:
+            bwwr.sec("%s mem=%s" % (nfp.TEST_NAMES[test_no],
+                                    nfp.MEM_NAMES[mem]))
+            for trans_sz in trans_szs:
+                nfp.bw_test(bwwr, test_no, flags, win_sz, trans_sz,
+                            0, 0, mem=mem)
+
+    bwwr.close(TableWriter.ALL)
+    twr.close(TableWriter.ALL)
+
+
+def run_duplex(nfp, outdir):
+    """Run duplex bandwidth tests with different splits of the worker
+    MEs into read and write pools"""
+    twr = TableWriter(nfp.duplex_fmt)
+    twr.open(outdir + "bw_dma_duplex", TableWriter.ALL)
+
+    trans_szs = [64, 256, 512, 1024, 2048]
+    win_sz = 8192
+    trans = 2 * 1000 * 1000
+    flags = nfp.FLAGS_HOSTWARM
+
+    for rd_mes in range(1, nfp.last_me + 1):
+        twr.sec()
+        for trans_sz in trans_szs:
+            nfp.duplex_test(twr, flags, win_sz, trans_sz, 0, 0,
+                            rd_mes, trans, trans)
+
+    twr.close(TableWriter.ALL)
+
+
+def run_ring(nfp, outdir):
+    """Run host descriptor ring tests, polling and with doorbells, for
+    different batch sizes"""
+    twr = TableWriter(nfp.ring_fmt)
+    twr.open(outdir + "ring_desc", TableWriter.ALL)
+
+    entries = 1024
+    count = 200 * 1000
+    batches = [1, 2, 4, 8, 16, 32, 64]
+    lengths = [0, 256]
+
+    for mode in [nfp.RING_POLL, nfp.RING_DOORBELL]:
+        for length in lengths:
+            twr.sec("%s len=%d" % (nfp.RING_NAMES[mode], length))
+            for batch in batches:
+                fname = outdir + "ring_%s_%d_%d.rtt" % \
+                        (nfp.RING_NAMES[mode].lower(), length, batch)
+                _ = nfp.ring_test(twr, mode, entries, batch, count, length,
+                                  fname)
+
+    twr.close(TableWriter.ALL)
+
+
+def run_d2h_vis(nfp, outdir):
+    """Run one-way device to host write visibility tests for different
+    window sizes and gaps between samples.  Small windows stay in the
+    host cache while large windows are cold.  For a remote NUMA node,
+    load the kernel module with the 'node' parameter set accordingly"""
+    twr = TableWriter(nfp.vis_fmt)
+    twr.open(outdir + "d2h_vis", TableWriter.ALL)
+
+    samples = 100 * 1000
+    rounds = 100
+    win_szs = [64, 4096, 1024 * 1024]
+    intervals = [1000, 10000, 100000]
+
+    for attr in [0, nfp.FLAGS_RO]:
+        for win_sz in win_szs:
+            twr.sec()
+            for interval in intervals:
+                fname = outdir + "d2h_vis_%s_%d_%d.ts" % \
+                        ("ro" if attr else "def", win_sz, interval)
+                _ = nfp.d2h_test(twr, win_sz, samples, interval, rounds,
+                                 fname, flags=attr)
+
+    twr.close(TableWriter.ALL)
+
+
+def run_h2d_fresh(nfp, outdir):
+    """Run one-way host to device freshness tests, polling with DMA
+    reads and PCIe reads, for different window sizes and gaps between
+    samples"""
+    twr = TableWriter(nfp.vis_fmt)
+    twr.open(outdir + "h2d_fresh", TableWriter.ALL)
+
+    samples = 100 * 1000
+    rounds = 100
+    win_szs = [64, 4096, 1024 * 1024]
+    intervals = [0, 1000, 10000]
+
+    for method in [nfp.FRESH_DMA, nfp.FRESH_CMD]:
+        for win_sz in win_szs:
+            twr.sec()
+            for interval in intervals:
+                fname = outdir + "h2d_fresh_%s_%d_%d.ts" % \
+                        (nfp.FRESH_NAMES[method].lower(), win_sz, interval)
+                _ = nfp.h2d_test(twr, win_sz, samples, interval, rounds,
+                                 fname, method=method)
+
+    twr.close(TableWriter.ALL)
+
+
+def run_clock_sync(nfp, outdir):
+    """Synchronise the NFP and host clocks repeatedly to measure the
+    offset error and the drift of the NFP clock over time"""
+    twr = TableWriter(nfp.sync_fmt)
+    twr.open(outdir + "clock_sync", TableWriter.ALL)
+
+    rounds = 1000
+    points = 11
+    interval = 10
+
+    for point in range(points):
+        if point:
+            time.sleep(interval)
+        _ = nfp.clock_sync(twr, rounds, outdir + "clock_sync_%d.ts" % point)
+
+    twr.close(TableWriter.ALL)
+
+
+def run_coalesce(nfp, outdir):
+    """Run write coalescing tests for small logical writes at different
+    rates, maximum DMA sizes and flush timeouts.  A maximum DMA size
+    equal to the write size is the baseline without coalescing"""
+    twr = TableWriter(nfp.coalesce_fmt)
+    twr.open(outdir + "wr_coalesce", TableWriter.ALL)
+
+    count = 200 * 1000
+    wr_szs = [8, 64]
+    intervals = [0, 160, 800, 4000]
+    max_szs = [64, 256, 1024]
+    timeouts = [0, 800, 8000]
+
+    for wr_sz in wr_szs:
+        for interval in intervals:
+            twr.sec("wr_sz=%d interval=%d" % (wr_sz, interval))
+            _ = nfp.coalesce_test(twr, wr_sz, wr_sz, interval, 0, count)
+            for max_sz in max_szs:
+                if max_sz <= wr_sz:
+                    continue
+                for timeout in timeouts:
+                    _ = nfp.coalesce_test(twr, wr_sz, max_sz, interval,
+                                          timeout, count)
+
+    twr.close(TableWriter.ALL)
+
+DEPTH_FMT = [("Poll", 4, "%s"), ("SZ", 4, "%d"), ("N", 2, "%d"),
+             ("Depth", 5, "%d"),
+             ("Reads", 9, "%d"), ("Share", 7, "%.3f")]
+def run_read_order(nfp, outdir):
+    """Run read completion ordering tests with different numbers of
+    outstanding reads and read sizes, and write the distribution of
+    the reorder depths"""
+    twr = TableWriter(nfp.order_fmt)
+    twr.open(outdir + "read_order", TableWriter.ALL)
+    dwr = TableWriter(DEPTH_FMT)
+    dwr.open(outdir + "read_order_depth", TableWriter.ALL)
+
+    batches = 100 * 1000
+    ns = [1, 2, 4, nfp.ORDER_MAX]
+    dma_szs = [64, 512, 2048]
+
+    tests = [(nfp.ORDER_CMD, 4)]
+    tests += [(nfp.ORDER_DMA, sz) for sz in dma_szs]
+
+    for attr in [0, nfp.FLAGS_RO]:
+        for method, sz in tests:
+            twr.sec()
+            for n in ns:
+                _, _, depths = nfp.read_order_test(twr, method, n, sz,
+                                                   batches, flags=attr)
+                if attr:
+                    continue
+                total = sum(depths.values())
+                for depth in sorted(depths):
+                    dwr.out((nfp.ORDER_NAMES[method], sz, n, depth,
+                             depths[depth], 1.0 * depths[depth] / total))
+
+    dwr.close(TableWriter.ALL)
+    twr.close(TableWriter.ALL)
+
+
+def run_tlp_attrs(nfp, outdir):
+    """Run DMA latency and bandwidth tests with the different
+    combinations of relaxed ordering and no snoop TLP attributes"""
+    twr = TableWriter(nfp.lat_fmt)
+    twr.open(outdir + "lat_dma_tlp_attrs", TableWriter.ALL)
+    bwwr = TableWriter(nfp.bw_fmt)
+    bwwr.open(outdir + "bw_dma_tlp_attrs", TableWriter.ALL)
+
+    attrs = [0, nfp.FLAGS_RO, nfp.FLAGS_NS, nfp.FLAGS_RO | nfp.FLAGS_NS]
+    trans_szs = [64, 256, 512, 1024, 2048]
+    win_szs = [8192, 64 * 1024 * 1024]
+
+    for win_sz in win_szs:
+        for cache in [nfp.FLAGS_HOSTWARM, nfp.FLAGS_THRASH]:
+            flags = nfp.FLAGS_RANDOM | cache
+            for test_no in [nfp.LAT_DMA_RD, nfp.LAT_DMA_WRRD]:
+                twr.sec()
+                for attr in attrs:
+                    for trans_sz in trans_szs:
+                        _ = nfp.lat_test(twr, test_no, flags | attr,
+                                         win_sz, trans_sz, 0, 0)
+
+            for test_no in [nfp.BW_DMA_RD, nfp.BW_DMA_WR, nfp.BW_DMA_RW]:
+                bwwr.sec()
+                for attr in attrs:
+                    for trans_sz in trans_szs:
+                        nfp.bw_test(bwwr, test_no, flags | attr,
+                                    win_sz, trans_sz, 0, 0)
+
+    bwwr.close(TableWriter.ALL)
+    twr.close(TableWriter.ALL)
+
+
 def run_lat_dma_off(nfp, outdir):
     """Run Latency tests to with different host offset"""
     twr = TableWriter(nfp.lat_fmt)
@@ -204,6 +529,60 @@ def run_lat_dma_off(nfp, outdir):
 
         twr.close(TableWriter.ALL)
 
+OFF_MAP_FMT = [("Test", 12, "%s"), ("SZ", 4, "%d"),
+               ("HO", 3, "%d"), ("DO", 3, "%d"), ("#samples", 8, "%d"),
+               ("", 0, ""),
+               ("Min", 6, "%d"), ("Avg", 6, "%d"), ("Max", 6, "%d"),
+               ("", 0, ""),
+               ("Avg(ns)", 7, "%d"), ("BW (GB/s)", 9, "%.3f"),
+               ]
+def run_off_heatmap(nfp, outdir):
+    """Run DMA latency and bandwidth tests over all combinations of
+    host and device offsets within a cache line.  Each transaction
+    size is a single sweep on the device.  The results are written as
+    a table and as one matrix per transaction size (one row per host
+    offset), which can be plotted by gnuplot with 'matrix with image'"""
+
+    win_sz = 8192
+    trans_szs = [64, 128, 256, 512]
+    offs = (0, 63, 1)
+
+    twr = TableWriter(OFF_MAP_FMT)
+    twr.open(outdir + "off_heatmap", TableWriter.ALL)
+    twr.msg("\nPCIe DMA latency and bandwidth by host/device offset")
+
+    for test_no, samples in [(nfp.LAT_DMA_RD, 10000),
+                             (nfp.LAT_DMA_WRRD, 10000),
+                             (nfp.BW_DMA_RD, 100000),
+                             (nfp.BW_DMA_WR, 100000)]:
+        for trans_sz in trans_szs:
+            twr.sec("test=%s sz=%d" % (nfp.TEST_NAMES[test_no], trans_sz))
+            points = nfp.run_sweep(test_no, nfp.FLAGS_HOSTWARM, win_sz,
+                                   [trans_sz], offs, offs, samples, win_sz)
+
+            rows = {}
+            for _, h_off, d_off, cycles, count, lat in points:
+                if lat:
+                    lat_min, lat_avg, lat_max = lat
+                    val = nfp.cyc2ns(lat_avg)
+                    bw = 0.0
+                else:
+                    lat_min, lat_avg, lat_max = 0, 0, 0
+                    bw = 8.0 * trans_sz * count / nfp.cyc2ns(cycles)
+                    val = bw
+                twr.out((nfp.TEST_NAMES[test_no], trans_sz, h_off, d_off,
+                         count, lat_min, lat_avg, lat_max,
+                         nfp.cyc2ns(lat_avg), bw))
+                rows.setdefault(h_off, []).append("%.3f" % val)
+
+            outf = open(outdir + "off_heatmap_%s_%d.mat" %
+                        (nfp.TEST_NAMES[test_no].lower(), trans_sz), 'w')
+            for h_off in sorted(rows.keys()):
+                outf.write(" ".join(rows[h_off]) + "\n")
+            outf.close()
+
+    twr.close(TableWriter.ALL)
+
 LAT_TEST_CDF_FMT = [("cycles", 8, "%d"), ("ns", 8, "%.0f"),
                     ("cdf", 10, "%.8f")]
 def run_lat_details(nfp, outdir):
@@ -296,6 +675,303 @@ def run_lat_details(nfp, outdir):
     twr.close(TableWriter.ALL)
     raw.close()
 
+PAGE_MAP_FMT = [("Test", 12, "%s"), ("Idx", 6, "%d"), ("Chunk", 5, "%d"),
+                ("Offset", 8, "%x"), ("#samples", 8, "%d"),
+                ("", 0, ""),
+                ("Med", 5, "%d"), ("99%", 5, "%d"), ("Max", 5, "%d"),
+                ("", 0, ""),
+                ("Med(ns)", 7, "%d"), ("99%(ns)", 7, "%d"),
+                ("Max(ns)", 7, "%d"),
+                ]
+def _page_map_out(nfp, twr, test_no, idx, chunk, off, stats):
+    """Write a line of per page/chunk latency stats"""
+    med_cyc = stats.median()
+    per99_cyc = stats.percentile(99)
+    max_cyc = stats.max()
+    twr.out((nfp.TEST_NAMES[test_no], idx, chunk, off, len(stats.list),
+             med_cyc, per99_cyc, max_cyc,
+             nfp.cyc2ns(med_cyc), nfp.cyc2ns(per99_cyc), nfp.cyc2ns(max_cyc)))
+
+def _page_map_matrix(nfp, fname, pages, per_chunk, chunks, percentile):
+    """Write per page latencies as a matrix (one row per chunk) which
+    can be plotted by gnuplot with 'matrix with image'"""
+    outf = open(fname, 'w')
+    for chunk in range(chunks):
+        row = []
+        for page in range(chunk * per_chunk, (chunk + 1) * per_chunk):
+            if page in pages:
+                row.append("%.0f" % nfp.cyc2ns(
+                    pages[page].percentile(percentile)))
+            else:
+                row.append("NaN")
+        outf.write(" ".join(row) + "\n")
+    outf.close()
+
+def run_lat_page_map(nfp, outdir):
+    """Run long, random latency tests across the whole host buffer and
+    aggregate the latencies by host page and chunk.  Slow pages,
+    e.g. due to NUMA misplacement or IO-MMU mappings, stand out."""
+
+    win_sz = 64 * 1024 * 1024
+    trans_sz = 64
+    flags = nfp.FLAGS_LONG | nfp.FLAGS_RANDOM
+
+    twr = TableWriter(nfp.lat_fmt)
+    twr.open(outdir + "lat_page_map", TableWriter.ALL)
+    twr.msg("\nPCIe latencies per host page")
+
+    pgwr = TableWriter(PAGE_MAP_FMT, stdout=False)
+    pgwr.open(outdir + "lat_page_map_pages", TableWriter.ALL)
+    chwr = TableWriter(PAGE_MAP_FMT)
+    chwr.open(outdir + "lat_page_map_chunks", TableWriter.ALL)
+
+    for test_no in [nfp.LAT_DMA_RD, nfp.LAT_DMA_WRRD, nfp.LAT_CMD_RD]:
+        twr.sec()
+        lat_stats = nfp.lat_test(twr, test_no, flags, win_sz,
+                                 trans_sz if test_no != nfp.LAT_CMD_RD else 8,
+                                 0, 0)
+        pages, chunks = nfp.page_map(lat_stats.list)
+
+        per_chunk = int(nfp.chunk_sz / HOST_PAGE_SZ)
+        pgwr.sec("test=%s" % nfp.TEST_NAMES[test_no])
+        for page in sorted(pages.keys()):
+            _page_map_out(nfp, pgwr, test_no, page, page // per_chunk,
+                          page * HOST_PAGE_SZ, pages[page])
+
+        chwr.sec("test=%s" % nfp.TEST_NAMES[test_no])
+        for chunk in sorted(chunks.keys()):
+            _page_map_out(nfp, chwr, test_no, chunk, chunk,
+                          chunk * nfp.chunk_sz, chunks[chunk])
+
+        base = outdir + "lat_page_map_%s" % nfp.TEST_NAMES[test_no].lower()
+        num_chunks = int(win_sz / nfp.chunk_sz)
+        _page_map_matrix(nfp, base + "_med.mat", pages,
+                         per_chunk, num_chunks, 50)
+        _page_map_matrix(nfp, base + "_p99.mat", pages,
+                         per_chunk, num_chunks, 99)
+
+    chwr.close(TableWriter.ALL)
+    pgwr.close(TableWriter.ALL)
+    twr.close(TableWriter.ALL)
+
+TIMELINE_FMT = [("Test", 12, "%s"), ("Samples", 8, "%d"),
+                ("99.9%(ns)", 9, "%d"),
+                ("", 0, ""),
+                ("Spikes", 6, "%d"), ("Clusters", 8, "%d"),
+                ("Period(us)", 10, "%.1f"), ("Freq(Hz)", 9, "%.1f"),
+                ("Regular", 7, "%.2f"),
+                ]
+CLUSTER_FMT = [("Test", 12, "%s"), ("Start(ns)", 16, "%d"),
+               ("Dur(ns)", 9, "%d"), ("Spikes", 6, "%d"),
+               ("Max(ns)", 9, "%d"),
+               ]
+def run_lat_timeline(nfp, outdir):
+    """Run DMA latency tests with the start timestamp of each
+    transaction journalled and write (start time, latency) timelines.
+    Spikes above the 99.9th percentile are grouped into clusters which
+    are checked for periodicity, to match them with host events like
+    timer ticks or memory refresh.  With the C helper, the clocks are
+    synchronised so the start times are host CLOCK_MONOTONIC time."""
+    twr = TableWriter(nfp.lat_fmt)
+    twr.open(outdir + "lat_timeline", TableWriter.ALL)
+    tlwr = TableWriter(TIMELINE_FMT)
+    tlwr.open(outdir + "lat_timeline_spikes", TableWriter.ALL)
+    clwr = TableWriter(CLUSTER_FMT, stdout=False)
+    clwr.open(outdir + "lat_timeline_clusters", TableWriter.ALL)
+    if nfp.helper:
+        swr = TableWriter(nfp.sync_fmt)
+        swr.open(outdir + "lat_timeline_sync", TableWriter.ALL)
+
+    win_sz = 8192
+    trans_sz = 64
+    flags = nfp.FLAGS_RANDOM | nfp.FLAGS_TIMELINE
+    rounds = 1000
+    # Spikes closer than this belong to the same cluster
+    gap = 10 * 1000
+
+    tests = [nfp.LAT_DMA_RD, nfp.LAT_DMA_WRRD]
+    for test_no in tests:
+        twr.sec()
+        name = nfp.TEST_NAMES[test_no]
+        # Synchronise around each test to map its timestamps
+        if nfp.helper:
+            nfp.clock_points = []
+            _ = nfp.clock_sync(swr, rounds, outdir + "lat_timeline_sync.ts")
+        lat_stats = nfp.lat_test(twr, test_no, flags, win_sz, trans_sz,
+                                 0, 0)
+        if nfp.helper:
+            _ = nfp.clock_sync(swr, rounds, outdir + "lat_timeline_sync.ts")
+
+        timeline = nfp.timeline(lat_stats.list)
+        outf = open(outdir + "lat_timeline_%s.dat" % name.lower(), 'w')
+        for start, lat in timeline:
+            outf.write("%d %.1f\n" % (start, lat))
+        outf.close()
+
+        threshold = nfp.cyc2ns(lat_stats.percentile(99.9))
+        clusters = spike_clusters(timeline, threshold, gap)
+        period, regular = periodicity([c[0] for c in clusters])
+
+        clwr.sec("test=%s" % name)
+        for start, end, num, top in clusters:
+            clwr.out((name, start, end - start, num, top))
+
+        tlwr.out((name, len(timeline), threshold,
+                  sum(c[2] for c in clusters), len(clusters),
+                  period / 1000.0 if period else 0.0,
+                  1000.0 * 1000 * 1000 / period if period else 0.0,
+                  regular))
+
+    if nfp.helper:
+        swr.close(TableWriter.ALL)
+    clwr.close(TableWriter.ALL)
+    tlwr.close(TableWriter.ALL)
+    twr.close(TableWriter.ALL)
+
+STREAM_SPIKE_FMT = [("Test", 12, "%s"), ("Index", 12, "%d"),
+                    ("Lat", 8, "%d"), ("Lat(ns)", 9, "%d"),
+                    ]
+def run_lat_stream(nfp, outdir, trans):
+    """Run a long DMA latency test with the journal streamed to the host
+    and list the individual spikes, e.g. caused by SMIs or memory
+    scrubbing on the host."""
+    twr = TableWriter(nfp.lat_fmt)
+    twr.open(outdir + "lat_stream", TableWriter.ALL)
+    twr.msg("\nLong running PCIe DMA latency (%d transactions)" % trans)
+
+    spwr = TableWriter(STREAM_SPIKE_FMT)
+    spwr.open(outdir + "lat_stream_spikes", TableWriter.ALL)
+
+    win_sz = 8192
+    trans_sz = 64
+    flags = nfp.FLAGS_RANDOM
+
+    for test_no in [nfp.LAT_DMA_RD, nfp.LAT_DMA_WRRD]:
+        fname = outdir + "lat_stream_%s.raw" % \
+                nfp.TEST_NAMES[test_no].lower()
+        twr.sec()
+        stats = nfp.stream_lat_test(twr, test_no, flags, win_sz, trans_sz,
+                                    0, 0, trans, fname)
+
+        # Spikes are values ten times the median
+        limit = 10 * stats.median()
+        spwr.sec("test=%s limit=%d" % (nfp.TEST_NAMES[test_no], limit))
+        idx = 0
+        for vals in nfp.read_stream(fname):
+            for val in vals:
+                if val * 16 > limit:
+                    spwr.out((nfp.TEST_NAMES[test_no], idx, val * 16,
+                              nfp.cyc2ns(val * 16)))
+                idx += 1
+
+    spwr.close(TableWriter.ALL)
+    twr.close(TableWriter.ALL)
+
+def run_interference(nfp, outdir):
+    """Run DMA latency tests on ME0 while the other MEs generate
+    background DMA traffic of different sizes to a separate part of
+    the host buffer."""
+    twr = TableWriter(nfp.lat_fmt)
+    twr.open(outdir + "lat_interference", TableWriter.ALL)
+    bwwr = TableWriter(nfp.bw_fmt)
+    bwwr.open(outdir + "bw_interference", TableWriter.ALL)
+
+    twr.msg("\nPCIe DMA latency with concurrent DMA bandwidth tests")
+
+    lat_win = 8192
+    lat_sz = 64
+    bw_win = 8192
+    bw_szs = [64, 256, 512, 1024, 2048]
+
+    for lat_no in [nfp.LAT_DMA_RD, nfp.LAT_DMA_WRRD]:
+        for bw_no in [nfp.BW_DMA_RD, nfp.BW_DMA_WR]:
+            twr.sec("background=%s" % nfp.TEST_NAMES[bw_no])
+            bwwr.sec("latency=%s" % nfp.TEST_NAMES[lat_no])
+            # Baseline without background traffic
+            _ = nfp.lat_test(twr, lat_no, nfp.FLAGS_RANDOM,
+                             lat_win, lat_sz, 0, 0)
+            for bw_sz in bw_szs:
+                _ = nfp.interference_test(
+                    twr, bwwr,
+                    (lat_no, nfp.FLAGS_RANDOM, lat_win, lat_sz, 0, 0),
+                    (bw_no, nfp.FLAGS_RANDOM, bw_win, bw_sz, 0, 0))
+
+    bwwr.close(TableWriter.ALL)
+    twr.close(TableWriter.ALL)
+
+def run_load_curve(nfp, outdir):
+    """Run rate controlled DMA tests at increasing fractions of the
+    closed loop throughput to get latency vs offered load curves."""
+    twr = TableWriter(nfp.rate_fmt)
+    twr.open(outdir + "bw_load_curve", TableWriter.ALL)
+
+    twr.msg("\nPCIe DMA latency vs offered load")
+
+    win_sz = 8192
+    trans_szs = [64, 256, 1024]
+    loads = [0.1, 0.2, 0.3, 0.4, 0.5, 0.6, 0.7, 0.8, 0.9, 0.95, 1.0, 1.1]
+    flags = nfp.FLAGS_RANDOM | nfp.FLAGS_HOSTWARM
+    trans = 256 * 1024
+
+    for test_no in [nfp.BW_DMA_RD, nfp.BW_DMA_WR]:
+        for trans_sz in trans_szs:
+            # Closed loop throughput as the reference for the load
+            cycles, res = nfp.run_test(
+                test_no, [flags, trans_sz, win_sz, 0, 0], win_sz)
+            cyc_per_dma = float(cycles) / res[0]
+            for mode in [nfp.RATE_CONST, nfp.RATE_POISSON]:
+                twr.sec("%s sz=%d mode=%s closed loop=%.1f cycles/DMA" %
+                        (nfp.TEST_NAMES[test_no], trans_sz,
+                         nfp.RATE_NAMES[mode], cyc_per_dma))
+                for load in loads:
+                    interval = max(1, int(cyc_per_dma / load))
+                    # Long intervals need fewer DMAs to fit the schedule
+                    n = min(trans, nfp.rate_trans_max(interval, mode))
+                    _ = nfp.rate_test(twr, test_no, flags, win_sz, trans_sz,
+                                      0, 0, interval, mode, trans=n)
+
+    twr.close(TableWriter.ALL)
+
+
+# Simple IMIX (7:4:1 of 64B, 594B and 1518B frames)
+IMIX = [(64, 7), (594, 4), (1518, 1)]
+
+
+def read_size_dist(fname):
+    """Read a size distribution from @fname.  Each line has a size and
+    a weight (e.g. a packet count from a histogram of captured
+    traffic).  Empty lines and lines starting with '#' are ignored."""
+    dist = []
+    for line in open(fname):
+        line = line.split('#')[0].split()
+        if not line:
+            continue
+        dist.append((int(line[0]), float(line[1])))
+    return dist
+
+
+def run_bw_dma_size_dist(nfp, outdir, fname):
+    """Run Bandwidth tests with DMA lengths from a size distribution,
+    read from @fname or the simple IMIX if @fname is 'imix'"""
+    twr = TableWriter(nfp.dist_fmt)
+    twr.open(outdir + "bw_dma_size_dist", TableWriter.ALL)
+
+    if fname == 'imix':
+        dist = IMIX
+    else:
+        dist = read_size_dist(fname)
+    name = fname.split('/')[-1]
+
+    flags = nfp.FLAGS_RANDOM | nfp.FLAGS_HOSTWARM
+    for win_sz in [8192, 64 * 1024, 1024 * 1024]:
+        twr.sec("win_sz=%d" % win_sz)
+        for test_no in [nfp.BW_DMA_RD, nfp.BW_DMA_WR, nfp.BW_DMA_RW]:
+            _ = nfp.size_dist_test(twr, test_no, flags, win_sz, dist,
+                                   0, 0, name)
+
+    twr.close(TableWriter.ALL)
+
+
 def run_bw_dma_sz_sweep(nfp, outdir):
     """Run Bandwidth tests across different DMA sizes"""
     twr = TableWriter(nfp.bw_fmt)
@@ -320,8 +996,8 @@ def run_bw_dma_sz_sweep(nfp, outdir):
 
     for test_no in [nfp.BW_DMA_RD, nfp.BW_DMA_WR, nfp.BW_DMA_RW]:
         twr.sec()
-        for trans_sz in trans_szs:
-            nfp.bw_test(twr, test_no, flags, win_sz, trans_sz, 0, 0)
+        nfp.bw_tests(twr, [(test_no, flags, win_sz, trans_sz, 0, 0)
+                           for trans_sz in trans_szs])
 
     twr.close(TableWriter.ALL)
 
@@ -382,13 +1058,11 @@ def run_bw_dma_off(nfp, outdir):
 
             for trans_sz in trans_szs:
                 twr.sec()
-                for off in offsets:
-                    _ = nfp.bw_test(twr, test_no, flags,
-                                    win_sz, trans_sz, off, 0)
+                nfp.bw_tests(twr, [(test_no, flags, win_sz, trans_sz, off, 0)
+                                   for off in offsets])
                 twr.sec()
-                for off in offsets:
-                    _ = nfp.bw_test(twr, test_no, flags,
-                                    win_sz, trans_sz, 0, off)
+                nfp.bw_tests(twr, [(test_no, flags, win_sz, trans_sz, 0, off)
+                                   for off in offsets])
 
         twr.close(TableWriter.ALL)
 
@@ -454,13 +1128,17 @@ def run_dbg_bw(nfp, wr_flag, rw_flag, win_sz, trans_sz,
     twr = TableWriter(nfp.bw_fmt)
     twr.open(outdir + "dbg_bw", TableWriter.ALL)
 
+    wtwr = TableWriter(nfp.worker_fmt)
+    wtwr.open(outdir + "dbg_bw_workers", TableWriter.ALL)
+
     flags = cache_flags
 
     if rnd:
         flags |= nfp.FLAGS_RANDOM
 
-    nfp.bw_test(twr, test_no, flags, win_sz, trans_sz, h_off, d_off)
+    nfp.bw_test(twr, test_no, flags, win_sz, trans_sz, h_off, d_off, wtwr)
     twr.close(TableWriter.ALL)
+    wtwr.close(TableWriter.ALL)
 
 
 def run_dbg_mem(nfp, outdir):
@@ -499,6 +1177,13 @@ def main():
     parser.add_option('-s', '--short',
                       action="store_true", dest='short', default=False,
                       help='Run a subset of the benchmarks')
+    parser.add_option('-r', '--reload',
+                      action="store_true", dest='reload', default=False,
+                      help='Reload the firmware before every test')
+    parser.add_option('-i', '--islands', type='int',
+                      default=1, action='store', metavar='NUM',
+                      help='Number of ME islands for bandwidth tests ' + \
+                           '(NFP-6000, firmware built with ISLANDS>=NUM)')
 
 
     ##
@@ -559,6 +1244,103 @@ def main():
                       help='Debug: Hit the same cachelines over and over ' + \
                            '[window = transfersize] (default None)')
 
+    parser.add_option('--page-map',
+                      action='store_true', dest='page_map', default=False,
+                      help='Run latency tests over the whole host buffer ' + \
+                           'and report latencies per host page')
+
+    parser.add_option('--timeline',
+                      action='store_true', dest='timeline', default=False,
+                      help='Run latency tests with the start time of ' + \
+                           'each transaction and analyse the spikes ' + \
+                           'over time')
+
+    parser.add_option('--heatmap',
+                      action='store_true', dest='heatmap', default=False,
+                      help='Run DMA latency and bandwidth sweeps over ' + \
+                           'all host/device offsets on the device')
+
+    parser.add_option('--interference',
+                      action='store_true', dest='interference', default=False,
+                      help='Run latency tests while other MEs run ' + \
+                           'bandwidth tests')
+
+    parser.add_option('--stream', type='int',
+                      action='store', dest='stream', default=0,
+                      help='Run long latency tests of STREAM million ' + \
+                           'transactions, streaming the results to the host')
+
+    parser.add_option('--load-curve',
+                      action='store_true', dest='load_curve', default=False,
+                      help='Run rate controlled DMA tests at increasing ' + \
+                           'offered loads (latency vs load)')
+
+    parser.add_option('--chase',
+                      action='store_true', dest='chase', default=False,
+                      help='Run dependent DMA read latency tests ' + \
+                           'chasing pointers through the host window')
+
+    parser.add_option('--chained',
+                      action='store_true', dest='chained', default=False,
+                      help='Run DMA tests with transactions of up to ' + \
+                           '64KB, using chained DMAs above 4KB')
+
+    parser.add_option('--nfp-mem',
+                      action='store_true', dest='nfp_mem', default=False,
+                      help='Run DMA tests to/from buffers in the ' + \
+                           'different NFP memories')
+
+    parser.add_option('--duplex',
+                      action='store_true', dest='duplex', default=False,
+                      help='Run BW tests with separate pools of MEs ' + \
+                           'for reads and writes')
+
+    parser.add_option('--ring',
+                      action='store_true', dest='ring', default=False,
+                      help='Run host descriptor ring tests (needs the ' + \
+                           'C helper)')
+
+    parser.add_option('--d2h-vis',
+                      action='store_true', dest='d2h_vis', default=False,
+                      help='Run one-way device to host write ' + \
+                           'visibility tests (needs the C helper)')
+
+    parser.add_option('--h2d-fresh',
+                      action='store_true', dest='h2d_fresh', default=False,
+                      help='Run one-way host to device write ' + \
+                           'freshness tests (needs the C helper)')
+
+    parser.add_option('--clock-sync',
+                      action='store_true', dest='clock_sync', default=False,
+                      help='Synchronise the NFP and host clocks ' + \
+                           'repeatedly to measure their drift (needs ' + \
+                           'the C helper)')
+
+    parser.add_option('--coalesce',
+                      action='store_true', dest='coalesce', default=False,
+                      help='Run write coalescing tests with small ' + \
+                           'logical writes')
+
+    parser.add_option('--read-order',
+                      action='store_true', dest='read_order', default=False,
+                      help='Run PCIe read completion ordering tests')
+
+    parser.add_option('--tlp-attrs',
+                      action='store_true', dest='tlp_attrs', default=False,
+                      help='Run DMA tests with relaxed ordering and ' + \
+                           'no snoop TLP attributes')
+
+    parser.add_option('--sg',
+                      action='store_true', dest='sg', default=False,
+                      help='Run gather/scatter DMA latency tests ' + \
+                           'with up to 32 segments per transaction')
+
+    parser.add_option('--size-dist',
+                      action='store', dest='size_dist', default=None,
+                      help='Run bandwidth tests with DMA sizes from ' + \
+                           'SIZE_DIST, a file of "size weight" lines, ' + \
+                           'or "imix"')
+
     parser.add_option("-v", '--verbose',
                       action="count", help='set the verbosity level')
 
@@ -573,7 +1355,8 @@ def main():
     # System information
     pciebench.sysinfo.collect(outdir, options.nfp)
 
-    nfp = NFPBench(options.nfp, options.fwfile, options.helper)
+    nfp = NFPBench(options.nfp, options.fwfile, options.helper,
+                   options.reload, options.islands)
 
     cache_vals = {'hwarm' : nfp.FLAGS_HOSTWARM,
                   'dwarm' : nfp.FLAGS_WARM,
@@ -617,6 +1400,82 @@ def main():
         run_dbg_mem(nfp, outdir)
         return
 
+    if options.page_map:
+        run_lat_page_map(nfp, outdir)
+        return
+
+    if options.timeline:
+        run_lat_timeline(nfp, outdir)
+        return
+
+    if options.heatmap:
+        run_off_heatmap(nfp, outdir)
+        return
+
+    if options.interference:
+        run_interference(nfp, outdir)
+        return
+
+    if options.chase:
+        run_lat_chase(nfp, outdir)
+        return
+
+    if options.chained:
+        run_chained(nfp, outdir)
+        return
+
+    if options.nfp_mem:
+        run_nfp_mem(nfp, outdir)
+        return
+
+    if options.duplex:
+        run_duplex(nfp, outdir)
+        return
+
+    if options.ring:
+        run_ring(nfp, outdir)
+        return
+
+    if options.d2h_vis:
+        run_d2h_vis(nfp, outdir)
+        return
+
+    if options.h2d_fresh:
+        run_h2d_fresh(nfp, outdir)
+        return
+
+    if options.clock_sync:
+        run_clock_sync(nfp, outdir)
+        return
+
+    if options.coalesce:
+        run_coalesce(nfp, outdir)
+        return
+
+    if options.read_order:
+        run_read_order(nfp, outdir)
+        return
+
+    if options.tlp_attrs:
+        run_tlp_attrs(nfp, outdir)
+        return
+
+    if options.sg:
+        run_sg(nfp, outdir)
+        return
+
+    if options.size_dist:
+        run_bw_dma_size_dist(nfp, outdir, options.size_dist)
+        return
+
+    if options.load_curve:
+        run_load_curve(nfp, outdir)
+        return
+
+    if options.stream:
+        run_lat_stream(nfp, outdir, options.stream * 1000 * 1000)
+        return
+
     run_lat_cmd(nfp, outdir)
     run_lat_cmd_sweep(nfp, outdir)
     if not options.short:
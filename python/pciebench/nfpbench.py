@@ -15,37 +15,91 @@
 
 """Main functions/class to control the NFP ME firmware"""
 
+import os
 import subprocess
 import struct
 import math
 import time
+import bisect
+import array
+import random
 
-from .stats import ListStats
+from .stats import ListStats, HistStats
 from .debug import err, warn, dbg, trc, log
 
 # procfs files exported by the kernel module
 _PROC_DMA_ADDRS = "/proc/pciebench_dma_addrs-%d"
 _PROC_BUF_SZ = "/proc/pciebench_buf_sz-%d"
 _PROC_BUFFER = "/proc/pciebench_buffer-%d"
+_PROC_XFER_ADDRS = "/proc/pciebench_xfer_addrs-%d"
+_PROC_XFER = "/proc/pciebench_xfer-%d"
 
 # Symbol names for interacting with the FW
 _NFP6000_ME_TEST_CTRL = "i32._test_ctrl"
 _NFP6000_ME_TEST_PARAMS = "i32._test_params"
 _NFP6000_ME_TEST_RESULT = "i32._test_result"
+_NFP6000_ME_TEST_SLOTS = "i32._test_slots"
 _NFP6000_ME_DMA_ADDRS = "i32._host_dma_addrs"
+_NFP6000_ME_STREAM_STATE = "i32._stream_state"
+_NFP6000_ME_XFER_ADDRS = "i32._host_xfer_addrs"
+_NFP6000_ME_TEST_QUEUE = "_test_queue"
+_NFP6000_ME_SWEEP_SPEC = "_sweep_spec"
+_NFP6000_ME_SWEEP_POINTS = "_sweep_points"
+_NFP6000_ME_WORKER_STATS = "_worker_stats"
+_NFP6000_ME_RATE_SPEC = "i32._rate_spec"
+_NFP6000_ME_SIZE_DIST = "i32._size_dist"
+_NFP6000_ME_DUPLEX_SPEC = "i32._duplex_spec"
+_NFP6000_ME_RING_DOORBELL = "i32._ring_doorbell"
+_NFP6000_ME_CLOCK_SYNC = "i32._clock_sync_req"
 _NFP6000_TEST_JOURNAL = "test_journal"
+_NFP6000_DEBUG_JOURNAL = "debug_journal"
 
 _NFP3200_ME_TEST_CTRL = "cl1._test_ctrl"
 _NFP3200_ME_TEST_PARAMS = "cl1._test_params"
 _NFP3200_ME_TEST_RESULT = "cl1._test_result"
+_NFP3200_ME_TEST_SLOTS = "cl1._test_slots"
 _NFP3200_ME_DMA_ADDRS = "cl1._host_dma_addrs"
+_NFP3200_ME_STREAM_STATE = "cl1._stream_state"
+_NFP3200_ME_XFER_ADDRS = "cl1._host_xfer_addrs"
+_NFP3200_ME_TEST_QUEUE = "_test_queue"
+_NFP3200_ME_SWEEP_SPEC = "_sweep_spec"
+_NFP3200_ME_SWEEP_POINTS = "_sweep_points"
+_NFP3200_ME_WORKER_STATS = "_worker_stats"
+_NFP3200_ME_RATE_SPEC = "cl1._rate_spec"
+_NFP3200_ME_SIZE_DIST = "cl1._size_dist"
+_NFP3200_ME_DUPLEX_SPEC = "cl1._duplex_spec"
+_NFP3200_ME_RING_DOORBELL = "cl1._ring_doorbell"
+_NFP3200_ME_CLOCK_SYNC = "cl1._clock_sync_req"
 _NFP3200_TEST_JOURNAL = "_test_journal"
+_NFP3200_DEBUG_JOURNAL = "_debug_journal"
 
 _ME_TEST_CTRL = None
 _ME_TEST_PARAMS = None
 _ME_TEST_RESULT = None
+_ME_TEST_SLOTS = None
 _ME_DMA_ADDRS = None
+_ME_STREAM_STATE = None
+_ME_XFER_ADDRS = None
+_ME_TEST_QUEUE = None
+_ME_SWEEP_SPEC = None
+_ME_SWEEP_POINTS = None
+_ME_WORKER_STATS = None
+_ME_RATE_SPEC = None
+_ME_SIZE_DIST = None
+_ME_DUPLEX_SPEC = None
+_ME_RING_DOORBELL = None
+_ME_CLOCK_SYNC = None
 _TEST_JOURNAL = None
+_DEBUG_JOURNAL = None
+
+# Host page size used for spatial latency maps
+HOST_PAGE_SZ = 4096
+
+# Number of 32bit entries in the host stream ring (PCIEBENCH_STREAM_SZ)
+STREAM_ENTRIES = 16 * 1024 * 1024
+
+# Offset of the results in the transfer area (PCIEBENCH_XFER_RESULT_CHUNK)
+XFER_RESULT_OFF = 64 * 1024 * 1024
 
 # Firmware image name
 FW_FILE = "./pciebench.fw"
@@ -111,10 +165,19 @@ class NFPBench(object):
     BW_DMA_RD = 5
     BW_DMA_WR = 6
     BW_DMA_RW = 7
+    TEST_QUEUE = 8
+    TEST_SWEEP = 9
+    RING_DESC = 10
+    D2H_VIS = 11
+    H2D_FRESH = 12
+    CLOCK_SYNC = 13
+    WR_COALESCE = 14
+    READ_ORDER = 15
 
     TESTS = [LAT_CMD_RD, LAT_CMD_WRRD,
              LAT_DMA_RD, LAT_DMA_WRRD,
-             BW_DMA_RD, BW_DMA_WR, BW_DMA_RW]
+             BW_DMA_RD, BW_DMA_WR, BW_DMA_RW,
+             WR_COALESCE, READ_ORDER]
 
     LAT_TESTS = [LAT_CMD_RD, LAT_CMD_WRRD, LAT_DMA_RD, LAT_DMA_WRRD]
     BW_TESTS = [BW_DMA_RD, BW_DMA_WR, BW_DMA_RW]
@@ -126,31 +189,145 @@ class NFPBench(object):
                   BW_DMA_RD : "BW_DMA_RD",
                   BW_DMA_WR : "BW_DMA_WR",
                   BW_DMA_RW : "BW_DMA_RW",
+                  WR_COALESCE : "WR_COALESCE",
+                  READ_ORDER : "READ_ORDER",
                   }
 
+    # Inter-arrival times of rate controlled tests (keep in sync with
+    # enum rate_mode)
+    RATE_CONST = 0
+    RATE_POISSON = 1
+    RATE_NAMES = {RATE_CONST : "Const", RATE_POISSON : "Poisson"}
+
+    # Entries in a size distribution (keep in sync with
+    # PCIEBENCH_SIZE_DIST_SZ)
+    SIZE_DIST_SZ = 256
+
+    # NFP buffer memories (keep in sync with enum nfp_buf_mem)
+    MEM_DEFAULT = 0
+    MEM_CTM = 1
+    MEM_IMEM = 2
+    MEM_EMEM = 3
+    MEM_NAMES = {MEM_DEFAULT : "Default", MEM_CTM : "CTM",
+                 MEM_IMEM : "IMEM", MEM_EMEM : "EMEM"}
+
+    # Host descriptor ring modes and limits (keep in sync with enum
+    # ring_mode, PCIEBENCH_RING_SZ and PCIEBENCH_RING_BATCH)
+    RING_POLL = 0
+    RING_DOORBELL = 1
+    RING_NAMES = {RING_POLL : "Poll", RING_DOORBELL : "Doorbell"}
+    RING_SZ = 4096
+    RING_BATCH = 64
+
+    # Offset of the clock synchronisation timestamps in the host buffer
+    # (keep in sync with PCIEBENCH_SYNC_OFF)
+    SYNC_OFF = 4 * 1024 * 1024 - 4096
+
+    # How the NFP polls the host in H2D_FRESH tests (keep in sync with
+    # enum fresh_method)
+    FRESH_DMA = 0
+    FRESH_CMD = 1
+    FRESH_NAMES = {FRESH_DMA : "DMA", FRESH_CMD : "CMD"}
+
+    # Outstanding reads of read ordering tests (keep in sync with
+    # PCIEBENCH_ORDER_MAX)
+    ORDER_MAX = 8
+
+    # How the NFP reads in read ordering tests (keep in sync with
+    # enum order_method)
+    ORDER_DMA = 0
+    ORDER_CMD = 1
+    ORDER_NAMES = {ORDER_DMA : "DMA", ORDER_CMD : "CMD"}
+
+    # Size of each NFP buffer (keep in sync with NFP_BUF_SZ)
+    NFP_BUF_SZ = 128 * 1024
+
+    # Number of test slots (keep in sync with PCIEBENCH_SLOTS)
+    SLOTS = 4
+
+    # Size of the host buffer (keep in sync with MAX_MEM)
+    MAX_MEM = 64 * 1024 * 1024
+
+    # Largest DMA transaction, larger than a single DMA descriptor are
+    # chained (keep in sync with PCIEBENCH_MAX_TRANS_SZ)
+    MAX_TRANS_SZ = 64 * 1024
+
+    # Number of test queue entries (keep in sync with PCIEBENCH_QUEUE_SZ)
+    QUEUE_SZ = 256
+
+    # Sweep limits (keep in sync with PCIEBENCH_SWEEP_*)
+    SWEEP_SIZES = 16
+    SWEEP_POINTS = 4096
+
+    # Timestamp ticks the NFP waits for a live host side before it gives
+    # up (keep in sync with PCIEBENCH_HOST_TIMEOUT)
+    HOST_TIMEOUT = 1 << 28
+
+    # Entries in the test journal (keep in sync with PCIEBENCH_JOURNAL_SZ)
+    JOURNAL_SZ = 16 * 1024 * 1024
+
+    # Default transactions of bandwidth tests (keep in sync with
+    # PCIEBENCH_BW_TRANS)
+    BW_TRANS = 8 * 1024 * 1024
+
+    # Rate controlled test schedule (keep in sync with
+    # PCIEBENCH_RATE_LEAD and PCIEBENCH_RATE_EXP_MAX)
+    RATE_LEAD = 16384
+    RATE_EXP_MAX = 1597
+
     # Test flags
     FLAGS_WARM = 1 << 0       # Try to warm the window from the device
     FLAGS_THRASH = 1 << 1     # Try to thrash the cache from the device
     FLAGS_RANDOM = 1 << 2     # Random access, default sequential
     FLAGS_LONG = 1 << 3       # Do a longer run
+    FLAGS_STREAM = 1 << 4     # Stream the journal to the host
+    FLAGS_XFER = 1 << 5       # DMA journal/results to the host
+    FLAGS_RATE = 1 << 6       # Rate controlled BW test (see rate_test)
+    FLAGS_SIZES = 1 << 7      # BW test with a size distribution
+    FLAGS_RO = 1 << 8         # DMAs with relaxed ordering
+    FLAGS_NS = 1 << 9         # DMAs with no snoop
+    FLAGS_DUPLEX = 1 << 10    # BW_DMA_RW with read/write pools
+    FLAGS_TIMELINE = 1 << 11  # Journal start timestamps, see timeline()
+    FLAGS_CHASE = 1 << 12     # LAT_DMA_RD chasing pointers in the window
     FLAGS_HOSTWARM = 1 << 31  # not a ME code flag
+    # Keep in sync with LAT_FLAGS_ALL
     FLAGS = FLAGS_WARM | FLAGS_THRASH | FLAGS_RANDOM | \
-            FLAGS_LONG | FLAGS_HOSTWARM
+            FLAGS_LONG | FLAGS_STREAM | FLAGS_XFER | FLAGS_RATE | \
+            FLAGS_SIZES | FLAGS_RO | FLAGS_NS | FLAGS_DUPLEX | \
+            FLAGS_TIMELINE | FLAGS_CHASE | FLAGS_HOSTWARM
     _FLAGS_CACHE = FLAGS_WARM | FLAGS_THRASH | FLAGS_HOSTWARM
 
-    def __init__(self, nfp_num=0, fwfile=None, helper=None):
+    def __init__(self, nfp_num=0, fwfile=None, helper=None, reload_fw=False,
+                 islands=1):
         """Initialise the class
 
         @nfp_num    NFP device number
         @fwfile     Path to firmware
         @helper     Optional path to a C helper program
+        @reload_fw  Reload the firmware before every test.  By default
+                    the firmware is only loaded for the first test.
+        @islands    Number of ME islands slot 0 uses for bandwidth
+                    tests (NFP-6000 only, see PCIEBENCH_ISLANDS)
         """
 
         global _ME_TEST_CTRL
         global _ME_TEST_PARAMS
         global _ME_TEST_RESULT
+        global _ME_TEST_SLOTS
         global _ME_DMA_ADDRS
+        global _ME_STREAM_STATE
+        global _ME_XFER_ADDRS
+        global _ME_TEST_QUEUE
+        global _ME_SWEEP_SPEC
+        global _ME_SWEEP_POINTS
+        global _ME_WORKER_STATS
+        global _ME_RATE_SPEC
+        global _ME_SIZE_DIST
+        global _ME_DUPLEX_SPEC
+        global _ME_RING_DOORBELL
+        global _ME_CLOCK_SYNC
         global _TEST_JOURNAL
+        global _DEBUG_JOURNAL
 
         self.nfp_num = nfp_num
 
@@ -165,14 +342,40 @@ class NFPBench(object):
             _ME_TEST_CTRL = _NFP6000_ME_TEST_CTRL
             _ME_TEST_PARAMS = _NFP6000_ME_TEST_PARAMS
             _ME_TEST_RESULT = _NFP6000_ME_TEST_RESULT
+            _ME_TEST_SLOTS = _NFP6000_ME_TEST_SLOTS
             _ME_DMA_ADDRS = _NFP6000_ME_DMA_ADDRS
+            _ME_STREAM_STATE = _NFP6000_ME_STREAM_STATE
+            _ME_XFER_ADDRS = _NFP6000_ME_XFER_ADDRS
+            _ME_TEST_QUEUE = _NFP6000_ME_TEST_QUEUE
+            _ME_SWEEP_SPEC = _NFP6000_ME_SWEEP_SPEC
+            _ME_SWEEP_POINTS = _NFP6000_ME_SWEEP_POINTS
+            _ME_WORKER_STATS = _NFP6000_ME_WORKER_STATS
+            _ME_RATE_SPEC = _NFP6000_ME_RATE_SPEC
+            _ME_SIZE_DIST = _NFP6000_ME_SIZE_DIST
+            _ME_DUPLEX_SPEC = _NFP6000_ME_DUPLEX_SPEC
+            _ME_RING_DOORBELL = _NFP6000_ME_RING_DOORBELL
+            _ME_CLOCK_SYNC = _NFP6000_ME_CLOCK_SYNC
             _TEST_JOURNAL = _NFP6000_TEST_JOURNAL
+            _DEBUG_JOURNAL = _NFP6000_DEBUG_JOURNAL
         else:
             _ME_TEST_CTRL = _NFP3200_ME_TEST_CTRL
             _ME_TEST_PARAMS = _NFP3200_ME_TEST_PARAMS
             _ME_TEST_RESULT = _NFP3200_ME_TEST_RESULT
+            _ME_TEST_SLOTS = _NFP3200_ME_TEST_SLOTS
             _ME_DMA_ADDRS = _NFP3200_ME_DMA_ADDRS
+            _ME_STREAM_STATE = _NFP3200_ME_STREAM_STATE
+            _ME_XFER_ADDRS = _NFP3200_ME_XFER_ADDRS
+            _ME_TEST_QUEUE = _NFP3200_ME_TEST_QUEUE
+            _ME_SWEEP_SPEC = _NFP3200_ME_SWEEP_SPEC
+            _ME_SWEEP_POINTS = _NFP3200_ME_SWEEP_POINTS
+            _ME_WORKER_STATS = _NFP3200_ME_WORKER_STATS
+            _ME_RATE_SPEC = _NFP3200_ME_RATE_SPEC
+            _ME_SIZE_DIST = _NFP3200_ME_SIZE_DIST
+            _ME_DUPLEX_SPEC = _NFP3200_ME_DUPLEX_SPEC
+            _ME_RING_DOORBELL = _NFP3200_ME_RING_DOORBELL
+            _ME_CLOCK_SYNC = _NFP3200_ME_CLOCK_SYNC
             _TEST_JOURNAL = _NFP3200_TEST_JOURNAL
+            _DEBUG_JOURNAL = _NFP3200_DEBUG_JOURNAL
 
         if fwfile:
             self.fw_name = fwfile
@@ -180,16 +383,53 @@ class NFPBench(object):
             self.fw_name = FW_FILE
 
         self.helper = helper
+        self.reload_fw = reload_fw
+        self.fw_loaded = False
+
+        # Read journal and results from the host transfer area, if the
+        # kernel module provides one
+        self.use_xfer = os.path.exists(_PROC_XFER % self.nfp_num)
+
+        # Last worker ME (see PCIEBENCH_LAST_WORKER_ME)
+        self.last_me = 11 if self.nfp6000 else 7
+
+        # Worker islands used by slot 0 in addition to i32
+        if islands > 1 and not self.nfp6000:
+            err("Multiple islands are only supported on the NFP-6000")
+        self.islands = islands - 1
+
+        # Slot configuration: (first ME, last ME, host offset) per slot
+        self.slots = [(0, self.last_me, 0)] + \
+                     [(0, 0, 0)] * (self.SLOTS - 1)
 
         self.symtab = {}
+
+        # Host buffer layout, filled in by _set_dma_addrs()
+        self.dma_addrs = []
+        self.chunk_sz = 0
+        self._chunk_starts = []
+
+        # Journal positions of the last latency test (see r1/r2)
+        self.journal_start = 0
+        self.dbg_journal_start = 0
+
+        # Start timestamp (in ME cycles) of the last test result read
+        self.result_start = 0
+
+        # Clock synchronisation points (NFP timestamp, host time in ns,
+        # error in ns), see clock_sync()
+        self.clock_points = []
         return
 
     def cyc2ns(self, cycles):
-        """Convert ME cycles to nanosecods"""
-        return float(cycles) *  (1000 * 1000 * 1000) / self.freq_hz
-
-    def _sym_write(self, sym, val):
-        """Write value(s) to symbol"""
+        """Convert ME cycles to nanosecods (of the host clock, once the
+        clocks were synchronised twice, see clock_sync())"""
+        return float(cycles) * self._tick_ns() / 16
+
+    def _sym_write(self, sym, val, off=0):
+        """Write value(s) to symbol, optionally at offset @off"""
+        if off:
+            sym = "%s:0x%x" % (sym, off)
         _, _ = _exec_cmd("nfp-rtsym -n %d %s %s" % (self.nfp_num, sym, val))
         return
 
@@ -213,6 +453,19 @@ class NFPBench(object):
         self._get_symtab()
         return
 
+    def _setup_fw(self):
+        """Load the firmware and tell it about the host buffers.  The
+        firmware resets its per test state itself, so this is only
+        done once unless @reload_fw was set."""
+        if self.fw_loaded and not self.reload_fw:
+            return
+        self._reload_fw()
+        self._set_dma_addrs()
+        if self.use_xfer:
+            self._set_xfer_addrs()
+        self.fw_loaded = True
+        return
+
     def _get_symtab(self):
         """Extract some details from the symbol table from a fw file and
         return a dict, indexed by name and containing _Symbol objects"""
@@ -253,6 +506,28 @@ class NFPBench(object):
         f_dma.close()
         return
 
+    def _link_host(self, win_sz, unit_sz, h_off):
+        """Link the units of @unit_sz bytes in the host window of
+        @win_sz into a single random cycle for pointer chasing (see
+        "Pointer chasing" in pciebench.h).  The link to the next unit
+        is its index, as a little endian 32 bit word at @h_off (see
+        "Byte order" in pciebench.h)."""
+        units = win_sz // unit_sz
+        order = list(range(units))
+        # Sattolo's algorithm, which only produces single cycles
+        for i in range(units - 1, 0, -1):
+            j = random.randrange(i)
+            order[i], order[j] = order[j], order[i]
+
+        buf = bytearray(win_sz)
+        for i in range(units):
+            struct.pack_into('<I', buf, order[i] * unit_sz + h_off,
+                             order[(i + 1) % units])
+
+        f_dma = open(_PROC_BUFFER % self.nfp_num, 'wb')
+        f_dma.write(buf)
+        f_dma.close()
+
     def _set_dma_addrs(self):
         """The kernel module exports a list of memory regions to be
         accessed by the NFP.  Read the list, validate it and write it
@@ -273,7 +548,7 @@ class NFPBench(object):
 
         # Sanity check (and debug)
         # The ME code makes some assumptions which we check here
-        chunk_sz = buf_sz / len(dma_addrs)
+        chunk_sz = int(buf_sz / len(dma_addrs))
         dbg("buf_sz=0x%x chunks=%d chunk_sz=0x%x" %
             (buf_sz, len(dma_addrs), chunk_sz))
         dbg("DMA addresses:")
@@ -288,6 +563,11 @@ class NFPBench(object):
                 err("Chunk 0x%x can't be addressed with a single c2p bar" %
                     start)
 
+        # Keep the layout around to map DMA addresses back to offsets
+        self.dma_addrs = dma_addrs
+        self.chunk_sz = chunk_sz
+        self._chunk_starts = sorted(dma_addrs)
+
         loc_sym = self.symtab[_ME_DMA_ADDRS]
         entries = loc_sym.size / 8 # entries are 64bit
         nfp_addr = loc_sym.off
@@ -303,74 +583,119 @@ class NFPBench(object):
         self._sym_write(_ME_DMA_ADDRS, val)
         return
 
-    def _set_params(self, pm0, pm1, pm2, pm3, pm4):
-        """Write the test parameters to the device"""
+    # Number of test parameters (see struct test_params)
+    PARAMS = 8
+
+    def _set_params(self, params, slot=0):
+        """Write the test parameters for @slot to the device. Missing
+        parameters are set to 0"""
         loc_sym = self.symtab[_ME_TEST_PARAMS]
-        val = "0x%x 0x%x 0x%x 0x%x 0x%x" % (pm0, pm1, pm2, pm3, pm4)
-        trc("Write params to 0x%x -> %d %d %d %d %d (%s)" %
-            (loc_sym.off, pm0, pm1, pm2, pm3, pm4, val))
-        self._sym_write(_ME_TEST_PARAMS, val)
+        off = slot * int(loc_sym.size / self.SLOTS)
+        params = (list(params) + [0] * self.PARAMS)[:self.PARAMS]
+        val = " ".join("0x%x" % pm for pm in params)
+        trc("Write params to 0x%x -> %s (%s)" %
+            (loc_sym.off + off, " ".join("%d" % pm for pm in params), val))
+        self._sym_write(_ME_TEST_PARAMS, val, off)
         return
 
-    def _set_test_ctrl(self, ctrl):
-        """Write the test control to device"""
+    def _set_test_ctrl(self, ctrl, slot=0):
+        """Write the test control of @slot to device"""
         loc_sym = self.symtab[_ME_TEST_CTRL]
         val = "0x%x" % ctrl
-        trc("Write test control to 0x%x" % loc_sym.off)
-        self._sym_write(_ME_TEST_CTRL, val)
+        trc("Write test control to 0x%x" % (loc_sym.off + slot * 4))
+        self._sym_write(_ME_TEST_CTRL, val, slot * 4)
         return
 
-    def _get_test_ctrl(self):
-        """Get the test control value from the device"""
-        loc_sym = self.symtab[_ME_TEST_CTRL]
+    def _get_test_ctrl(self, slot=0):
+        """Get the test control value of @slot from the device"""
         mem = self._sym_read(_ME_TEST_CTRL)
-        # the symbol can be 8B or 4B depending where it is located
-        if loc_sym.size == 8:
-            res = struct.unpack('ii', mem)
-        else:
-            res = struct.unpack('i', mem)
-        trc("Test Control: %s" % res)
-        return res[0]
+        res = struct.unpack_from('<%ui' % self.SLOTS, mem)
+        trc("Test Control: %s" % (res,))
+        return res[slot]
+
+    def _set_slots(self):
+        """Write the slot configuration to the device"""
+        val = ""
+        for slot, (me_first, me_last, host_off) in enumerate(self.slots):
+            islands = self.islands if slot == 0 else 0
+            val += " 0x%x 0x%x 0x%x 0x%x" % (me_first, me_last, host_off,
+                                             islands)
+        trc("Write slot configuration: %s" % val)
+        self._sym_write(_ME_TEST_SLOTS, val)
+        return
 
-    def _get_result(self):
-        """Get the result from the device
+    def _read_xfer(self, off, length):
+        """Read @length bytes at offset @off from the transfer area"""
+        inf = open(_PROC_XFER % self.nfp_num, 'rb')
+        inf.seek(off)
+        mem = inf.read(length)
+        inf.close()
+        return mem
+
+    def _get_result(self, slot=0):
+        """Get the result of @slot from the device
         returns time difference (in ME cycles) and a tuple of test results"""
         loc_sym = self.symtab[_ME_TEST_RESULT]
-        mem = self._sym_read(_ME_TEST_RESULT)
+        words = int(loc_sym.size / 4 / self.SLOTS)
 
-        tmp = struct.unpack('<%uIc' % (loc_sym.size / 4), mem)
+        if self.use_xfer:
+            mem = self._read_xfer(XFER_RESULT_OFF + slot * words * 4,
+                                  words * 4)
+            tmp = struct.unpack('<%uI' % words, mem)
+        else:
+            mem = self._sym_read(_ME_TEST_RESULT)
+            tmp = struct.unpack_from('<%uI' % words, mem, slot * words * 4)
         trc("Test result: %s" % ' '.join([str(i) for i in tmp]))
         # first four words are time stamp
         start = (tmp[0] << 32) + tmp[1]
         end = (tmp[2] << 32) + tmp[3]
         diff = (end - start) * 16 # cycle counter every 16 cycles
+        self.result_start = start * 16
 
-        return diff, [tmp[4], tmp[5], tmp[6], tmp[7]]
+        return diff, list(tmp[4:])
 
-    def _read_journal(self, name, count=None):
+    def _read_journal(self, name, count=None, start=0):
         """The ME code maintains two journals, one for test data and
         one fro debug purposes.  This internal functions reads up to
-        @count values from the journal called @name.  If @count is
-        None, the whole journal is returned."""
+        @count values from the journal called @name, starting at entry
+        @start and wrapping around at the end.  If @count is None, the
+        whole journal is returned."""
 
         loc_sym = self.symtab[name]
+        entries = int(loc_sym.size / 4)
 
         if count == None:
-            byte_cnt = loc_sym.size
+            count = entries
         else:
-            byte_cnt = min(loc_sym.size, count * 4)
-
-        mem = self._sym_read(name, byte_cnt)
-        res = struct.unpack('<%uIc' % (byte_cnt / 4), mem)
-        return res[:-1]
+            count = min(entries, count)
+
+        res = ()
+        while count:
+            num = min(count, entries - start)
+            sym = "%s:0x%x" % (name, start * 4) if start else name
+            mem = self._sym_read(sym, num * 4)
+            res += struct.unpack_from('<%uI' % num, mem)
+            count -= num
+            start = 0
+        return res
 
     def get_journal(self, count=None, nullcheck=False):
         """Some tests uses a journal to store extra data.  This method
-        reads that journal and returns a tuple of 32bit values up to
-        @count if specified. If you expect the journal to be full and
-        don't expect 0 values, use @nullcheck"""
-
-        res = self._read_journal(_TEST_JOURNAL, count)
+        reads the entries of the last latency test from that journal
+        and returns a tuple of 32bit values up to @count if specified.
+        If you expect the journal to be full and don't expect 0 values,
+        use @nullcheck"""
+
+        if self.use_xfer:
+            # The firmware copied the journal to the transfer area
+            loc_sym = self.symtab[_TEST_JOURNAL]
+            byte_cnt = loc_sym.size if count == None else \
+                       min(loc_sym.size, count * 4)
+            mem = self._read_xfer(0, byte_cnt)
+            res = struct.unpack('<%uI' % (byte_cnt / 4), mem)
+        else:
+            res = self._read_journal(_TEST_JOURNAL, count,
+                                     self.journal_start)
 
         if nullcheck:
             nullcount = 0
@@ -381,7 +706,118 @@ class NFPBench(object):
                 warn("journal countains %d null entries" % nullcount)
         return res
 
-    def run_test(self, test_no, params, warm=0):
+    def get_debug_journal(self, count=None):
+        """The latency tests record the DMA address used for each
+        transaction in the debug journal as two 32bit values (high
+        and low word).  Return a list of up to @count 64bit DMA
+        addresses, in the order they were accessed."""
+
+        res = self._read_journal(_DEBUG_JOURNAL,
+                                 None if count == None else 2 * count,
+                                 self.dbg_journal_start)
+        return [((res[i] & 0xffffff) << 32) | res[i + 1]
+                for i in range(0, len(res) - 1, 2)]
+
+    def dma2off(self, dma_addr):
+        """Convert a host DMA address into an offset into the host
+        buffer.  Returns None if the address is not part of it."""
+        if not self.dma_addrs:
+            err("DMA addresses have not been set up")
+
+        starts = self._chunk_starts
+        pos = bisect.bisect_right(starts, dma_addr) - 1
+        if pos < 0 or dma_addr >= starts[pos] + self.chunk_sz:
+            return None
+        chunk_idx = self.dma_addrs.index(starts[pos])
+        return chunk_idx * self.chunk_sz + (dma_addr - starts[pos])
+
+    def _dbg_window(self, count):
+        """Read the debug journal entries of the last latency test
+        with @count transactions.  The firmware writes two entries per
+        transaction and wraps around, so if @count is more than half
+        the size of the debug journal, the later transactions have
+        overwritten the entries of the earlier ones.
+
+        Returns the index of the first transaction which still has its
+        entries and the entries from it onwards."""
+        entries = int(self.symtab[_DEBUG_JOURNAL].size / 4)
+        first = max(0, count - entries // 2)
+        res = self._read_journal(_DEBUG_JOURNAL, 2 * (count - first),
+                                 (self.dbg_journal_start + 2 * first) %
+                                 entries)
+        return first, res
+
+    def page_map(self, lat_cyc):
+        """Aggregate latencies from the last latency test by host
+        page and by chunk.  @lat_cyc is the list of latencies (in
+        cycles) as returned in the stats of @lat_test().
+
+        The DMA addresses come from the debug journal.  If the test
+        had more transactions than the debug journal holds addresses
+        for, only the latencies of the last transactions, whose
+        addresses were not overwritten, are aggregated.
+
+        Returns a tuple of two dictionaries, mapping page index and
+        chunk index, respectively, to a ListStats object."""
+
+        first, res = self._dbg_window(len(lat_cyc))
+        addrs = [((res[i] & 0xffffff) << 32) | res[i + 1]
+                 for i in range(0, len(res) - 1, 2)]
+        if first:
+            warn("Debug journal wrapped, mapping the last %d of %d "
+                 "samples" % (len(addrs), len(lat_cyc)))
+
+        pages = {}
+        chunks = {}
+        unknown = 0
+        for lat, addr in zip(lat_cyc[first:], addrs):
+            off = self.dma2off(addr)
+            if off == None:
+                unknown += 1
+                continue
+            pages.setdefault(off // HOST_PAGE_SZ, []).append(lat)
+            chunks.setdefault(off // self.chunk_sz, []).append(lat)
+
+        if unknown:
+            warn("%d samples with unknown DMA address" % unknown)
+
+        return (dict((k, ListStats(v)) for k, v in pages.items()),
+                dict((k, ListStats(v)) for k, v in chunks.items()))
+
+    def timeline(self, lat_cyc):
+        """Put the latencies of the last latency test, run with
+        @FLAGS_TIMELINE, on a timeline.  @lat_cyc is the list of
+        latencies (in cycles) as returned in the stats of @lat_test().
+
+        The start timestamps come from the debug journal, which the
+        later transactions of a test overwrite once it is full.  The
+        timeline then starts at the first transaction with its
+        timestamp intact rather than at the start of the test.
+
+        Returns a list of (start time, latency) tuples, both in ns.
+        The start times are host time (see ts2host()) if the clocks
+        were synchronised and relative to the start of the test
+        otherwise."""
+        first, res = self._dbg_window(len(lat_cyc))
+        if first:
+            warn("Debug journal wrapped, timeline starts at sample %d" %
+                 first)
+
+        timeline = []
+        for i in range(0, len(res) - 1, 2):
+            lat = lat_cyc[first + i // 2]
+            ts = (res[i] << 32) | res[i + 1]
+            # The top 32 bit were read after the transaction
+            if res[i + 1] + lat // 16 >= 1 << 32:
+                ts -= 1 << 32
+            if self.clock_points:
+                start_ns = self.ts2host(ts)[0]
+            else:
+                start_ns = self.cyc2ns(ts * 16 - self.result_start)
+            timeline.append((start_ns, self.cyc2ns(lat)))
+        return timeline
+
+    def run_test(self, test_no, params, warm=0, stream=None):
         """Run the test with @test_no and the provided parameters (a
         list/tuple).
 
@@ -389,38 +825,34 @@ class NFPBench(object):
         "warm" the cache with the first @warm bytes of the dma buffers
         by writing to them.
 
+        If @stream is set, it names a file to which the journal,
+        streamed to the host while the test runs, is written.
+
         Returns time difference (in ME cycles) and a tuple of test results
         """
 
         if test_no not in self.TESTS:
             err("Unknown test number %d" % test_no)
-        pm0 = 0
-        pm1 = 0
-        pm2 = 0
-        pm3 = 0
-        pm4 = 0
-        if len(params) > 0:
-            pm0 = params[0]
-        if len(params) > 1:
-            pm1 = params[1]
-        if len(params) > 2:
-            pm2 = params[2]
-        if len(params) > 3:
-            pm3 = params[3]
-        if len(params) > 4:
-            pm4 = params[4]
-
-        dbg("Test: %d p0=%d p1=%d p2=%d p3=%d p4=%d" %
-            (test_no, pm0, pm1, pm2, pm3, pm4))
+        dbg("Test: %d %s" % (test_no, " ".join(
+            "p%d=%d" % (i, pm) for i, pm in enumerate(params))))
 
-        self._reload_fw()
-        self._set_dma_addrs()
-        self._set_params(pm0, pm1, pm2, pm3, pm4)
+        if stream and not self.use_xfer:
+            err("Streaming requires a host transfer area")
+
+        self._setup_fw()
+        self.slots = [(0, self.last_me, 0)] + \
+                     [(0, 0, 0)] * (self.SLOTS - 1)
+        self._set_slots()
+        if self.use_xfer:
+            params = [params[0] | self.FLAGS_XFER] + list(params[1:])
+        self._set_params(params)
 
         # If we have a C helper, use it
         if self.helper:
             cmd = self.helper + " -n %d -c %s -t %d -w %d" % \
                   (self.nfp_num, _ME_TEST_CTRL, test_no, warm)
+            if stream:
+                cmd += " -j %s -r %s" % (stream, _ME_STREAM_STATE)
             ret, _ = _exec_cmd(cmd)
             if not ret == 0:
                 err("Test helper failed with %d" % (ret))
@@ -431,7 +863,11 @@ class NFPBench(object):
             if warm > 0:
                 self._warm_host(warm)
 
+            if stream:
+                self._set_stream_state([0] * 5)
             self._set_test_ctrl(test_no)
+            if stream:
+                self._consume_stream(stream)
             while self._get_test_ctrl() > 0:
                 time.sleep(5)
 
@@ -441,13 +877,329 @@ class NFPBench(object):
 
         diff, res = self._get_result()
         log("Finished: cycles=%d res=%s" % (diff, res))
+        if test_no in self.LAT_TESTS:
+            self.journal_start, self.dbg_journal_start = res[1], res[2]
 
         return diff, res
 
+    def _set_xfer_addrs(self):
+        """Write the DMA addresses of the host transfer area to the NFP"""
+        val = ""
+        inf = open(_PROC_XFER_ADDRS % self.nfp_num, 'r')
+        for line in inf:
+            addr = int(line, 0)
+            val += " 0x%x 0x%x" % (addr >> 32, addr & 0xffffffff)
+        inf.close()
+        trc("Write transfer area addresses: %s" % val)
+        self._sym_write(_ME_XFER_ADDRS, val)
+        return
+
+    def _get_stream_state(self):
+        """Return the stream state as a tuple of
+        (ctrl, prod, drained, cons, lost)"""
+        mem = self._sym_read(_ME_STREAM_STATE)
+        return struct.unpack_from('<5I', mem)
+
+    def _set_stream_state(self, vals):
+        """Write the stream state"""
+        self._sym_write(_ME_STREAM_STATE,
+                        " ".join("0x%x" % val for val in vals))
+        return
+
+    def _consume_stream(self, fname):
+        """Copy the journal streamed to the host ring into @fname while
+        the test runs.  This is a fallback if there is no C helper, it
+        is much slower and more likely to lose entries."""
+        inf = open(_PROC_XFER % self.nfp_num, 'rb')
+        outf = open(fname, 'wb')
+        cons = 0
+        while True:
+            running = self._get_test_ctrl() > 0
+            ctrl, _, drained, _, lost = self._get_stream_state()
+            while cons != drained:
+                idx = cons % STREAM_ENTRIES
+                num = min(drained - cons, STREAM_ENTRIES - idx)
+                inf.seek(idx * 4)
+                outf.write(inf.read(num * 4))
+                cons += num
+            self._sym_write(_ME_STREAM_STATE, "0x%x" % cons, 12)
+            if not running and ctrl == 0:
+                break
+            time.sleep(0.1)
+        if lost:
+            warn("Stream lost %d entries" % lost)
+        outf.close()
+        inf.close()
+        return
+
+    def run_concurrent(self, tests):
+        """Run several tests concurrently, each in its own slot.
+
+        @tests is a list of (test_no, params, me_first, me_last, host_off)
+        tuples.  Test i is run in slot i using MEs @me_first to
+        @me_last and the host buffer starting at @host_off.  The ME
+        ranges must not overlap and at most one latency test may be
+        run at a time as all latency tests share the journal.  Cache
+        warming from the host is not supported.
+
+        Returns a list of (time difference, test results) tuples, one
+        per test.
+        """
+        if len(tests) > self.SLOTS:
+            err("At most %d concurrent tests supported" % self.SLOTS)
+        if sum(t[0] in self.LAT_TESTS for t in tests) > 1:
+            err("At most one latency test may run concurrently")
+
+        used = set()
+        for test_no, params, me_first, me_last, host_off in tests:
+            if test_no not in self.TESTS:
+                err("Unknown test number %d" % test_no)
+            mes = set(range(me_first, me_last + 1))
+            if not mes or me_last > self.last_me or used & mes:
+                err("Illegal ME range %d-%d" % (me_first, me_last))
+            if host_off % HOST_PAGE_SZ:
+                err("Host offset must be page aligned. Was %d" % host_off)
+            used |= mes
+
+        self._setup_fw()
+        self.slots = [(0, 0, 0)] * self.SLOTS
+        for slot, (test_no, params, me_first, me_last, host_off) in \
+                enumerate(tests):
+            dbg("Slot %d: Test %d %s MEs %d-%d" %
+                (slot, test_no, " ".join("p%d=%d" % (i, pm) for i, pm in
+                                         enumerate(params)),
+                 me_first, me_last))
+            self.slots[slot] = (me_first, me_last, host_off)
+            if self.use_xfer:
+                params = [params[0] | self.FLAGS_XFER] + list(params[1:])
+            self._set_params(params, slot)
+        self._set_slots()
+
+        # The master ME dispatches slots in order and runs a slot
+        # starting at ME0 inline, so kick off the others first.
+        order = sorted(range(len(tests)), key=lambda i: tests[i][2] == 0)
+        if self.helper:
+            cmd = self.helper + " -n %d -c %s -w 0" % \
+                  (self.nfp_num, _ME_TEST_CTRL)
+            for slot in order:
+                cmd += " -s %d -t %d" % (slot, tests[slot][0])
+            ret, _ = _exec_cmd(cmd)
+            if not ret == 0:
+                err("Test helper failed with %d" % (ret))
+        else:
+            _thrash_cache()
+            for slot in order:
+                self._set_test_ctrl(tests[slot][0], slot)
+
+        results = []
+        for slot, test in enumerate(tests):
+            while self._get_test_ctrl(slot) > 0:
+                time.sleep(5)
+            ret = self._get_test_ctrl(slot)
+            if ret < 0:
+                err("Test %d in slot %d failed with %d" % (test[0], slot, ret))
+            diff, res = self._get_result(slot)
+            log("Finished slot %d: cycles=%d res=%s" % (slot, diff, res))
+            if test[0] in self.LAT_TESTS:
+                self.journal_start, self.dbg_journal_start = res[1], res[2]
+            results.append((diff, res))
+
+        return results
+
+    # Number of 32bit words per test queue entry (struct test_queue_entry)
+    _QUEUE_WORDS = 32
+
+    def run_queue(self, tests, warm=0):
+        """Run a list of tests back to back using the test queue of
+        the firmware.  @tests is a list of (test_no, params) tuples.
+
+        The host is only involved before and after each batch of
+        @QUEUE_SZ tests, so if @warm is set, the first @warm bytes of
+        the DMA buffers are only warmed once per batch.
+
+        Returns a list of (time difference, test results) tuples, one
+        per test.
+        """
+        for test_no, _ in tests:
+            if test_no not in self.TESTS:
+                err("Unknown test number %d" % test_no)
+
+        self._setup_fw()
+        self.slots = [(0, self.last_me, 0)] + \
+                     [(0, 0, 0)] * (self.SLOTS - 1)
+        self._set_slots()
+
+        results = []
+        for first in range(0, len(tests), self.QUEUE_SZ):
+            batch = tests[first:first + self.QUEUE_SZ]
+
+            # Write all queue entries with a single symbol write
+            val = ""
+            for idx, (test_no, params) in enumerate(batch):
+                dbg("Queue %d: Test %d %s" % (first + idx, test_no, " ".join(
+                    "p%d=%d" % (i, pm) for i, pm in enumerate(params))))
+                params = (list(params) + [0] * self.PARAMS)[:self.PARAMS]
+                words = [test_no] + params
+                words += [0] * (self._QUEUE_WORDS - len(words))
+                val += " " + " ".join("0x%x" % w for w in words)
+            self._sym_write(_ME_TEST_QUEUE, val)
+            self._set_params([0, len(batch)])
+
+            if self.helper:
+                cmd = self.helper + " -n %d -c %s -t %d -w %d" % \
+                      (self.nfp_num, _ME_TEST_CTRL, self.TEST_QUEUE, warm)
+                ret, _ = _exec_cmd(cmd)
+                if not ret == 0:
+                    err("Test helper failed with %d" % (ret))
+            else:
+                _thrash_cache()
+                if warm > 0:
+                    self._warm_host(warm)
+                self._set_test_ctrl(self.TEST_QUEUE)
+                while self._get_test_ctrl() > 0:
+                    time.sleep(5)
+
+            ret = self._get_test_ctrl()
+            if ret < 0:
+                err("Test queue failed with %d" % ret)
+
+            mem = self._sym_read(_ME_TEST_QUEUE,
+                                 len(batch) * self._QUEUE_WORDS * 4)
+            for idx, (test_no, _) in enumerate(batch):
+                tmp = struct.unpack_from('<%uI' % self._QUEUE_WORDS, mem,
+                                         idx * self._QUEUE_WORDS * 4)
+                ret = struct.unpack('<i', struct.pack('<I', tmp[0]))[0]
+                if ret < 0:
+                    err("Test %d (queue entry %d) failed with %d" %
+                        (test_no, first + idx, ret))
+                start = (tmp[9] << 32) + tmp[10]
+                end = (tmp[11] << 32) + tmp[12]
+                diff = (end - start) * 16 # cycle counter every 16 cycles
+                res = list(tmp[13:21])
+                log("Finished queue entry %d: cycles=%d res=%s" %
+                    (first + idx, diff, res))
+                results.append((diff, res))
+
+        return results
+
+    # Number of 32bit words in struct sweep_spec and struct sweep_point
+    _SWEEP_SPEC_WORDS = 16
+    _SWEEP_POINT_WORDS = 16
+
+    def run_sweep(self, test_no, flags, win_sz, trans_szs, h_offs, d_offs,
+                  samples=0, warm=0, mem=0):
+        """Run @test_no over a grid of transaction sizes, host and
+        device offsets on the device (see "Parameter sweeps" in
+        pciebench.h).
+        @test_no:   Test to run. One of @LAT_TESTS or @BW_TESTS
+        @flags:     Test flags. Combination of @FLAGS*
+        @win_sz:    Window size to access
+        @trans_szs: List of transaction sizes
+        @h_offs:    Host offsets as (first, last, step)
+        @d_offs:    Device offsets as (first, last, step)
+        @samples:   Transactions per point (0 for the default)
+        @warm:      Warm the first @warm bytes of the host buffers once
+        @mem:       NFP buffer memory, one of @MEM_*
+
+        Returns a list of (trans_sz, h_off, d_off, cycles, count, lat)
+        tuples, one per point, where @lat is a (min, avg, max) tuple of
+        the latencies in cycles for latency tests and None otherwise.
+        """
+        if test_no not in self.TESTS:
+            err("Unknown test number %d" % test_no)
+        if not trans_szs or len(trans_szs) > self.SWEEP_SIZES:
+            err("Between 1 and %d transaction sizes supported" %
+                self.SWEEP_SIZES)
+        for offs in (h_offs, d_offs):
+            if offs[2] <= 0 or offs[1] < offs[0]:
+                err("Invalid offset range %d:%d:%d" % tuple(offs))
+        points = len(trans_szs) * \
+                 len(range(h_offs[0], h_offs[1] + 1, h_offs[2])) * \
+                 len(range(d_offs[0], d_offs[1] + 1, d_offs[2]))
+        if points > self.SWEEP_POINTS:
+            err("Sweep has %d points, at most %d supported" %
+                (points, self.SWEEP_POINTS))
+        for trans_sz in trans_szs:
+            if test_no in self.LAT_TESTS:
+                self._lat_check(test_no, flags, win_sz, trans_sz)
+            else:
+                self._bw_check(test_no, flags, win_sz, trans_sz)
+            self._mem_check(mem, trans_sz, d_offs[1])
+        dbg("Sweep: %d flags=%d win_sz=%d sizes=%s h_offs=%s d_offs=%s" %
+            (test_no, flags, win_sz, trans_szs, h_offs, d_offs))
+
+        self._setup_fw()
+        self.slots = [(0, self.last_me, 0)] + \
+                     [(0, 0, 0)] * (self.SLOTS - 1)
+        self._set_slots()
+
+        words = [test_no, flags, win_sz, samples] + list(h_offs) + \
+                list(d_offs) + [len(trans_szs), mem]
+        words += [0] * (self._SWEEP_SPEC_WORDS - len(words)) + trans_szs
+        self._sym_write(_ME_SWEEP_SPEC,
+                        " ".join("0x%x" % w for w in words))
+
+        if self.helper:
+            cmd = self.helper + " -n %d -c %s -t %d -w %d" % \
+                  (self.nfp_num, _ME_TEST_CTRL, self.TEST_SWEEP, warm)
+            ret, _ = _exec_cmd(cmd)
+            if not ret == 0:
+                err("Test helper failed with %d" % (ret))
+        else:
+            _thrash_cache()
+            if warm > 0:
+                self._warm_host(warm)
+            self._set_test_ctrl(self.TEST_SWEEP)
+            while self._get_test_ctrl() > 0:
+                time.sleep(5)
+
+        ret = self._get_test_ctrl()
+        if ret < 0:
+            err("Sweep failed with %d" % ret)
+
+        mem = self._sym_read(_ME_SWEEP_POINTS,
+                             points * self._SWEEP_POINT_WORDS * 4)
+        res = []
+        for idx in range(points):
+            tmp = struct.unpack_from('<%uI' % self._SWEEP_POINT_WORDS, mem,
+                                     idx * self._SWEEP_POINT_WORDS * 4)
+            ret = struct.unpack('<i', struct.pack('<I', tmp[0]))[0]
+            if ret < 0:
+                err("Sweep point %d (sz=%d h_off=%d d_off=%d) failed with %d" %
+                    (idx, tmp[1], tmp[2], tmp[3], ret))
+            lat = None
+            if test_no in self.LAT_TESTS and tmp[5]:
+                lat = (tmp[6] * 16,
+                       16.0 * ((tmp[8] << 32) + tmp[9]) / tmp[5],
+                       tmp[7] * 16)
+            res.append((tmp[1], tmp[2], tmp[3], tmp[4] * 16, tmp[5], lat))
+        return res
+
+    def _cache_str(self, flags):
+        """Return a string describing the cache flags"""
+        cache_str = "Cold"
+        if flags & self.FLAGS_WARM:
+            cache_str = "DWarm"
+        if flags & self.FLAGS_THRASH:
+            cache_str = "DThrash"
+        if flags & self.FLAGS_HOSTWARM:
+            cache_str = "HWarm"
+        return cache_str
+
+    def _attr_str(self, flags):
+        """Return a string describing the TLP attribute flags"""
+        attrs = []
+        if flags & self.FLAGS_RO:
+            attrs.append("RO")
+        if flags & self.FLAGS_NS:
+            attrs.append("NS")
+        return "+".join(attrs) if attrs else "-"
+
     # Output format for latency tests
     lat_fmt = [("Test", 12, "%s"), # Benchmark name
                ("PAT", 4, "%s"),   # Access pattern
                ("Cache", 7, "%s"), # Cache warming/thrashing
+               ("Attr", 5, "%s"),  # TLP attributes
                ("HO", 2, "%s"),    # Host offset
                ("DO", 2, "%s"),    # Device offset
                ("WinSZ", 5, "%z"), # Window size
@@ -466,7 +1218,8 @@ class NFPBench(object):
                ("#outliers", 10, "%d"), ("#samples", 10, "%d"),
                ]
 
-    def lat_test(self, twr, test_no, flags, win_sz, trans_sz, h_off, d_off):
+    def lat_test(self, twr, test_no, flags, win_sz, trans_sz, h_off, d_off,
+                 mem=0):
         """Run a latency test:
         @twr:      TableWriter object set up with @lat_fmt
         @test_no:  Test to run. One of @LAT_TESTS
@@ -474,21 +1227,103 @@ class NFPBench(object):
         @win_sz:   Window size to access
         @trans_sz: Transaction size
         @h_off:    Host offset (from the start of a 64B cache line)
-        @d_off:    Device offset (from the start of a 64B cache line)
+        @d_off:    Device offset (from the start of the NFP buffer)
+        @mem:      NFP buffer memory, one of @MEM_* (DMA tests only)
 
         Returns a list of individual latencies for further analysis
         """
-        # Sanity checks
+        self._lat_check(test_no, flags, win_sz, trans_sz)
+        self._mem_check(mem, trans_sz, d_off)
+        if flags & self.FLAGS_CHASE:
+            self._chase_setup(test_no, flags, win_sz, trans_sz, h_off, d_off)
+
+        dbg("LatTest: %d flags=%d win_sz=%d trans_sz=%d  h_off=%d d_off=%d " %
+            (test_no, flags, win_sz, trans_sz, h_off, d_off))
+
+        # Run the test
+        cycles, res = self.run_test(
+            test_no, [flags, trans_sz, win_sz, h_off, d_off, 0, 0, mem],
+            win_sz if flags & self.FLAGS_HOSTWARM else 0)
+
+        return self._lat_report(twr, test_no, flags, win_sz, trans_sz,
+                                h_off, d_off, cycles, res)
+
+    def _chase_setup(self, test_no, flags, win_sz, trans_sz, h_off, d_off):
+        """Sanity check the arguments of a pointer chasing latency test
+        and link the host window"""
+        unit_sz = (trans_sz + h_off + 63) & ~63
+        if test_no != self.LAT_DMA_RD:
+            err("Pointer chasing is only supported for LAT_DMA_RD")
+        if flags & self._FLAGS_CACHE:
+            err("Cache warming/thrashing would overwrite the links")
+        if unit_sz & (unit_sz - 1) or unit_sz > 4096:
+            err("Pointer chasing needs a unit size of a power of 2 "
+                "up to 4096. Was %d" % unit_sz)
+        if d_off % 8:
+            err("Pointer chasing needs a device offset aligned to 8")
+        self._link_host(win_sz, unit_sz, h_off)
+
+    def _mem_check(self, mem, trans_sz, d_off):
+        """Sanity check the NFP buffer memory and device offset"""
+        if mem not in self.MEM_NAMES:
+            err("Unknown NFP buffer memory %d" % mem)
+        if not self.nfp6000 and mem in [self.MEM_CTM, self.MEM_IMEM]:
+            err("The NFP-3200 only has a DRAM buffer")
+        if d_off + trans_sz > self.NFP_BUF_SZ:
+            err("Transaction at device offset %d exceeds the NFP buffer" %
+                d_off)
+
+    # Most segments per gather/scatter transaction (keep in sync with
+    # PCIEBENCH_SG_MAX)
+    SG_MAX = 32
+
+    def sg_lat_test(self, twr, test_no, flags, win_sz, seg_sz, segs,
+                    h_off, d_off):
+        """Run a gather/scatter latency test, where each transaction
+        consists of @segs DMAs of @seg_sz bytes at independent host
+        addresses (see @dma_lat in pciebench.h):
+        @twr:      TableWriter object set up with @lat_fmt
+        @test_no:  Test to run. One of @LAT_DMA_RD or @LAT_DMA_WRRD
+        @flags:    Test flags. Combination of @FLAGS*
+        @win_sz:   Window size to access
+        @seg_sz:   Size of each segment
+        @segs:     Number of segments per transaction
+        @h_off:    Host offset (from the start of a 64B cache line)
+        @d_off:    Device offset (from the start of a 64B cache line)
+
+        The transaction size reported is @segs * @seg_sz.  Returns the
+        latency stats.
+        """
+        if test_no not in [self.LAT_DMA_RD, self.LAT_DMA_WRRD]:
+            err("%s is not a DMA latency test" % test_no)
+        self._lat_check(test_no, flags, win_sz, seg_sz)
+        if segs < 1 or segs > self.SG_MAX:
+            err("Between 1 and %d segments supported" % self.SG_MAX)
+        if segs > 1 and seg_sz > (4096 if self.nfp6000 else 2048):
+            err("Segments must fit into a single DMA")
+
+        dbg("SGLatTest: %d flags=%d win_sz=%d seg_sz=%d segs=%d "
+            "h_off=%d d_off=%d" %
+            (test_no, flags, win_sz, seg_sz, segs, h_off, d_off))
+
+        cycles, res = self.run_test(
+            test_no, [flags, seg_sz, win_sz, h_off, d_off, 0, segs],
+            win_sz if flags & self.FLAGS_HOSTWARM else 0)
+
+        return self._lat_report(twr, test_no, flags, win_sz, seg_sz * segs,
+                                h_off, d_off, cycles, res)
+
+    def _lat_check(self, test_no, flags, win_sz, trans_sz):
+        """Sanity check the arguments of a latency test"""
         if not test_no in self.LAT_TESTS:
             err("%s is not a latency test" % test_no)
         if (test_no == self.LAT_CMD_RD) or (test_no == self.LAT_CMD_WRRD):
             if (trans_sz % 4) or (trans_sz > 64):
                 err("Wrong argument for CMD latency test: %d" % (trans_sz))
         if (test_no == self.LAT_DMA_RD) or (test_no == self.LAT_DMA_WRRD):
-            if self.nfp6000 and (trans_sz > 4096):
-                err("For NFP-6000 the transaction must be less than 4096")
-            if not self.nfp6000 and (trans_sz > 2048):
-                err("For NFP-3200 the transaction must be less than 2048")
+            if trans_sz > self.MAX_TRANS_SZ:
+                err("DMA transactions must be at most %d bytes" %
+                    self.MAX_TRANS_SZ)
         if win_sz % 64:
             err("Window size must be a multiple of 64. Was %d" % win_sz)
         if flags & ~self.FLAGS:
@@ -496,15 +1331,10 @@ class NFPBench(object):
         if bin(flags & self._FLAGS_CACHE).count("1") > 1:
             err("Only one cache related flag may be set")
 
-
-        dbg("LatTest: %d flags=%d win_sz=%d trans_sz=%d  h_off=%d d_off=%d " %
-            (test_no, flags, win_sz, trans_sz, h_off, d_off))
-
-        # Run the test
-        cycles, res = self.run_test(
-            test_no, [flags, trans_sz, win_sz, h_off, d_off],
-            win_sz if flags & self.FLAGS_HOSTWARM else 0)
-
+    def _lat_report(self, twr, test_no, flags, win_sz, trans_sz,
+                    h_off, d_off, cycles, res):
+        """Read the journal of a finished latency test, write a summary
+        line to @twr and return the latency stats"""
         samples = res[0]
 
         # read timestamps and convert to cycles
@@ -514,6 +1344,16 @@ class NFPBench(object):
         # Calculate some stats
         stats = ListStats(lat_cyc)
 
+        # Outliers are values three times the 95th percentile
+        outliers = sum(i > (3 * stats.percentile(95)) for i in lat_cyc)
+
+        self._lat_out(twr, test_no, flags, win_sz, trans_sz, h_off, d_off,
+                      cycles, samples, stats, outliers)
+        return stats
+
+    def _lat_out(self, twr, test_no, flags, win_sz, trans_sz, h_off, d_off,
+                 cycles, samples, stats, outliers):
+        """Write a summary line for a latency test to @twr"""
         tavg_cyc = cycles / samples
         avg_cyc = stats.avg()
         med_cyc = stats.median()
@@ -530,33 +1370,89 @@ class NFPBench(object):
         per95_ns = self.cyc2ns(per95_cyc)
         per99_ns = self.cyc2ns(per99_cyc)
 
-        # Outliers are values three times the 95th percentile
-        outliers = sum(i > (3 * per95_cyc) for i in lat_cyc)
-
-        cache_str = "Cold"
-        if flags & self.FLAGS_WARM:
-            cache_str = "DWarm"
-        if flags & self.FLAGS_THRASH:
-            cache_str = "DThrash"
-        if flags & self.FLAGS_HOSTWARM:
-            cache_str = "HWarm"
+        if flags & self.FLAGS_CHASE:
+            pat = "Ptr"
+        else:
+            pat = "Rand" if flags & self.FLAGS_RANDOM else "Seq"
 
         twr.out((
-            self.TEST_NAMES[test_no],
-            "Rand" if flags & self.FLAGS_RANDOM else "Seq",
-            cache_str,
+            self.TEST_NAMES[test_no], pat,
+            self._cache_str(flags), self._attr_str(flags),
             h_off, d_off,
             win_sz, trans_sz,
             tavg_cyc, avg_cyc, med_cyc, min_cyc, max_cyc, per95_cyc, per99_cyc,
             tavg_ns, avg_ns, med_ns, min_ns, max_ns, per95_ns, per99_ns,
             outliers, samples))
+        return
+
+    def stream_lat_test(self, twr, test_no, flags, win_sz, trans_sz,
+                        h_off, d_off, trans, fname):
+        """Run a latency test of arbitrary length, streaming the
+        journal to the host while it runs:
+        @twr:      TableWriter object set up with @lat_fmt
+        @test_no:  Test to run. One of @LAT_TESTS
+        @flags:    Test flags. Combination of @FLAGS*
+        @win_sz:   Window size to access
+        @trans_sz: Transaction size
+        @h_off:    Host offset (from the start of a 64B cache line)
+        @d_off:    Device offset (from the start of a 64B cache line)
+        @trans:    Number of transactions
+        @fname:    File for the raw journal (32bit little endian
+                   timestamp differences, in 16 cycle units)
+
+        The journal may be too large to keep in memory, so the stats
+        are computed from a histogram.  Returns a HistStats object
+        (in cycles).
+        """
+        flags |= self.FLAGS_STREAM
+        self._lat_check(test_no, flags, win_sz, trans_sz)
+        if trans <= 0 or trans >= 1 << 32:
+            err("Illegal number of transactions %d" % trans)
+
+        dbg("StreamLatTest: %d flags=%d win_sz=%d trans_sz=%d h_off=%d "
+            "d_off=%d trans=%d" %
+            (test_no, flags, win_sz, trans_sz, h_off, d_off, trans))
+
+        cycles, res = self.run_test(
+            test_no, [flags, trans_sz, win_sz, h_off, d_off, trans],
+            win_sz if flags & self.FLAGS_HOSTWARM else 0, fname)
+
+        histo = {}
+        for vals in self.read_stream(fname):
+            for val in vals:
+                histo[val * 16] = histo.get(val * 16, 0) + 1
+        stats = HistStats(histo)
 
+        if stats.count() != res[0]:
+            warn("Streamed %d of %d samples" % (stats.count(), res[0]))
+
+        outliers = stats.count_above(3 * stats.percentile(95))
+        self._lat_out(twr, test_no, flags, win_sz, trans_sz, h_off, d_off,
+                      cycles, res[0], stats, outliers)
         return stats
 
+    @staticmethod
+    def read_stream(fname, block=1024 * 1024):
+        """Generator returning the entries of a streamed journal file in
+        arrays of up to @block entries"""
+        inf = open(fname, 'rb')
+        while True:
+            vals = array.array('I')
+            data = inf.read(block * 4)
+            if not data:
+                break
+            if hasattr(vals, 'frombytes'):
+                vals.frombytes(data)
+            else:
+                vals.fromstring(data)
+            yield vals
+        inf.close()
+
     # Output format for BW tests
     bw_fmt = [("Test", 10, "%s"),   # Benchmark Name
               ("PAT", 4, "%s"),     # Access pattern
               ("Cache", 7, "%s"),   # Cache warming/thrashing
+              ("Attr", 5, "%s"),    # TLP attributes
               ("HO", 2, "%s"),      # Host offset
               ("DO", 2, "%s"),      # Device offset
               ("WinSZ", 5, "%z"),   # Window size
@@ -569,7 +1465,8 @@ class NFPBench(object):
               ("Trans/s", 10, "%.1f"),
               ]
 
-    def bw_test(self, twr, test_no, flags, win_sz, trans_sz, h_off, d_off):
+    def bw_test(self, twr, test_no, flags, win_sz, trans_sz, h_off, d_off,
+                wtwr=None, mem=0):
         """Run a bandwidth test:
         @twr:      TableWriter object set up with @bw_fmt
         @test_no:  Test to run. One of @LAT_TESTS
@@ -578,16 +1475,961 @@ class NFPBench(object):
         @trans_sz: Transaction size
         @h_off:    Host offset (from the start of a 64B cache line)
         @d_off:    Device offset (from the start of a 64B cache line)
+        @wtwr:     Optional TableWriter object set up with @worker_fmt
+                   for per worker statistics
+        @mem:      NFP buffer memory, one of @MEM_*
 
         Returns a list of individual latencies for further analysis
         """
-        # Sanity checks
+        self._bw_check(test_no, flags, win_sz, trans_sz)
+        self._mem_check(mem, trans_sz, d_off)
+
+        cycles, res = self.run_test(
+            test_no, [flags, trans_sz, win_sz, h_off, d_off, 0, 0, mem],
+            win_sz if flags & self.FLAGS_HOSTWARM else 0)
+
+        self._bw_report(twr, test_no, flags, win_sz, trans_sz,
+                        h_off, d_off, cycles, res)
+        if wtwr:
+            self._worker_report(wtwr)
+        return
+
+    # Words in struct rate_spec
+    _RATE_SPEC_WORDS = 8
+
+    # Output format for rate controlled BW tests
+    rate_fmt = [("Test", 10, "%s"),   # Benchmark Name
+                ("PAT", 4, "%s"),     # Access pattern
+                ("Mode", 7, "%s"),    # Inter-arrival times
+                ("SZ", 4, "%d"),      # Transaction size
+                ("Interval", 8, "%d"), # Mean cycles between DMAs
+                ("On", 8, "%d"), ("Off", 8, "%d"),
+                ("", 0, ""),
+                ("Offered", 9, "%.3f"), # Offered load (GB/s)
+                ("Achieved", 9, "%.3f"), # Achieved throughput (GB/s)
+                ("", 0, ""),
+                ("Avg(ns)", 7, "%.1f"), ("Med(ns)", 7, "%d"),
+                ("Min(ns)", 7, "%d"), ("Max(ns)", 7, "%d"),
+                ("95%(ns)", 7, "%d"), ("99%(ns)", 7, "%d"),
+                ("99.9%(ns)", 9, "%d"),
+                ("", 0, ""),
+                ("Samples", 7, "%d"),
+                ]
+
+    def rate_trans_max(self, interval, mode=RATE_CONST, on=0, off=0):
+        """Return the most DMAs a rate controlled test with the given
+        schedule can issue.  The NFP keeps the schedule in 32 bit
+        cycles, so the test must end within 2^31 cycles, assuming the
+        longest Poisson inter-arrival times."""
+        limit = (1 << 31) - self.RATE_LEAD
+        if on:
+            limit = (limit - on) * on // (on + off)
+        if mode == self.RATE_POISSON:
+            interval = interval * self.RATE_EXP_MAX / 256.0
+        return max(0, int((limit - 1) // interval))
+
+    def rate_test(self, twr, test_no, flags, win_sz, trans_sz, h_off, d_off,
+                  interval, mode=RATE_CONST, on=0, off=0, sample_shift=0,
+                  trans=0):
+        """Run a rate controlled (open loop) bandwidth test (see "Rate
+        controlled bandwidth tests" in pciebench.h):
+        @twr:      TableWriter object set up with @rate_fmt
+        @test_no:  Test to run. One of @BW_TESTS
+        @flags:    Test flags. Combination of @FLAGS*
+        @win_sz:   Window size to access
+        @trans_sz: Transaction size
+        @h_off:    Host offset (from the start of a 64B cache line)
+        @d_off:    Device offset (from the start of a 64B cache line)
+        @interval: Mean ME cycles between DMAs
+        @mode:     @RATE_CONST or @RATE_POISSON inter-arrival times
+        @on, @off: Cycles with and without DMAs per burst (@on = 0
+                   for no bursts)
+        @sample_shift: Record the latency of every 2^@sample_shift DMA
+        @trans:    Number of DMAs (0 for the default)
+
+        Returns the latency stats (in cycles, measured from the
+        scheduled time of each DMA)
+        """
+        flags |= self.FLAGS_RATE
+        self._bw_check(test_no, flags, win_sz, trans_sz)
+        if flags & self.FLAGS_STREAM:
+            err("Rate controlled tests can't stream the journal")
+        if self.islands:
+            err("Rate controlled tests can't use worker islands")
+        if interval <= 0 or interval >= 1 << 21:
+            err("Illegal interval %d" % interval)
+        if mode not in self.RATE_NAMES:
+            err("Unknown rate mode %d" % mode)
+        if on < 0 or off < 0 or on + off >= 1 << 32:
+            err("Illegal on/off periods %d/%d" % (on, off))
+
+        n = trans or (self.JOURNAL_SZ if flags & self.FLAGS_LONG else
+                      self.BW_TRANS)
+        if n > self.rate_trans_max(interval, mode, on, off):
+            err("Schedule of %d DMAs is too long, at most %d DMAs with "
+                "an interval of %d cycles" %
+                (n, self.rate_trans_max(interval, mode, on, off), interval))
+
+        dbg("RateTest: %d flags=%d win_sz=%d trans_sz=%d h_off=%d d_off=%d "
+            "interval=%d mode=%d on=%d off=%d" %
+            (test_no, flags, win_sz, trans_sz, h_off, d_off,
+             interval, mode, on, off))
+
+        self._setup_fw()
+        words = [interval, mode, on, off, sample_shift]
+        words += [0] * (self._RATE_SPEC_WORDS - len(words))
+        self._sym_write(_ME_RATE_SPEC, " ".join("0x%x" % w for w in words))
+
+        cycles, res = self.run_test(
+            test_no, [flags, trans_sz, win_sz, h_off, d_off, trans],
+            win_sz if flags & self.FLAGS_HOSTWARM else 0)
+
+        self.journal_start = res[1]
+        lat_cyc = [x * 16 for x in self.get_journal(res[3], nullcheck=True)]
+        stats = ListStats(lat_cyc)
+
+        nbytes = trans_sz * res[0]
+        period = float(interval)
+        if on:
+            period = period * (on + off) / on
+        offered = 8.0 * trans_sz / self.cyc2ns(period)
+        achieved = 8.0 * nbytes / self.cyc2ns(cycles) if cycles else 0.0
+
+        twr.out((
+            self.TEST_NAMES[test_no],
+            "Rand" if flags & self.FLAGS_RANDOM else "Seq",
+            self.RATE_NAMES[mode], trans_sz, interval, on, off,
+            offered, achieved,
+            self.cyc2ns(stats.avg()), self.cyc2ns(stats.median()),
+            self.cyc2ns(stats.min()), self.cyc2ns(stats.max()),
+            self.cyc2ns(stats.percentile(95)),
+            self.cyc2ns(stats.percentile(99)),
+            self.cyc2ns(stats.percentile(99.9)),
+            len(lat_cyc)))
+        return stats
+
+    def _host_test_check(self, name, helper_ret):
+        """Check the outcome of test @name, whose host side ran in the
+        C helper, which returned @helper_ret.  The NFP gives up if the
+        host side stops responding (see @HOST_TIMEOUT), which in turn
+        stops the helper, so check the NFP first."""
+        ret = self._get_test_ctrl()
+        if ret < 0:
+            err("%s failed with %d: Invalid parameters, or the host side "
+                "did not respond within %.1fs" %
+                (name, ret, self.cyc2ns(self.HOST_TIMEOUT * 16) / 1e9))
+        if not helper_ret == 0:
+            err("Test helper failed with %d" % (helper_ret))
+
+    # Output format for descriptor ring tests
+    ring_fmt = [("Mode", 8, "%s"),     # Poll or doorbell
+                ("Attr", 5, "%s"),     # TLP attributes
+                ("Entries", 7, "%d"),  # Ring entries
+                ("Batch", 5, "%d"),    # Batch size
+                ("Len", 4, "%d"),      # Buffer length
+                ("", 0, ""),
+                ("Descs", 9, "%d"),    # Number of descriptors
+                ("Fetches", 9, "%d"),  # Descriptor fetches (DMAs)
+                ("Empty", 9, "%d"),    # Fetches without a new descriptor
+                ("Desc/s", 12, "%.1f"),
+                ("", 0, ""),
+                ("Avg(ns)", 8, "%.1f"), ("Med(ns)", 8, "%d"),
+                ("Min(ns)", 8, "%d"), ("Max(ns)", 8, "%d"),
+                ("95%(ns)", 8, "%d"), ("99%(ns)", 8, "%d"),
+                ]
+
+    def ring_test(self, twr, mode, entries, batch, count, length, fname,
+                  flags=0, mem=0, cpu=None):
+        """Run a host descriptor ring test (see "Host descriptor ring"
+        in pciebench.h) with the C helper producing descriptors and
+        reaping their completions:
+        @twr:      TableWriter object set up with @ring_fmt
+        @mode:     @RING_POLL or @RING_DOORBELL
+        @entries:  Number of ring entries (a power of 2)
+        @batch:    Descriptors per batch (and per doorbell)
+        @count:    Number of descriptors
+        @length:   Length of the buffer of each descriptor (0 for none)
+        @fname:    File to write the round trip times (in ns) to
+        @flags:    Test flags (@FLAGS_RO and @FLAGS_NS only)
+        @mem:      NFP buffer memory, one of @MEM_*
+        @cpu:      CPU to pin the helper to
+
+        Returns the round trip time stats (in ns)
+        """
+        if not self.helper:
+            err("Descriptor ring tests need the C helper")
+        if mode not in self.RING_NAMES:
+            err("Unknown ring mode %d" % mode)
+        if entries & (entries - 1) or not 0 < entries <= self.RING_SZ:
+            err("Ring entries must be a power of 2 up to %d. Was %d" %
+                (self.RING_SZ, entries))
+        if not 0 < batch <= min(self.RING_BATCH, entries // 2):
+            err("Batch must be 1 to %d. Was %d" %
+                (min(self.RING_BATCH, entries // 2), batch))
+        if not 0 < count or length > 4096:
+            err("Illegal count %d or length %d" % (count, length))
+        if flags & ~(self.FLAGS_RO | self.FLAGS_NS):
+            err("Illegal flags %#08x for ring tests" % flags)
+        self._mem_check(mem, length, 0)
+
+        dbg("RingTest: mode=%d entries=%d batch=%d count=%d length=%d "
+            "flags=%d" % (mode, entries, batch, count, length, flags))
+
+        self._setup_fw()
+        self.slots = [(0, self.last_me, 0)] + \
+                     [(0, 0, 0)] * (self.SLOTS - 1)
+        self._set_slots()
+        if self.use_xfer:
+            flags |= self.FLAGS_XFER
+        self._set_params([flags, 0, entries, batch, mode, count, 0, mem])
+
+        cmd = self.helper + " -n %d -c %s -t %d -e %d -S %s -b %d -N %d " \
+              "-l %d -o %s" % (self.nfp_num, _ME_TEST_CTRL, self.RING_DESC,
+                               entries, _ME_TEST_SLOTS, batch, count, length,
+                               fname)
+        if mode == self.RING_DOORBELL:
+            cmd += " -d %s" % _ME_RING_DOORBELL
+        if cpu is not None:
+            cmd += " -C %d" % cpu
+        ret, _ = _exec_cmd(cmd)
+        self._host_test_check("Ring test", ret)
+
+        cycles, res = self._get_result()
+        if res[3]:
+            warn("%d descriptors with an invalid buffer" % res[3])
+
+        rtt = array.array('I')
+        inf = open(fname, 'rb')
+        rtt.fromfile(inf, count)
+        inf.close()
+        stats = ListStats(rtt.tolist())
+
+        rate = 1.0 * res[0] / (self.cyc2ns(cycles) / (1000 * 1000 * 1000))
+
+        twr.out((
+            self.RING_NAMES[mode], self._attr_str(flags),
+            entries, batch, length,
+            res[0], res[1], res[2], rate,
+            stats.avg(), stats.median(), stats.min(), stats.max(),
+            stats.percentile(95), stats.percentile(99)))
+        return stats
+
+    def _clock_best(self, recs):
+        """Return the clock synchronisation round with the smallest
+        round trip time from @recs, a list of (host time before the
+        request, host time the NFP timestamp was seen, NFP timestamp),
+        as (NFP timestamp in 16 cycle units, host time in ns, error in
+        ns)"""
+        t0, t1, ts = min(recs, key=lambda rec: rec[1] - rec[0])
+        return ts, (t0 + t1) / 2.0, (t1 - t0) / 2.0
+
+    def _clock_fit(self, point0, point1):
+        """Map NFP timestamps to host time with the two clock
+        synchronisation points @point0 and @point1 (see _clock_best()).
+
+        Returns a function converting NFP timestamps (in 16 cycle
+        units) to host time (in ns), the error bound (in ns) between
+        the two points and the drift of the NFP clock relative to the
+        host clock (in ppm)"""
+        ts0, ns0, err0 = point0
+        ts1, ns1, err1 = point1
+        nominal = 16.0 * 1000 / self.freq_mhz
+        slope = (ns1 - ns0) / (ts1 - ts0) if ts1 != ts0 else nominal
+        drift = (slope / nominal - 1.0) * 1000 * 1000
+        return (lambda ts: ns0 + (ts - ts0) * slope), max(err0, err1), drift
+
+    def _tick_ns(self):
+        """Return the length of an NFP timestamp tick (16 cycles) in
+        host ns, measured if the clocks were synchronised at least
+        twice, nominal otherwise"""
+        nominal = 16.0 * 1000 / self.freq_mhz
+        if len(self.clock_points) < 2:
+            return nominal
+        (ts0, ns0, _), (ts1, ns1, _) = \
+            self.clock_points[0], self.clock_points[-1]
+        return (ns1 - ns0) / (ts1 - ts0) if ts1 != ts0 else nominal
+
+    def ts2host(self, ts):
+        """Convert the NFP timestamp @ts (in 16 cycle units, e.g.
+        @result_start / 16) to host time (CLOCK_MONOTONIC, in ns) with
+        the first and last clock synchronisation points.
+
+        Returns the host time and its error bound (in ns).  Outside the
+        synchronised interval, the bound grows with the uncertainty of
+        the measured drift."""
+        if not self.clock_points:
+            err("Clocks were not synchronised")
+        point0, point1 = self.clock_points[0], self.clock_points[-1]
+        to_host, bound, _ = self._clock_fit(point0, point1)
+        host_ns = to_host(ts)
+
+        if point1[1] != point0[1]:
+            rate_err = (point0[2] + point1[2]) / (point1[1] - point0[1])
+            if host_ns < point0[1]:
+                bound += (point0[1] - host_ns) * rate_err
+            elif host_ns > point1[1]:
+                bound += (host_ns - point1[1]) * rate_err
+        return host_ns, bound
+
+    # Output format for clock synchronisation
+    sync_fmt = [("Point", 5, "%d"),
+                ("Rounds", 6, "%d"),
+                ("", 0, ""),
+                ("RTTMin(ns)", 10, "%d"), ("RTTMed(ns)", 10, "%d"),
+                ("RTTMax(ns)", 10, "%d"),
+                ("Err(ns)", 8, "%.1f"),   # Offset error bound
+                ("", 0, ""),
+                ("Elapsed(s)", 10, "%.3f"), # Since the first point
+                ("Drift", 8, "%.2f"),     # NFP clock drift (ppm)
+                ("MHz", 10, "%.4f"),      # Measured ME frequency
+                ]
+
+    def clock_sync(self, twr, rounds, fname, cpu=None):
+        """Synchronise the NFP and host clocks (see "Clock
+        synchronisation" in pciebench.h) and add the round with the
+        smallest round trip time to the clock synchronisation points.
+        Once there are at least two points, ts2host() and cyc2ns() use
+        the measured drift.
+        @twr:      TableWriter object set up with @sync_fmt
+        @rounds:   Clock synchronisation rounds
+        @fname:    File to write the timestamps to
+        @cpu:      CPU to pin the helper to
+
+        Returns the synchronisation point (NFP timestamp in 16 cycle
+        units, host time in ns, error in ns)
+        """
+        if not self.helper:
+            err("Clock synchronisation needs the C helper")
+        if not 0 < rounds:
+            err("Illegal rounds %d" % rounds)
+
+        dbg("ClockSync: rounds=%d" % rounds)
+
+        self._setup_fw()
+        self.slots = [(0, self.last_me, 0)] + \
+                     [(0, 0, 0)] * (self.SLOTS - 1)
+        self._set_slots()
+        flags = self.FLAGS_XFER if self.use_xfer else 0
+        self._set_params([flags, 0, 0, 0, 0, 0, rounds, 0])
+
+        cmd = self.helper + " -n %d -c %s -t %d -y %s -k %d -o %s" % \
+              (self.nfp_num, _ME_TEST_CTRL, self.CLOCK_SYNC,
+               _ME_CLOCK_SYNC, rounds, fname)
+        if cpu is not None:
+            cmd += " -C %d" % cpu
+        ret, _ = _exec_cmd(cmd)
+        self._host_test_check("Clock synchronisation", ret)
+
+        inf = open(fname, 'rb')
+        recs = struct.unpack('<%dQ' % (3 * rounds), inf.read(3 * rounds * 8))
+        inf.close()
+        recs = [recs[i:i + 3] for i in range(0, 3 * rounds, 3)]
+        stats = ListStats([t1 - t0 for t0, t1, _ in recs])
+
+        point = self._clock_best(recs)
+        self.clock_points.append(point)
+        _, sync_err, drift = self._clock_fit(self.clock_points[0], point)
+
+        twr.out((
+            len(self.clock_points) - 1, rounds,
+            stats.min(), stats.median(), stats.max(), sync_err,
+            (point[1] - self.clock_points[0][1]) / (1000.0 * 1000 * 1000),
+            drift, 16.0 * 1000 / self._tick_ns()))
+        return point
+
+    # Output format for one-way latency tests
+    vis_fmt = [("Test", 9, "%s"),
+               ("Poll", 4, "%s"),       # Read method (H2D_FRESH)
+               ("Attr", 5, "%s"),       # TLP attributes
+               ("WinSZ", 5, "%z"),      # Window size
+               ("Gap(ns)", 8, "%d"),    # Time between samples
+               ("", 0, ""),
+               ("Samples", 8, "%d"),
+               ("Reads", 6, "%.1f"),    # Reads per sample (H2D_FRESH)
+               ("Err(ns)", 8, "%.1f"),  # Clock synchronisation error
+               ("Drift", 8, "%.2f"),    # NFP clock drift (ppm)
+               ("", 0, ""),
+               ("Avg(ns)", 8, "%.1f"), ("Med(ns)", 8, "%d"),
+               ("Min(ns)", 8, "%d"), ("Max(ns)", 8, "%d"),
+               ("95%(ns)", 8, "%d"), ("99%(ns)", 8, "%d"),
+               ]
+
+    def _vis_run(self, test_no, params, opts, samples, rounds, fname,
+                 cpu):
+        """Run a one-way latency test @test_no with @params on the
+        master of slot 0 and the C helper with the additional options
+        @opts.  Returns the results, the pairs of timestamps of the
+        samples (see vis_run() in nfp-pciebench-helper.c) and the
+        clock mapping (see _clock_fit())"""
+        if not self.helper:
+            err("One-way latency tests need the C helper")
+        if not 0 < samples or not 0 < rounds:
+            err("Illegal samples %d or rounds %d" % (samples, rounds))
+        if params[0] & ~(self.FLAGS_RO | self.FLAGS_NS):
+            err("Illegal flags %#08x for one-way latency tests" % params[0])
+
+        self._setup_fw()
+        self.slots = [(0, self.last_me, 0)] + \
+                     [(0, 0, 0)] * (self.SLOTS - 1)
+        self._set_slots()
+        if self.use_xfer:
+            params[0] |= self.FLAGS_XFER
+        self._set_params(params)
+
+        cmd = self.helper + " -n %d -c %s -t %d -N %d -y %s -k %d -o %s " \
+              "%s" % (self.nfp_num, _ME_TEST_CTRL, test_no, samples,
+                      _ME_CLOCK_SYNC, rounds, fname, opts)
+        if cpu is not None:
+            cmd += " -C %d" % cpu
+        ret, _ = _exec_cmd(cmd)
+        self._host_test_check("One-way latency test", ret)
+        _, res = self._get_result()
+
+        num = 6 * rounds + 2 * samples
+        inf = open(fname, 'rb')
+        recs = struct.unpack('<%dQ' % num, inf.read(num * 8))
+        inf.close()
+        before = [recs[i:i + 3] for i in range(0, 3 * rounds, 3)]
+        after = [recs[i:i + 3] for i in range(num - 3 * rounds, num, 3)]
+        pairs = [recs[i:i + 2] for i in range(3 * rounds, num - 3 * rounds, 2)]
+
+        point0 = self._clock_best(before)
+        point1 = self._clock_best(after)
+        self.clock_points += [point0, point1]
+        return res, pairs, self._clock_fit(point0, point1)
+
+    def d2h_test(self, twr, win_sz, samples, interval, rounds, fname,
+                 flags=0, cpu=None):
+        """Run a device to host visibility test (see "One-way latencies"
+        in pciebench.h) with the C helper spinning on the host buffer:
+        @twr:      TableWriter object set up with @vis_fmt
+        @win_sz:   Window size (a multiple of 64)
+        @samples:  Number of samples
+        @interval: Time between samples (in ns)
+        @rounds:   Clock synchronisation rounds before and after the test
+        @fname:    File to write the timestamps to
+        @flags:    Test flags (@FLAGS_RO and @FLAGS_NS only)
+        @cpu:      CPU to pin the helper to
+
+        Returns the one-way latency stats (in ns)
+        """
+        if win_sz % 64 or not 0 < win_sz <= self.SYNC_OFF:
+            err("Window size must be a multiple of 64 up to %d. Was %d" %
+                (self.SYNC_OFF, win_sz))
+
+        dbg("D2HTest: win=%d samples=%d interval=%d rounds=%d flags=%d" %
+            (win_sz, samples, interval, rounds, flags))
+
+        gap = int(interval * self.freq_mhz / 1000)
+        _, pairs, (to_host, sync_err, drift) = self._vis_run(
+            self.D2H_VIS, [flags, 0, win_sz, 0, gap, samples, rounds, 0],
+            "-v %d" % win_sz, samples, rounds, fname, cpu)
+
+        stats = ListStats([seen - to_host(ts) for ts, seen in pairs])
+
+        twr.out((
+            "D2H_VIS", "-", self._attr_str(flags), win_sz, interval,
+            samples, 0, sync_err, drift,
+            stats.avg(), stats.median(), stats.min(), stats.max(),
+            stats.percentile(95), stats.percentile(99)))
+        return stats
+
+    def h2d_test(self, twr, win_sz, samples, interval, rounds, fname,
+                 method=0, flags=0, cpu=None):
+        """Run a host to device freshness test (see "One-way latencies"
+        in pciebench.h) with the C helper writing to the host buffer:
+        @twr:      TableWriter object set up with @vis_fmt
+        @win_sz:   Window size (a multiple of 64)
+        @samples:  Number of samples
+        @interval: Time between the acknowledgement of a sample and the
+                   next write (in ns)
+        @rounds:   Clock synchronisation rounds before and after the test
+        @fname:    File to write the timestamps to
+        @method:   How the NFP polls, one of @FRESH_*
+        @flags:    Test flags (@FLAGS_RO and @FLAGS_NS only)
+        @cpu:      CPU to pin the helper to
+
+        Returns the one-way latency stats (in ns)
+        """
+        if win_sz % 64 or not 0 < win_sz <= self.SYNC_OFF:
+            err("Window size must be a multiple of 64 up to %d. Was %d" %
+                (self.SYNC_OFF, win_sz))
+        if method not in self.FRESH_NAMES:
+            err("Unknown read method %d" % method)
+
+        dbg("H2DTest: win=%d samples=%d interval=%d rounds=%d method=%d "
+            "flags=%d" % (win_sz, samples, interval, rounds, method, flags))
+
+        res, pairs, (to_host, sync_err, drift) = self._vis_run(
+            self.H2D_FRESH, [flags, 0, win_sz, method, 0, samples, rounds, 0],
+            "-v %d -H -g %d" % (win_sz, interval), samples, rounds, fname,
+            cpu)
+
+        stats = ListStats([to_host(ts) - written for written, ts in pairs])
+
+        twr.out((
+            "H2D_FRESH", self.FRESH_NAMES[method], self._attr_str(flags),
+            win_sz, interval, samples, 1.0 * res[2] / samples,
+            sync_err, drift,
+            stats.avg(), stats.median(), stats.min(), stats.max(),
+            stats.percentile(95), stats.percentile(99)))
+        return stats
+
+    # Output format for write coalescing tests
+    coalesce_fmt = [("Attr", 5, "%s"),     # TLP attributes
+                    ("WinSZ", 5, "%z"),    # Window size
+                    ("SZ", 3, "%d"),       # Logical write size
+                    ("MaxSZ", 5, "%d"),    # Maximum DMA size
+                    ("Interval", 8, "%d"), # Cycles between writes
+                    ("Timeout", 8, "%d"),  # Flush timeout in cycles
+                    ("", 0, ""),
+                    ("Writes", 9, "%d"),   # Logical writes
+                    ("DMAs", 9, "%d"),
+                    ("Timeouts", 9, "%d"), # DMAs flushed by the timeout
+                    ("AvgSZ", 6, "%.1f"),  # Average DMA size
+                    ("Offered", 9, "%.3f"), # Offered load (Mwrites/s)
+                    ("Achieved", 9, "%.3f"), # Logical writes (Mwrites/s)
+                    ("", 0, ""),
+                    ("Avg(ns)", 8, "%.1f"), ("Med(ns)", 8, "%d"),
+                    ("Min(ns)", 8, "%d"), ("Max(ns)", 8, "%d"),
+                    ("95%(ns)", 8, "%d"), ("99%(ns)", 8, "%d"),
+                    ]
+
+    def coalesce_test(self, twr, wr_sz, max_sz, interval, timeout, count,
+                      win_sz=64 * 1024, flags=0, mem=0):
+        """Run a write coalescing test (see "Write coalescing" in
+        pciebench.h):
+        @twr:      TableWriter object set up with @coalesce_fmt
+        @wr_sz:    Size of the logical writes (a power of 2, 8 to 64)
+        @max_sz:   Maximum size of the coalesced DMAs (@wr_sz for none)
+        @interval: ME cycles between logical writes (0 for back to back)
+        @timeout:  ME cycles a pending write may be held back
+        @count:    Number of logical writes
+        @win_sz:   Window size (a multiple of 4096)
+        @flags:    Test flags (@FLAGS_RO and @FLAGS_NS only)
+        @mem:      NFP buffer memory, one of @MEM_*
+
+        Returns the stats of the latencies (in cycles) the logical
+        writes saw from their arrival to the completion of their DMA
+        """
+        if wr_sz not in [8, 16, 32, 64]:
+            err("Illegal write size %d" % wr_sz)
+        # Coalesced DMAs are single descriptors (PCIEBENCH_XFER_DMA_SZ)
+        if max_sz < wr_sz or max_sz % wr_sz or \
+           max_sz > (4096 if self.nfp6000 else 2048):
+            err("Illegal maximum DMA size %d" % max_sz)
+        if not win_sz or win_sz % 4096:
+            err("Window size must be a multiple of 4096")
+        if interval < 0 or timeout < 0 or count <= 0:
+            err("Illegal interval, timeout or count")
+        if count > self.JOURNAL_SZ:
+            err("At most %d writes, one journal entry each" %
+                self.JOURNAL_SZ)
+
+        dbg("CoalesceTest: wr_sz=%d max_sz=%d interval=%d timeout=%d "
+            "count=%d win_sz=%d flags=%d" %
+            (wr_sz, max_sz, interval, timeout, count, win_sz, flags))
+
+        cycles, res = self.run_test(
+            self.WR_COALESCE,
+            [flags, wr_sz, win_sz, max_sz, interval, count, timeout, mem])
+
+        self.journal_start = res[1]
+        lat_cyc = [x * 16 for x in self.get_journal(res[3])]
+        stats = ListStats(lat_cyc)
+
+        # The firmware schedules the writes in 16 cycle units
+        period = interval & ~15
+        offered = 1000.0 / self.cyc2ns(period) if period else 0.0
+        achieved = 1000.0 * res[0] / self.cyc2ns(cycles) if cycles else 0.0
+
+        twr.out((
+            self._attr_str(flags), win_sz, wr_sz, max_sz, interval, timeout,
+            res[0], res[2], res[4], 1.0 * wr_sz * res[0] / res[2],
+            offered, achieved,
+            self.cyc2ns(stats.avg()), self.cyc2ns(stats.median()),
+            self.cyc2ns(stats.min()), self.cyc2ns(stats.max()),
+            self.cyc2ns(stats.percentile(95)),
+            self.cyc2ns(stats.percentile(99))))
+        return stats
+
+    # Output format for read completion ordering tests
+    order_fmt = [("Poll", 4, "%s"),       # Read method
+                 ("Attr", 5, "%s"),       # TLP attributes
+                 ("WinSZ", 5, "%z"),      # Window size
+                 ("SZ", 4, "%d"),         # Read size
+                 ("N", 2, "%d"),          # Reads per batch
+                 ("", 0, ""),
+                 ("Reads", 9, "%d"),
+                 ("Reord%", 6, "%.2f"),   # Reads completing out of order
+                 ("Batch%", 6, "%.2f"),   # Batches with reordering
+                 ("Depth", 5, "%d"),      # Largest reorder depth
+                 ("", 0, ""),
+                 ("Avg(ns)", 8, "%.1f"), ("Med(ns)", 8, "%d"),
+                 ("99%(ns)", 8, "%d"),
+                 ("", 0, ""),
+                 ("HoL(ns)", 8, "%.1f"),  # Head-of-line latency
+                 ("HoLMed", 8, "%d"), ("HoL99%", 8, "%d"),
+                 ("Wait(ns)", 8, "%.1f"), # Avg. wait for earlier reads
+                 ]
+
+    def read_order_test(self, twr, method, n, sz, batches,
+                        win_sz=64 * 1024, flags=0, mem=0):
+        """Run a read completion ordering test (see "Read completion
+        ordering" in pciebench.h):
+        @twr:      TableWriter object set up with @order_fmt
+        @method:   How the NFP reads, one of @ORDER_*
+        @n:        Reads outstanding per batch (1 to @ORDER_MAX)
+        @sz:       Read size (a power of 2, 4 for @ORDER_CMD)
+        @batches:  Number of batches
+        @win_sz:   Window size
+        @flags:    Test flags (@FLAGS_RO and @FLAGS_NS only)
+        @mem:      NFP buffer memory, one of @MEM_*
+
+        Returns a tuple of the latency stats, the head-of-line latency
+        stats (both in cycles) and a dict with the number of reads for
+        each reorder depth
+        """
+        if method not in self.ORDER_NAMES:
+            err("Unknown read method %d" % method)
+        if n < 1 or n > self.ORDER_MAX:
+            err("Between 1 and %d outstanding reads supported" %
+                self.ORDER_MAX)
+        if batches < 1 or 2 * n * batches > self.JOURNAL_SZ:
+            err("Between 1 and %d batches supported, two journal entries "
+                "per read" % (self.JOURNAL_SZ // (2 * n)))
+        if sz < 4 or sz & (sz - 1) or \
+           (method == self.ORDER_CMD and not sz == 4):
+            err("Illegal read size %d" % sz)
+        if not win_sz or win_sz % max(sz, 64):
+            err("Illegal window size %d" % win_sz)
+
+        dbg("OrderTest: method=%d n=%d sz=%d batches=%d win_sz=%d "
+            "flags=%d" % (method, n, sz, batches, win_sz, flags))
+
+        _, res = self.run_test(
+            self.READ_ORDER, [flags, sz, win_sz, method, n, batches, 0, mem])
+
+        self.journal_start = res[1]
+        entries = self.get_journal(res[3])
+        lat_cyc = []
+        hol_cyc = []
+        depths = {}
+        for i in range(0, len(entries) - 1, 2):
+            depth = entries[i] >> 24
+            depths[depth] = depths.get(depth, 0) + 1
+            lat_cyc.append((entries[i] & 0xffffff) * 16)
+            hol_cyc.append(entries[i + 1] * 16)
+        stats = ListStats(lat_cyc)
+        hol_stats = ListStats(hol_cyc)
+
+        twr.out((
+            self.ORDER_NAMES[method], self._attr_str(flags), win_sz, sz, n,
+            res[0], 100.0 * res[2] / res[0], 100.0 * res[5] / batches,
+            res[4],
+            self.cyc2ns(stats.avg()), self.cyc2ns(stats.median()),
+            self.cyc2ns(stats.percentile(99)),
+            self.cyc2ns(hol_stats.avg()), self.cyc2ns(hol_stats.median()),
+            self.cyc2ns(hol_stats.percentile(99)),
+            self.cyc2ns(hol_stats.avg() - stats.avg())))
+        return stats, hol_stats, depths
+
+    # Words in struct duplex_spec
+    _DUPLEX_SPEC_WORDS = 4
+
+    # Output format for duplex BW tests
+    duplex_fmt = [("Test", 10, "%s"),   # Benchmark Name
+                  ("PAT", 4, "%s"),     # Access pattern
+                  ("Cache", 7, "%s"),   # Cache warming/thrashing
+                  ("Attr", 5, "%s"),    # TLP attributes
+                  ("HO", 2, "%s"),      # Host offset
+                  ("DO", 2, "%s"),      # Device offset
+                  ("WinSZ", 5, "%z"),   # Window size
+                  ("SZ", 4, "%d"),      # Transaction size
+                  ("RdMEs", 5, "%d"), ("WrMEs", 5, "%d"),
+                  ("", 0, ""),
+                  ("Rd", 8, "%d"),      # Reads
+                  ("Rd(ns)", 10, "%.1f"), # Time until the last read
+                  ("Rd (GB/s)", 9, "%.3f"),
+                  ("", 0, ""),
+                  ("Wr", 8, "%d"),      # Writes
+                  ("Wr(ns)", 10, "%.1f"), # Time until the last write
+                  ("Wr (GB/s)", 9, "%.3f"),
+                  ("", 0, ""),
+                  ("BW (GB/s)", 9, "%.3f"), # Both directions
+                  ]
+
+    def duplex_test(self, twr, flags, win_sz, trans_sz, h_off, d_off,
+                    rd_mes, rd_trans, wr_trans, mem=0):
+        """Run a duplex bandwidth test (see "Duplex bandwidth tests" in
+        pciebench.h), with separate pools of MEs issuing reads and
+        writes at the same time:
+        @twr:      TableWriter object set up with @duplex_fmt
+        @flags:    Test flags. Combination of @FLAGS*
+        @win_sz:   Window size to access
+        @trans_sz: Transaction size
+        @h_off:    Host offset (from the start of a 64B cache line)
+        @d_off:    Device offset (from the start of a 64B cache line)
+        @rd_mes:   Number of worker MEs issuing reads.  The others
+                   issue writes
+        @rd_trans: Number of reads
+        @wr_trans: Number of writes
+        @mem:      NFP buffer memory, one of @MEM_*
+
+        Returns a tuple of the read and write bandwidth (in GB/s)
+        """
+        test_no = self.BW_DMA_RW
+        flags |= self.FLAGS_DUPLEX
+        self._bw_check(test_no, flags, win_sz, trans_sz)
+        self._mem_check(mem, trans_sz, d_off)
+        if flags & self.FLAGS_RATE:
+            err("Duplex tests can't be rate controlled")
+        if self.islands:
+            err("Duplex tests can't use worker islands")
+        if rd_mes < 1 or rd_mes > self.last_me:
+            err("Read pool must have 1 to %d MEs. Was %d" %
+                (self.last_me, rd_mes))
+        if rd_trans < 1 or wr_trans < 1:
+            err("Both pools need at least one transaction")
+
+        dbg("DuplexTest: flags=%d win_sz=%d trans_sz=%d h_off=%d d_off=%d "
+            "rd_mes=%d rd_trans=%d wr_trans=%d" %
+            (flags, win_sz, trans_sz, h_off, d_off,
+             rd_mes, rd_trans, wr_trans))
+
+        self._setup_fw()
+        words = [rd_mes, rd_trans, wr_trans]
+        words += [0] * (self._DUPLEX_SPEC_WORDS - len(words))
+        self._sym_write(_ME_DUPLEX_SPEC, " ".join("0x%x" % w for w in words))
+
+        cycles, res = self.run_test(
+            test_no, [flags, trans_sz, win_sz, h_off, d_off, 0, 0, mem],
+            win_sz if flags & self.FLAGS_HOSTWARM else 0)
+
+        rd_ns = self.cyc2ns(res[4] * 16)
+        wr_ns = self.cyc2ns(res[5] * 16)
+        rd_bw = 8.0 * trans_sz * res[1] / rd_ns
+        wr_bw = 8.0 * trans_sz * res[2] / wr_ns
+        bw = 8.0 * trans_sz * (res[1] + res[2]) / self.cyc2ns(cycles)
+
+        twr.out((
+            self.TEST_NAMES[test_no],
+            "Rand" if flags & self.FLAGS_RANDOM else "Seq",
+            self._cache_str(flags), self._attr_str(flags),
+            h_off, d_off,
+            win_sz, trans_sz,
+            rd_mes, self.last_me + 1 - rd_mes,
+            res[1], rd_ns, rd_bw,
+            res[2], wr_ns, wr_bw,
+            bw))
+        return rd_bw, wr_bw
+
+    @classmethod
+    def size_table(cls, dist):
+        """Turn a size distribution @dist, a list of (size, weight)
+        tuples, into a table of @SIZE_DIST_SZ sizes with each size
+        appearing in proportion to its weight (largest remainder
+        method)."""
+        total = float(sum(w for _, w in dist))
+        if not dist or total <= 0:
+            err("Empty size distribution")
+        shares = [(sz, w * cls.SIZE_DIST_SZ / total) for sz, w in dist]
+        counts = [[sz, int(share), share - int(share)]
+                  for sz, share in shares]
+        left = cls.SIZE_DIST_SZ - sum(c[1] for c in counts)
+        for c in sorted(counts, key=lambda c: -c[2])[:left]:
+            c[1] += 1
+        table = []
+        for sz, cnt, _ in counts:
+            if not cnt:
+                warn("Size %d is too rare for the distribution" % sz)
+            table += [sz] * cnt
+        return table
+
+    # Output format for BW tests with size distributions
+    dist_fmt = [("Test", 10, "%s"),   # Benchmark Name
+                ("PAT", 4, "%s"),     # Access pattern
+                ("Cache", 7, "%s"),   # Cache warming/thrashing
+                ("Attr", 5, "%s"),    # TLP attributes
+                ("Dist", 12, "%s"),   # Name of the size distribution
+                ("HO", 2, "%s"),      # Host offset
+                ("DO", 2, "%s"),      # Device offset
+                ("WinSZ", 5, "%z"),   # Window size
+                ("AvgSZ", 7, "%.1f"), # Average transaction size
+                ("", 0, ""),
+                ("Time(cyc)", 11, "%d"), ("Time", 9, "%t"),
+                ("Bytes", 8, "%z"), ("Trans", 9, "%d"),
+                ("", 0, ""),
+                ("BW (GB/s)", 9, "%.3f"),
+                ("Trans/s", 10, "%.1f"),
+                ]
+
+    def size_dist_test(self, twr, test_no, flags, win_sz, dist, h_off, d_off,
+                       name="", wtwr=None):
+        """Run a bandwidth test with DMA lengths drawn from a size
+        distribution (see "Transaction size distributions" in
+        pciebench.h):
+        @twr:      TableWriter object set up with @dist_fmt
+        @test_no:  Test to run. One of @BW_TESTS
+        @flags:    Test flags. Combination of @FLAGS*
+        @win_sz:   Window size to access
+        @dist:     List of (size, weight) tuples
+        @h_off:    Host offset (from the start of a 64B cache line)
+        @d_off:    Device offset (from the start of a 64B cache line)
+        @name:     Name of the distribution for the report
+        @wtwr:     Optional TableWriter object set up with @worker_fmt
+                   for per worker statistics
+
+        Returns the number of bytes transferred
+        """
+        flags |= self.FLAGS_SIZES
+        table = self.size_table(dist)
+        trans_sz = max(table)
+        self._bw_check(test_no, flags, win_sz, trans_sz)
+        if min(table) <= 0:
+            err("Illegal transaction size %d" % min(table))
+        if flags & self.FLAGS_RATE:
+            err("Size distributions can't be rate controlled")
+        if self.islands:
+            err("Size distributions can't use worker islands")
+
+        dbg("SizeDistTest: %d flags=%d win_sz=%d dist=%s h_off=%d d_off=%d" %
+            (test_no, flags, win_sz, dist, h_off, d_off))
+
+        self._setup_fw()
+        self._sym_write(_ME_SIZE_DIST, " ".join("0x%x" % sz for sz in table))
+
+        cycles, res = self.run_test(
+            test_no, [flags, trans_sz, win_sz, h_off, d_off],
+            win_sz if flags & self.FLAGS_HOSTWARM else 0)
+
+        # The workers count the bytes they transferred
+        tbytes = sum(w[4] for w in self.get_worker_stats())
+        trans = res[0]
+        if test_no == self.BW_DMA_RW:
+            trans = trans / 2
+            tbytes = tbytes / 2
+
+        tavg_ns = self.cyc2ns(cycles)
+        twr.out((
+            self.TEST_NAMES[test_no],
+            "Rand" if flags & self.FLAGS_RANDOM else "Seq",
+            self._cache_str(flags), self._attr_str(flags), name,
+            h_off, d_off, win_sz,
+            float(sum(table)) / len(table),
+            cycles, tavg_ns, tbytes, trans,
+            8.0 * tbytes / tavg_ns,
+            1.0 * trans / (tavg_ns / (1000 * 1000 * 1000))))
+        if wtwr:
+            self._worker_report(wtwr)
+        return tbytes
+
+    def bw_tests(self, twr, tests):
+        """Run a list of bandwidth tests back to back using the test
+        queue (see @run_queue).
+        @twr:      TableWriter object set up with @bw_fmt
+        @tests:    List of (test_no, flags, win_sz, trans_sz, h_off, d_off)
+                   tuples, see @bw_test
+
+        If any test sets @FLAGS_HOSTWARM, the largest window is warmed
+        once before the tests are run.
+        """
+        warm = 0
+        for test_no, flags, win_sz, trans_sz, _, _ in tests:
+            self._bw_check(test_no, flags, win_sz, trans_sz)
+            if flags & self.FLAGS_HOSTWARM:
+                warm = max(warm, win_sz)
+
+        results = self.run_queue(
+            [(test_no, [flags, trans_sz, win_sz, h_off, d_off])
+             for test_no, flags, win_sz, trans_sz, h_off, d_off in tests],
+            warm)
+
+        for test, (cycles, res) in zip(tests, results):
+            self._bw_report(twr, *(list(test) + [cycles, res]))
+        return
+
+    # Words per worker statistics entry (struct worker_stats)
+    _WORKER_STATS_WORDS = 8
+
+    def get_worker_stats(self):
+        """Return the statistics of the worker contexts which took
+        part in the last bandwidth test as a list of
+        (isl, me, ctx, dmas, bytes, first, last) tuples.  @isl is
+        relative to the first island, @first and @last are in ME
+        cycles from the start of the test."""
+        workers = (self.last_me + 1) * 8
+        words = self._WORKER_STATS_WORDS
+        num = (self.islands + 1) * workers
+        mem = self._sym_read(_ME_WORKER_STATS, num * words * 4)
+        res = []
+        for idx in range(num):
+            tmp = struct.unpack_from('<%uI' % words, mem, idx * words * 4)
+            first = ((tmp[3] << 32) + tmp[4]) * 16
+            last = ((tmp[5] << 32) + tmp[6]) * 16
+            if not tmp[0] or first < self.result_start:
+                continue
+            res.append((idx // workers, (idx % workers) // 8, idx % 8,
+                        tmp[0], (tmp[1] << 32) + tmp[2],
+                        first - self.result_start, last - self.result_start))
+        return res
+
+    # Output format for per worker statistics of BW tests.  Rows with
+    # Ctx "all" summarise an ME.
+    worker_fmt = [("Isl", 3, "%d"),    # Island (relative to the first)
+                  ("ME", 2, "%d"),     # ME
+                  ("Ctx", 3, "%s"),    # Context
+                  ("", 0, ""),
+                  ("DMAs", 9, "%d"), ("Bytes", 8, "%z"),
+                  ("Share", 6, "%.3f"), # Fraction of all DMAs
+                  ("", 0, ""),
+                  ("First(cyc)", 11, "%d"), ("Last(cyc)", 11, "%d"),
+                  ("BW (GB/s)", 9, "%.3f"),
+                  ]
+
+    def _worker_report(self, twr):
+        """Write the per context and per ME statistics of the last
+        bandwidth test to @twr (set up with @worker_fmt) and log the
+        spread between contexts and MEs."""
+        workers = self.get_worker_stats()
+        if not workers:
+            warn("No worker statistics")
+            return
+        total = float(sum(w[3] for w in workers))
+
+        def _out(isl, me, ctx, dmas, nbytes, first, last):
+            ns = self.cyc2ns(last - first)
+            twr.out((isl, me, ctx, dmas, nbytes, dmas / total, first, last,
+                     8.0 * nbytes / ns if ns else 0.0))
+
+        mes = {}
+        for isl, me, ctx, dmas, nbytes, first, last in workers:
+            _out(isl, me, str(ctx), dmas, nbytes, first, last)
+            mes.setdefault((isl, me), []).append((dmas, nbytes, first, last))
+
+        me_dmas = []
+        for (isl, me), ctxs in sorted(mes.items()):
+            dmas = sum(c[0] for c in ctxs)
+            me_dmas.append(dmas)
+            _out(isl, me, "all", dmas, sum(c[1] for c in ctxs),
+                 min(c[2] for c in ctxs), max(c[3] for c in ctxs))
+
+        ctx_dmas = ListStats([w[3] for w in workers])
+        lasts = [w[6] for w in workers]
+        log("DMAs per context: min=%d avg=%.1f max=%d, per ME: min=%d max=%d" %
+            (ctx_dmas.min(), ctx_dmas.avg(), ctx_dmas.max(),
+             min(me_dmas), max(me_dmas)))
+        log("Last worker finished %d cycles after the first" %
+            (max(lasts) - min(lasts)))
+        return
+
+    def _bw_check(self, test_no, flags, win_sz, trans_sz):
+        """Sanity check the arguments of a bandwidth test"""
         if not test_no in self.BW_TESTS:
             err("%s is not a bandwidth test" % test_no)
-        if self.nfp6000 and (trans_sz > 4096):
-            err("For NFP-6000 the transaction must be less than 4096")
-        if not self.nfp6000 and (trans_sz > 2048):
-            err("For NFP-3200 the transaction must be less than 2048")
+        if trans_sz > self.MAX_TRANS_SZ:
+            err("DMA transactions must be at most %d bytes" %
+                self.MAX_TRANS_SZ)
         if win_sz % 64:
             err("Window size must be a multiple of 64. Was %d" % win_sz)
         if flags & ~self.FLAGS:
@@ -595,10 +2437,9 @@ class NFPBench(object):
         if bin(flags & self._FLAGS_CACHE).count("1") > 1:
             err("Only one cache related flag may be set")
 
-        cycles, res = self.run_test(
-            test_no, [flags, trans_sz, win_sz, h_off, d_off],
-            win_sz if flags & self.FLAGS_HOSTWARM else 0)
-
+    def _bw_report(self, twr, test_no, flags, win_sz, trans_sz,
+                   h_off, d_off, cycles, res):
+        """Write a summary line of a finished bandwidth test to @twr"""
         trans = res[0]
         if test_no == self.BW_DMA_RW:
             trans = trans / 2
@@ -610,20 +2451,54 @@ class NFPBench(object):
         bw = 8.0 * tbytes / tavg_ns
         rate = 1.0 * trans / (tavg_ns / (1000 * 1000 * 1000))
 
-        cache_str = "Cold"
-        if flags & self.FLAGS_WARM:
-            cache_str = "DWarm"
-        if flags & self.FLAGS_THRASH:
-            cache_str = "DThrash"
-        if flags & self.FLAGS_HOSTWARM:
-            cache_str = "HWarm"
-
         twr.out((
             self.TEST_NAMES[test_no],
             "Rand" if flags & self.FLAGS_RANDOM else "Seq",
-            cache_str,
+            self._cache_str(flags), self._attr_str(flags),
             h_off, d_off,
             win_sz, trans_sz,
             tavg_cyc, tavg_ns, tbytes, trans,
             bw, rate))
         return
+
+    def interference_test(self, lat_twr, bw_twr, lat_args, bw_args,
+                          bw_mes=None, bw_host_off=None):
+        """Run a latency test on ME0 while a bandwidth test runs on the
+        remaining MEs.
+        @lat_twr:     TableWriter object set up with @lat_fmt
+        @bw_twr:      TableWriter object set up with @bw_fmt
+        @lat_args:    (test_no, flags, win_sz, trans_sz, h_off, d_off)
+                      of the latency test
+        @bw_args:     (test_no, flags, win_sz, trans_sz, h_off, d_off)
+                      of the bandwidth test
+        @bw_mes:      (first, last) MEs for the bandwidth test.
+                      Defaults to all worker MEs but ME0.
+        @bw_host_off: Offset into the host buffer for the bandwidth test.
+                      Defaults to the second half of the buffer.
+
+        Returns the latency stats of the latency test
+        """
+        lat_no, lat_flags, lat_win, lat_sz, lat_hoff, lat_doff = lat_args
+        bw_no, bw_flags, bw_win, bw_sz, bw_hoff, bw_doff = bw_args
+        if bw_mes is None:
+            bw_mes = (1, self.last_me)
+        if bw_host_off is None:
+            bw_host_off = int(self.MAX_MEM / 2)
+
+        self._lat_check(lat_no, lat_flags, lat_win, lat_sz)
+        self._bw_check(bw_no, bw_flags, bw_win, bw_sz)
+        if (lat_flags | bw_flags) & self.FLAGS_HOSTWARM:
+            err("Host cache warming not supported for concurrent tests")
+        if lat_win > bw_host_off or bw_host_off + bw_win > self.MAX_MEM:
+            err("Test windows overlap or exceed the host buffer")
+
+        (lat_cyc, lat_res), (bw_cyc, bw_res) = self.run_concurrent([
+            (lat_no, [lat_flags, lat_sz, lat_win, lat_hoff, lat_doff],
+             0, 0, 0),
+            (bw_no, [bw_flags, bw_sz, bw_win, bw_hoff, bw_doff],
+             bw_mes[0], bw_mes[1], bw_host_off)])
+
+        self._bw_report(bw_twr, bw_no, bw_flags, bw_win, bw_sz,
+                        bw_hoff, bw_doff, bw_cyc, bw_res)
+        return self._lat_report(lat_twr, lat_no, lat_flags, lat_win, lat_sz,
+                                lat_hoff, lat_doff, lat_cyc, lat_res)
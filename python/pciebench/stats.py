@@ -15,6 +15,7 @@
 
 """A collection of stats functions"""
 
+import bisect
 import math
 import sys
 
@@ -76,6 +77,66 @@ class ListStats(object):
                 res[val] += 1
         return res
 
+class HistStats(object):
+    """Statistics on a histogram (a dictionary with values as keys
+    and #occurrences as values).  Provides the same statistics as
+    ListStats for data sets too large to keep as a list."""
+
+    def __init__(self, histo):
+        """Initialise a stats object with a histogram"""
+        self.histo = histo
+        self.vals = sorted(histo.keys())
+        self.cum = []
+        total = 0
+        for val in self.vals:
+            total += histo[val]
+            self.cum.append(total)
+        self.total = total
+
+    def count(self):
+        """Return the number of values"""
+        return self.total
+
+    def count_above(self, limit):
+        """Return the number of values larger than @limit"""
+        return sum(self.histo[val] for val in self.vals if val > limit)
+
+    def avg(self):
+        """Return the average of the values."""
+        if not self.total:
+            return 0.0
+        return float(sum(val * self.histo[val] for val in self.vals)) / \
+            self.total
+
+    def _nth(self, idx):
+        """Return the @idx-th smallest value (0 based)"""
+        return self.vals[bisect.bisect_right(self.cum, idx)]
+
+    def median(self):
+        """Return the median of the values."""
+        return self.percentile(50)
+
+    def min(self):
+        """Return the minimum value"""
+        return self.vals[0]
+
+    def max(self):
+        """Return the maximum value"""
+        return self.vals[-1]
+
+    def percentile(self, percentile):
+        """Return the nth the percentile, interpolated like ListStats"""
+        if not self.total:
+            return 0
+        idx = (self.total - 1) * (percentile / 100.0)
+        floor = math.floor(idx)
+        ceil = math.ceil(idx)
+        if floor == ceil:
+            return self._nth(int(idx))
+        val0 = self._nth(int(floor)) * (ceil - idx)
+        val1 = self._nth(int(ceil)) * (idx - floor)
+        return val0 + val1
+
 def histo2cdf(histo):
     """Convert a histogram dictionary into a CDF.
     Returns a dictionary with values as keys and the CDF as values.
@@ -94,6 +155,47 @@ def histo2cdf(histo):
         res[val] = cdf_frac
     return res
 
+def spike_clusters(timeline, threshold, gap):
+    """Find clusters of spikes in a @timeline, a list of (time, value)
+    tuples sorted by time.  Spikes are values above @threshold and
+    spikes less than @gap apart belong to the same cluster.
+    Returns a list of (start, end, number of spikes, largest value)
+    tuples"""
+    res = []
+    for time, val in timeline:
+        if val <= threshold:
+            continue
+        if res and time - res[-1][1] < gap:
+            start, _, num, top = res[-1]
+            res[-1] = (start, time, num + 1, max(top, val))
+        else:
+            res.append((time, time, 1, val))
+    return res
+
+def periodicity(times, tolerance=0.05):
+    """Check if the events at @times (sorted) recur periodically.  The
+    period candidate is the median interval between events.  Intervals
+    within @tolerance (relative to the period) of a multiple of it
+    count as regular.  Returns the period, refined from the regular
+    intervals, and the fraction of regular intervals, or (None, 0.0)
+    for fewer than three events"""
+    intervals = [t1 - t0 for t0, t1 in zip(times, times[1:])]
+    if len(intervals) < 2:
+        return None, 0.0
+    period = ListStats(intervals).median()
+    if period <= 0:
+        return None, 0.0
+
+    regular = []
+    for ival in intervals:
+        mult = int(round(float(ival) / period))
+        if mult and abs(ival - mult * period) <= tolerance * period:
+            regular.append(float(ival) / mult)
+    if not regular:
+        return period, 0.0
+    return (sum(regular) / len(regular),
+            float(len(regular)) / len(intervals))
+
 def pp_list(inlist, perl=10):
     """Pretty print a large list. @perl says how many items per line"""
     cnt = 0
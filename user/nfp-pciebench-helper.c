@@ -15,15 +15,21 @@
  * limitations under the License.
  */
 
+#define _GNU_SOURCE
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 
+#include <endian.h>
 #include <fcntl.h>
+#include <sched.h>
+#include <time.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdint.h>
+#include <stddef.h>
 #include <inttypes.h>
 #include <getopt.h>
 #include <errno.h>
@@ -35,6 +41,68 @@
 #define ARRAY_SIZE(arr) (sizeof(arr)/sizeof(*(arr)))
 #endif
 
+/* Maximum number of test slots (see PCIEBENCH_SLOTS) */
+#define MAX_SLOTS 4
+
+/* Number of 32bit entries in the stream ring (see PCIEBENCH_STREAM_SZ) */
+#define STREAM_ENTRIES (16 * 1024 * 1024)
+
+/* Test slot as set up by the host (see struct test_slot) */
+struct test_slot {
+    uint32_t me_first;
+    uint32_t me_last;
+    uint32_t host_off;
+    uint32_t islands;
+};
+
+/* Stream state as maintained by the NFP (see struct stream_state) */
+struct stream_state {
+    uint32_t ctrl;
+    uint32_t prod;
+    uint32_t drained;
+    uint32_t cons;
+    uint32_t lost;
+    uint32_t base;
+};
+#define STREAM_IDLE 0
+
+/* The structures below are shared with the NFP through host memory and
+ * consist of 32 bit little endian words (see "Byte order" in
+ * pciebench.h), hence the htole32()/le32toh() on every access. */
+
+/* Host descriptor ring (see "Host descriptor ring" in pciebench.h).
+ * All offsets are relative to the host window of the test slot.  The
+ * buffer of descriptor i is the 4K page at RING_BUF_OFF + i * 4K. */
+#define RING_MAX 4096
+#define RING_CMPL_OFF (RING_MAX * 16)
+#define RING_BUF_OFF (4 * 1024 * 1024)
+
+struct ring_desc {
+    uint32_t seq;
+    uint32_t off;
+    uint32_t len;
+    uint32_t reserved;
+};
+
+struct ring_cmpl {
+    uint32_t seq;
+    uint32_t ts;
+};
+
+/* Clock synchronisation and one-way latencies (see "Clock
+ * synchronisation" in pciebench.h).  The NFP DMAs timestamps for the
+ * synchronisation to SYNC_OFF and acknowledges host writes at
+ * ACK_OFF. */
+#define SYNC_OFF (4 * 1024 * 1024 - 4096)
+#define ACK_OFF (SYNC_OFF + 64)
+
+struct clock_stamp {
+    uint32_t seq;
+    uint32_t ts_hi;
+    uint32_t ts_lo;
+    uint32_t reserved;
+};
+
 void usage(const char *program)
 {
     printf("Usage: "
@@ -48,8 +116,39 @@ void usage(const char *program)
            "\n"
            "  -n NFP        NFP number.\n"
            "  -c TEST_CTRL  Symbol name for test control.\n"
-           "  -t TEST       Test to run.\n"
+           "  -s SLOT       Test slot for the following -t options.\n"
+           "  -t TEST       Test to run. May be repeated with different\n"
+           "                slots to start several tests concurrently.\n"
            "  -w WIN        Warm a window of WIN size.\n"
+           "  -j FILE       Consume the streamed journal into FILE.\n"
+           "  -r STREAM     Symbol name for the stream state (with -j).\n"
+           "  -e ENTRIES    Produce descriptors into a ring of ENTRIES\n"
+           "                entries and reap their completions while the\n"
+           "                test (RING_DESC) runs.\n"
+           "  -S SLOTS      Symbol name for the test slots, to find the\n"
+           "                host window of the ring (with -e).\n"
+           "  -b BATCH      Descriptors per batch (with -e).\n"
+           "  -N COUNT      Number of descriptors (with -e) or samples\n"
+           "                (with -v).\n"
+           "  -l LEN        Buffer length of each descriptor (with -e).\n"
+           "  -d DOORBELL   Symbol name for the doorbell, which is rung\n"
+           "                after each batch (with -e, none to poll).\n"
+           "  -o FILE       Write the round trip time of each descriptor\n"
+           "                (in ns, 32 bit) to FILE (with -e) or the\n"
+           "                timestamps (64 bit) to FILE (with -v or -k).\n"
+           "  -v WIN        Wait for COUNT timestamps DMAed to a window\n"
+           "                of WIN size while the test (D2H_VIS, host\n"
+           "                offset 0) runs.\n"
+           "  -H            Instead write COUNT values to the window and\n"
+           "                wait for the NFP to see each (H2D_FRESH,\n"
+           "                with -v).\n"
+           "  -g GAP        Wait GAP ns between the writes (with -H).\n"
+           "  -y SYNC       Symbol name for the clock synchronisation\n"
+           "                requests (with -v or -k).\n"
+           "  -k ROUNDS     Clock synchronisation rounds before and after\n"
+           "                the test (with -v), or of the test\n"
+           "                (CLOCK_SYNC, host offset 0) on its own.\n"
+           "  -C CPU        Pin to CPU.\n"
            "  -h            Show this help message and exit.\n"
            "\n", program);
     exit(1);
@@ -110,18 +209,435 @@ warm_cache(int nfp_no, int win_sz)
     close(fd);
 }
 
+/*
+ * Copy entries from the stream ring, from @*cons up to @drained, to
+ * @out and advance @*cons.
+ */
+static void
+stream_copy(int fd, FILE *out, uint32_t *cons, uint32_t drained)
+{
+    static uint32_t buf[256 * 1024];
+    uint32_t n, idx;
+    ssize_t len;
+
+    while (*cons != drained) {
+        idx = *cons % STREAM_ENTRIES;
+        n = drained - *cons;
+        if (n > STREAM_ENTRIES - idx)
+            n = STREAM_ENTRIES - idx;
+        if (n > ARRAY_SIZE(buf))
+            n = ARRAY_SIZE(buf);
+
+        len = pread(fd, buf, n * sizeof(uint32_t), idx * sizeof(uint32_t));
+        if (len != n * sizeof(uint32_t)) {
+            perror("Failed to read stream ring");
+            exit(1);
+        }
+        if (fwrite(buf, sizeof(uint32_t), n, out) != n) {
+            perror("Failed to write stream file");
+            exit(1);
+        }
+        *cons += n;
+    }
+}
+
+/*
+ * Consume the streamed journal into @fname until all tests finished
+ * and the stream was drained.
+ */
+static void
+stream_consume(struct nfp_device *nfp, const struct nfp_rtsym *ctrl_sym,
+               const struct nfp_rtsym *stream_sym, int nfp_no,
+               const char *fname, int *slots, int num_tests)
+{
+    struct stream_state state;
+    uint32_t cons = 0;
+    int running, ctrl, i;
+    char fn[256];
+    FILE *out;
+    int fd;
+
+    snprintf(fn, sizeof(fn), "/proc/pciebench_xfer-%d", nfp_no);
+    fd = open(fn, O_RDONLY);
+    if (fd < 0) {
+        perror("Failed to open stream ring");
+        exit(1);
+    }
+
+    out = fopen(fname, "w");
+    if (!out) {
+        perror("Failed to open stream file");
+        exit(1);
+    }
+
+    do {
+        usleep(1000);
+
+        /* Check the tests first so that a final state read below
+         * covers all entries. */
+        running = 0;
+        for (i = 0; i < num_tests; i++) {
+            nfp_rtsym_read(nfp, ctrl_sym, &ctrl, sizeof(ctrl),
+                           slots[i] * sizeof(ctrl));
+            if (ctrl > 0)
+                running++;
+        }
+
+        nfp_rtsym_read(nfp, stream_sym, &state, sizeof(state), 0);
+        stream_copy(fd, out, &cons, state.drained);
+        nfp_rtsym_write(nfp, stream_sym, &cons, sizeof(cons),
+                        offsetof(struct stream_state, cons));
+    } while (running || state.ctrl != STREAM_IDLE);
+
+    if (state.lost)
+        fprintf(stderr, "Stream lost %u entries\n", state.lost);
+
+    fclose(out);
+    close(fd);
+}
+
+static uint64_t
+now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*
+ * Host side of the descriptor ring test: Produce @count descriptors in
+ * batches of @batch into the ring of @entries entries, ring the
+ * doorbell after each batch (if @db_sym is set) and reap the
+ * completions, until all descriptors completed.  The ring lives in the
+ * host window of @slot starting at @host_off.  The round trip time of
+ * each descriptor is written to @fname.
+ */
+static void
+ring_run(struct nfp_device *nfp, const struct nfp_rtsym *ctrl_sym,
+         const struct nfp_rtsym *db_sym, int nfp_no, int slot,
+         uint32_t host_off, uint32_t entries, uint32_t batch,
+         uint32_t count, uint32_t len, const char *fname)
+{
+    volatile struct ring_desc *descs;
+    volatile struct ring_cmpl *cmpls;
+    uint32_t prod = 0, reaped = 0, idle = 0;
+    uint32_t n, i, idx;
+    uint64_t *t_prod;
+    uint32_t *rtt;
+    size_t map_sz;
+    int ctrl, progress;
+    char fn[256];
+    void *map;
+    FILE *out;
+    int fd;
+
+    snprintf(fn, sizeof(fn), "/proc/pciebench_buffer-%d", nfp_no);
+    fd = open(fn, O_RDWR);
+    if (fd < 0) {
+        perror("Failed to open host buffer file");
+        exit(1);
+    }
+
+    map_sz = RING_CMPL_OFF + RING_MAX * sizeof(struct ring_cmpl);
+    map = mmap(NULL, map_sz, PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+               host_off);
+    if (map == MAP_FAILED) {
+        perror("Failed to map host buffer");
+        exit(1);
+    }
+    descs = map;
+    cmpls = (void *)((char *)map + RING_CMPL_OFF);
+
+    t_prod = calloc(count, sizeof(*t_prod));
+    rtt = calloc(count, sizeof(*rtt));
+    if (!t_prod || !rtt) {
+        perror("Failed to allocate ring state");
+        exit(1);
+    }
+
+    while (reaped < count) {
+        /* Produce the next batch, if the ring has room for all of it */
+        n = count - prod;
+        if (n > batch)
+            n = batch;
+        if (n && prod + n - reaped <= entries) {
+            for (i = 0; i < n; i++, prod++) {
+                idx = prod & (entries - 1);
+                descs[idx].off = htole32(RING_BUF_OFF + idx * 4096);
+                descs[idx].len = htole32(len);
+                t_prod[prod] = now_ns();
+                /* The sequence number last, it makes the entry valid */
+                __atomic_store_n(&descs[idx].seq, htole32(prod + 1),
+                                 __ATOMIC_RELEASE);
+            }
+            if (db_sym) {
+                __atomic_thread_fence(__ATOMIC_SEQ_CST);
+                nfp_rtsym_write(nfp, db_sym, &prod, sizeof(prod),
+                                slot * sizeof(prod));
+            }
+        }
+
+        /* Reap completions */
+        progress = 0;
+        while (reaped < prod &&
+               le32toh(__atomic_load_n(&cmpls[reaped & (entries - 1)].seq,
+                                       __ATOMIC_ACQUIRE)) == reaped + 1) {
+            rtt[reaped] = now_ns() - t_prod[reaped];
+            reaped++;
+            progress = 1;
+        }
+
+        /* Every now and then, check the test did not stop early */
+        if (progress) {
+            idle = 0;
+        } else if (++idle == (1 << 20)) {
+            idle = 0;
+            nfp_rtsym_read(nfp, ctrl_sym, &ctrl, sizeof(ctrl),
+                           slot * sizeof(ctrl));
+            if (ctrl <= 0) {
+                fprintf(stderr, "Test stopped after %u of %u descriptors\n",
+                        reaped, count);
+                exit(1);
+            }
+        }
+    }
+
+    /* Wait for the test to record its results */
+    do {
+        usleep(1000);
+        nfp_rtsym_read(nfp, ctrl_sym, &ctrl, sizeof(ctrl),
+                       slot * sizeof(ctrl));
+    } while (ctrl > 0);
+
+    out = fopen(fname, "w");
+    if (!out) {
+        perror("Failed to open round trip time file");
+        exit(1);
+    }
+    if (fwrite(rtt, sizeof(*rtt), count, out) != count) {
+        perror("Failed to write round trip time file");
+        exit(1);
+    }
+    fclose(out);
+
+    free(rtt);
+    free(t_prod);
+    munmap(map, map_sz);
+    close(fd);
+}
+
+/*
+ * Spin until @*seq becomes @val.  Every now and then, check the test
+ * did not stop early.
+ */
+static void
+seq_wait(struct nfp_device *nfp, const struct nfp_rtsym *ctrl_sym, int slot,
+         volatile uint32_t *seq, uint32_t val)
+{
+    uint32_t idle = 0;
+    int ctrl;
+
+    while (le32toh(__atomic_load_n(seq, __ATOMIC_ACQUIRE)) != val) {
+        if (++idle < (1 << 20))
+            continue;
+        idle = 0;
+        nfp_rtsym_read(nfp, ctrl_sym, &ctrl, sizeof(ctrl),
+                       slot * sizeof(ctrl));
+        if (ctrl <= 0) {
+            fprintf(stderr, "Test stopped waiting for %u\n", val);
+            exit(1);
+        }
+    }
+}
+
+/*
+ * Run @rounds clock synchronisation rounds, numbered from @first, with
+ * the NFP DMAing its timestamps to @stamp.  Record the host time
+ * before the request, the host time the timestamp was seen and the NFP
+ * timestamp in @rec for each round.
+ */
+static void
+clock_sync(struct nfp_device *nfp, const struct nfp_rtsym *ctrl_sym,
+           const struct nfp_rtsym *sync_sym, int slot,
+           volatile struct clock_stamp *stamp, uint32_t first,
+           uint32_t rounds, uint64_t *rec)
+{
+    uint32_t i;
+
+    for (i = first; i < first + rounds; i++, rec += 3) {
+        rec[0] = now_ns();
+        nfp_rtsym_write(nfp, sync_sym, &i, sizeof(i), slot * sizeof(i));
+        seq_wait(nfp, ctrl_sym, slot, &stamp->seq, i);
+        rec[1] = now_ns();
+        rec[2] = (uint64_t)le32toh(stamp->ts_hi) << 32 |
+            le32toh(stamp->ts_lo);
+    }
+}
+
+/*
+ * Host side of the one-way latency tests: Synchronise the clocks, then
+ * for each of the @count samples in the window of @win bytes either
+ * spin on its cache line and record the NFP timestamp and the host
+ * time it became visible (device to host), or, if @h2d is set, record
+ * the host time, write the sample and record the NFP timestamp the
+ * NFP acknowledged it with, @gap ns after the previous one.  Then
+ * synchronise the clocks again.  The records are written to @fname as
+ * 64 bit values: @rounds triplets (see clock_sync()), @count pairs and
+ * @rounds triplets.  Without a window (@win is 0) only synchronise the
+ * clocks once (CLOCK_SYNC) and write the @rounds triplets.
+ */
+static void
+vis_run(struct nfp_device *nfp, const struct nfp_rtsym *ctrl_sym,
+        const struct nfp_rtsym *sync_sym, int nfp_no, int slot,
+        uint32_t win, uint32_t count, uint32_t rounds, int h2d,
+        uint32_t gap, const char *fname)
+{
+    volatile struct clock_stamp *line, *stamp, *ack;
+    size_t map_sz, num;
+    uint64_t *rec, *sample;
+    uint64_t next = 0;
+    uint32_t i;
+    char fn[256];
+    void *map;
+    FILE *out;
+    int ctrl;
+    int fd;
+
+    snprintf(fn, sizeof(fn), "/proc/pciebench_buffer-%d", nfp_no);
+    fd = open(fn, O_RDWR);
+    if (fd < 0) {
+        perror("Failed to open host buffer file");
+        exit(1);
+    }
+
+    map_sz = SYNC_OFF + 4096;
+    map = mmap(NULL, map_sz, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        perror("Failed to map host buffer");
+        exit(1);
+    }
+    stamp = (void *)((char *)map + SYNC_OFF);
+    ack = (void *)((char *)map + ACK_OFF);
+
+    num = (win ? 6 : 3) * rounds + 2 * count;
+    rec = calloc(num, sizeof(*rec));
+    if (!rec) {
+        perror("Failed to allocate timestamps");
+        exit(1);
+    }
+
+    clock_sync(nfp, ctrl_sym, sync_sym, slot, stamp, 1, rounds, rec);
+
+    sample = rec + 3 * rounds;
+    for (i = 1; i <= count; i++, sample += 2) {
+        line = (void *)((char *)map + ((i - 1) * 64) % win);
+        if (!h2d) {
+            seq_wait(nfp, ctrl_sym, slot, &line->seq, i);
+            sample[1] = now_ns();
+            sample[0] = (uint64_t)le32toh(line->ts_hi) << 32 |
+                le32toh(line->ts_lo);
+            continue;
+        }
+
+        while (now_ns() < next)
+            ;
+        sample[0] = now_ns();
+        __atomic_store_n(&line->seq, htole32(i), __ATOMIC_SEQ_CST);
+        seq_wait(nfp, ctrl_sym, slot, &ack->seq, i);
+        sample[1] = (uint64_t)le32toh(ack->ts_hi) << 32 |
+            le32toh(ack->ts_lo);
+        next = now_ns() + gap;
+    }
+
+    if (win)
+        clock_sync(nfp, ctrl_sym, sync_sym, slot, stamp, rounds + 1,
+                   rounds, sample);
+
+    /* Wait for the test to record its results */
+    do {
+        usleep(1000);
+        nfp_rtsym_read(nfp, ctrl_sym, &ctrl, sizeof(ctrl),
+                       slot * sizeof(ctrl));
+    } while (ctrl > 0);
+
+    out = fopen(fname, "w");
+    if (!out) {
+        perror("Failed to open timestamp file");
+        exit(1);
+    }
+    if (fwrite(rec, sizeof(*rec), num, out) != num) {
+        perror("Failed to write timestamp file");
+        exit(1);
+    }
+    fclose(out);
+
+    free(rec);
+    munmap(map, map_sz);
+    close(fd);
+}
+
+/*
+ * Zero @len bytes at @off of the host buffer
+ */
+static void
+buf_zero(int nfp_no, off_t off, size_t len)
+{
+    static char zero[64 * 1024];
+    char fn[256];
+    size_t n;
+    int fd;
+
+    snprintf(fn, sizeof(fn), "/proc/pciebench_buffer-%d", nfp_no);
+    fd = open(fn, O_WRONLY | O_SYNC);
+    if (fd < 0) {
+        perror("Failed to open host buffer file");
+        exit(1);
+    }
+    for (; len; off += n, len -= n) {
+        n = len < sizeof(zero) ? len : sizeof(zero);
+        if (pwrite(fd, zero, n, off) != n) {
+            perror("Failed to zero host buffer");
+            exit(1);
+        }
+    }
+    close(fd);
+}
+
 int
 main(int argc, char *argv[])
 {
     char *cp;
     int r;
-    int opt_nfp = 0, opt_test = -1, opt_win = 0;
+    int opt_nfp = 0, opt_slot = 0, opt_win = 0;
+    int opt_slots[MAX_SLOTS], opt_tests[MAX_SLOTS];
+    int num_tests = 0;
+    int ctrl, running, i;
     char opt_ctrl[256];
+    char opt_stream[256] = "";
+    char *opt_journal = NULL;
+    uint32_t opt_entries = 0, opt_batch = 1, opt_count = 0, opt_len = 0;
+    char opt_doorbell[256] = "";
+    char opt_slots_sym[256] = "";
+    struct test_slot slot;
+    char *opt_rtt = NULL;
+    uint32_t opt_vis = 0, opt_rounds = 0, opt_gap = 0;
+    int opt_h2d = 0;
+    char opt_sync[256] = "";
+    int opt_cpu = -1;
+    struct stream_state state;
+    uint32_t zero = 0, host_off = 0;
+    cpu_set_t cpus;
 
     struct nfp_device *nfp;
     const struct nfp_rtsym *sym;
+    const struct nfp_rtsym *stream_sym = NULL;
+    const struct nfp_rtsym *db_sym = NULL;
+    const struct nfp_rtsym *slots_sym = NULL;
+    const struct nfp_rtsym *sync_sym = NULL;
 
-    while ((r = getopt(argc, argv, "n:c:t:w:h")) != -1) {
+    while ((r = getopt(argc, argv,
+                       "n:c:s:t:w:j:r:e:S:b:N:l:d:o:v:Hg:y:k:C:h")) != -1) {
         switch(r) {
         case 'n':
             opt_nfp = strtoul(optarg, &cp, 0);
@@ -133,10 +649,19 @@ main(int argc, char *argv[])
             strncpy(opt_ctrl, optarg, sizeof(opt_ctrl));
             break;
 
+        case 's':
+            opt_slot = strtoul(optarg, &cp, 0);
+            if ((cp == optarg) || (*cp != 0) || (opt_slot >= MAX_SLOTS))
+                usage(argv[0]);
+            break;
+
         case 't':
-            opt_test = strtoul(optarg, &cp, 0);
+            if (num_tests == MAX_SLOTS)
+                usage(argv[0]);
+            opt_tests[num_tests] = strtoul(optarg, &cp, 0);
             if ((cp == optarg) || (*cp != 0))
                 usage(argv[0]);
+            opt_slots[num_tests++] = opt_slot;
             break;
 
         case 'w':
@@ -145,14 +670,112 @@ main(int argc, char *argv[])
                 usage(argv[0]);
             break;
 
+        case 'j':
+            opt_journal = optarg;
+            break;
+
+        case 'r':
+            strncpy(opt_stream, optarg, sizeof(opt_stream));
+            break;
+
+        case 'e':
+            opt_entries = strtoul(optarg, &cp, 0);
+            if ((cp == optarg) || (*cp != 0) || !opt_entries ||
+                (opt_entries & (opt_entries - 1)) || opt_entries > RING_MAX)
+                usage(argv[0]);
+            break;
+
+        case 'S':
+            strncpy(opt_slots_sym, optarg, sizeof(opt_slots_sym));
+            break;
+
+        case 'b':
+            opt_batch = strtoul(optarg, &cp, 0);
+            if ((cp == optarg) || (*cp != 0) || !opt_batch)
+                usage(argv[0]);
+            break;
+
+        case 'N':
+            opt_count = strtoul(optarg, &cp, 0);
+            if ((cp == optarg) || (*cp != 0))
+                usage(argv[0]);
+            break;
+
+        case 'l':
+            opt_len = strtoul(optarg, &cp, 0);
+            if ((cp == optarg) || (*cp != 0) || opt_len > 4096)
+                usage(argv[0]);
+            break;
+
+        case 'd':
+            strncpy(opt_doorbell, optarg, sizeof(opt_doorbell));
+            break;
+
+        case 'o':
+            opt_rtt = optarg;
+            break;
+
+        case 'v':
+            opt_vis = strtoul(optarg, &cp, 0);
+            if ((cp == optarg) || (*cp != 0) || !opt_vis ||
+                (opt_vis % 64) || opt_vis > SYNC_OFF)
+                usage(argv[0]);
+            break;
+
+        case 'H':
+            opt_h2d = 1;
+            break;
+
+        case 'g':
+            opt_gap = strtoul(optarg, &cp, 0);
+            if ((cp == optarg) || (*cp != 0))
+                usage(argv[0]);
+            break;
+
+        case 'y':
+            strncpy(opt_sync, optarg, sizeof(opt_sync));
+            break;
+
+        case 'k':
+            opt_rounds = strtoul(optarg, &cp, 0);
+            if ((cp == optarg) || (*cp != 0))
+                usage(argv[0]);
+            break;
+
+        case 'C':
+            opt_cpu = strtoul(optarg, &cp, 0);
+            if ((cp == optarg) || (*cp != 0))
+                usage(argv[0]);
+            break;
+
         default:
             usage(argv[0]);
             break;
         }
     }
 
-    if (opt_test == -1)
+    if (num_tests == 0 || (opt_journal && !opt_stream[0]))
         usage(argv[0]);
+    if (opt_entries && (!opt_count || !opt_rtt || opt_journal ||
+                        !opt_slots_sym[0] || opt_batch > opt_entries / 2))
+        usage(argv[0]);
+    if (opt_vis && (!opt_count || !opt_rtt || opt_journal || opt_entries ||
+                    (opt_rounds && !opt_sync[0])))
+        usage(argv[0]);
+    if (opt_h2d && !opt_vis)
+        usage(argv[0]);
+    if (opt_rounds && !opt_vis && (!opt_sync[0] || !opt_rtt || opt_count ||
+                                   opt_journal || opt_entries))
+        usage(argv[0]);
+
+    if (opt_cpu >= 0) {
+        CPU_ZERO(&cpus);
+        CPU_SET(opt_cpu, &cpus);
+        if (sched_setaffinity(0, sizeof(cpus), &cpus)) {
+            perror("Failed to pin to CPU");
+            return -1;
+        }
+    }
 
 
     nfp = nfp_device_open(opt_nfp);
@@ -167,6 +790,60 @@ main(int argc, char *argv[])
         return -1;
     }
 
+    if (opt_journal) {
+        stream_sym = nfp_rtsym_lookup(nfp, opt_stream);
+        if (!stream_sym) {
+            perror("Lookup stream symbol");
+            return -1;
+        }
+        /* Start with a clean stream state */
+        memset(&state, 0, sizeof(state));
+        nfp_rtsym_write(nfp, stream_sym, &state, sizeof(state), 0);
+    }
+
+    if (opt_entries) {
+        slots_sym = nfp_rtsym_lookup(nfp, opt_slots_sym);
+        if (!slots_sym) {
+            perror("Lookup test slots symbol");
+            return -1;
+        }
+        nfp_rtsym_read(nfp, slots_sym, &slot, sizeof(slot),
+                       opt_slots[0] * sizeof(slot));
+        host_off = slot.host_off;
+        if (host_off % sysconf(_SC_PAGESIZE)) {
+            fprintf(stderr, "Host window at %#x is not page aligned\n",
+                    host_off);
+            return -1;
+        }
+        if (opt_doorbell[0]) {
+            db_sym = nfp_rtsym_lookup(nfp, opt_doorbell);
+            if (!db_sym) {
+                perror("Lookup doorbell symbol");
+                return -1;
+            }
+            nfp_rtsym_write(nfp, db_sym, &zero, sizeof(zero),
+                            opt_slots[0] * sizeof(zero));
+        }
+        buf_zero(opt_nfp, host_off,
+                 RING_CMPL_OFF + RING_MAX * sizeof(struct ring_cmpl));
+    }
+
+    if (opt_vis || opt_rounds) {
+        if (opt_rounds) {
+            sync_sym = nfp_rtsym_lookup(nfp, opt_sync);
+            if (!sync_sym) {
+                perror("Lookup clock synchronisation symbol");
+                return -1;
+            }
+            nfp_rtsym_write(nfp, sync_sym, &zero, sizeof(zero),
+                            opt_slots[0] * sizeof(zero));
+        }
+        if (opt_vis)
+            buf_zero(opt_nfp, 0, opt_vis);
+        buf_zero(opt_nfp, SYNC_OFF, ACK_OFF - SYNC_OFF +
+                 sizeof(struct clock_stamp));
+    }
+
     /* Always thrash the cache */
     thrash_cache();
 
@@ -174,15 +851,41 @@ main(int argc, char *argv[])
     if (opt_win)
         warm_cache(opt_nfp, opt_win);
 
-    /* start the test */
-    nfp_rtsym_write(nfp, sym, &opt_test, sizeof(opt_test), 0);
+    /* start the test(s) in the order given */
+    for (i = 0; i < num_tests; i++)
+        nfp_rtsym_write(nfp, sym, &opt_tests[i], sizeof(opt_tests[i]),
+                        opt_slots[i] * sizeof(ctrl));
 
-    /* Poll for the test to finish */
-    while (opt_test > 0) {
-        sleep(2);
-        nfp_rtsym_read(nfp, sym, &opt_test, sizeof(opt_test), 0);
+    if (opt_journal) {
+        stream_consume(nfp, sym, stream_sym, opt_nfp, opt_journal,
+                       opt_slots, num_tests);
+        return 0;
     }
 
+    if (opt_entries) {
+        ring_run(nfp, sym, db_sym, opt_nfp, opt_slots[0], host_off,
+                 opt_entries, opt_batch, opt_count, opt_len, opt_rtt);
+        return 0;
+    }
+
+    if (opt_vis || opt_rounds) {
+        vis_run(nfp, sym, sync_sym, opt_nfp, opt_slots[0], opt_vis,
+                opt_count, opt_rounds, opt_h2d, opt_gap, opt_rtt);
+        return 0;
+    }
+
+    /* Poll for the test(s) to finish */
+    do {
+        sleep(2);
+        running = 0;
+        for (i = 0; i < num_tests; i++) {
+            nfp_rtsym_read(nfp, sym, &ctrl, sizeof(ctrl),
+                           opt_slots[i] * sizeof(ctrl));
+            if (ctrl > 0)
+                running++;
+        }
+    } while (running);
+
     return 0;
 }
 